@@ -1,45 +1,143 @@
 #include "BinaryReader.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
 BinaryReader::BinaryReader(const char* path) {
-    stream = new std::ifstream(path, std::ios_base::binary);
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fail = true;
+        return;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(fileHandle, &fileSize);
+    file = fileHandle;
+    size = (size_t)fileSize.QuadPart;
+    if (size == 0) return; //can't map an empty file
+
+    HANDLE mapHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapHandle == nullptr) {
+        size = 0;
+        fail = true;
+        return;
+    }
+    mapping = mapHandle;
+    data = (const char*)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fail = true;
+        return;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size = (size_t)st.st_size;
+    if (size > 0) {
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED) {
+            data = (const char*)view;
+            mapping = view;
+        }
+    }
+    close(fd); //the mapping keeps the file alive
+#endif
+    if (size > 0 && data == nullptr) {
+        size = 0;
+        fail = true;
+    }
+}
+
+BinaryReader::BinaryReader(std::span<const char> bytes) {
+    data = bytes.data();
+    size = bytes.size();
 }
 
 BinaryReader::~BinaryReader() {
-    delete stream;
+#ifdef _WIN32
+    if (data != nullptr && mapping != nullptr) UnmapViewOfFile(data);
+    if (mapping != nullptr) CloseHandle((HANDLE)mapping);
+    if (file != nullptr) CloseHandle((HANDLE)file);
+#else
+    if (mapping != nullptr) munmap(mapping, size);
+#endif
 }
 
 void BinaryReader::Seek(int offset){
-    stream->seekg(offset, std::ios_base::cur);
+    if (offset < 0 && (size_t)-(long long)offset > pos) {
+        pos = 0;
+        fail = true;
+    }
+    else SeekTo(pos + offset);
 }
 
-void BinaryReader::Read(char* buffer, int size) {
-    stream->read(buffer, size);
+void BinaryReader::SeekTo(size_t newPos) {
+    if (newPos > size) {
+        newPos = size;
+        fail = true;
+    }
+    pos = newPos;
+}
+
+void BinaryReader::Read(char* buffer, int count) {
+    if (count < 0) {
+        fail = true;
+        return;
+    }
+    size_t available = size - pos;
+    size_t n = (size_t)count;
+    if (n > available) {
+        std::memset(buffer + available, 0, n - available);
+        n = available;
+        fail = true;
+    }
+    if (n > 0) std::memcpy(buffer, data + pos, n);
+    pos += n;
 }
 
 int BinaryReader::Pos()
 {
-    return (int)stream->tellg();
+    return (int)pos;
+}
+
+std::span<const char> BinaryReader::Span(size_t count) {
+    size_t available = size - pos;
+    if (count > available) {
+        count = available;
+        fail = true;
+    }
+    std::span<const char> view(data + pos, count);
+    pos += count;
+    return view;
 }
 
 BinaryReader& operator>>(BinaryReader& reader, unsigned char& c) {
-    reader.stream->read((char*)&c, 1);
+    c = reader.Read<unsigned char>();
     return reader;
 }
 
 BinaryReader& operator>>(BinaryReader& reader, unsigned short& s) {
-    reader.stream->read((char*)&s, 2);
+    s = reader.Read<unsigned short>();
     return reader;
 }
 BinaryReader& operator >>(BinaryReader& reader, unsigned int& i) {
-    reader.stream->read((char*)&i, 4);
+    i = reader.Read<unsigned int>();
     return reader;
 }
 BinaryReader& operator >>(BinaryReader& reader, unsigned long long& l) {
-    reader.stream->read((char*)&l, 8);
+    l = reader.Read<unsigned long long>();
     return reader;
 }
 BinaryReader& operator >>(BinaryReader& reader, float& f) {
-    reader.stream->read((char*)&f, 4);
+    f = reader.Read<float>();
     return reader;
-}
\ No newline at end of file
+}
@@ -1,16 +1,55 @@
-#include <fstream>
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <span>
 
+//reads little endian data either from a memory mapped file or from a caller owned byte span
+//reads past the end zero fill and set the fail flag instead of throwing, like ifstream did
 class BinaryReader {
 public:
-    std::ifstream* stream;
-
     BinaryReader(const char* path);
+    BinaryReader(std::span<const char> bytes); //does not take ownership, bytes must outlive the reader
     ~BinaryReader();
 
+    BinaryReader(const BinaryReader&) = delete;
+    BinaryReader& operator=(const BinaryReader&) = delete;
+
 
     void Seek(int offset);
+    void SeekTo(size_t pos);
     void Read(char* buffer, int size);
     int Pos();
+
+    //view of the next size bytes, advances past them. shorter than size if it runs off the end
+    std::span<const char> Span(size_t size);
+    //whole file, for callers that want to index it directly
+    std::span<const char> Bytes() const { return { data, size }; }
+
+    size_t Size() const { return size; }
+    size_t Remaining() const { return size - pos; }
+    bool Good() const { return !fail; }
+
+    template<typename T> T Read() {
+        T value;
+        if (size - pos >= sizeof(T)) {
+            std::memcpy(&value, data + pos, sizeof(T));
+            pos += sizeof(T);
+        }
+        else {
+            Read((char*)&value, sizeof(T));
+        }
+        return value;
+    }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool fail = false;
+
+    //platform handles, only set when we mapped the file ourselves
+    void* file = nullptr;
+    void* mapping = nullptr;
 };
 
 BinaryReader& operator >> (BinaryReader& reader, unsigned char& c);
@@ -1,19 +1,26 @@
 #include "EsoWorld.h"
+#include <algorithm>
+#include <bit>
+#include <filesystem>
 #include <iostream>
 
 char* Eso::World::WorldTocFilename(unsigned int world) {
-    char* buffer = new char[20];
+    char* buffer = new char[21]; //16 hex digits, .dat and the terminator
     sprintf(buffer, "%016llX.dat", 0x4400000000000000ULL | world);
     return buffer;
 }
 
 char* Eso::World::WorldCellFilename(unsigned int world, unsigned int layer, unsigned int x, unsigned int y) {
-    char* buffer = new char[20];
-    sprintf(buffer, "%016llX.dat", 0x4000000000000000ULL | ((world & 0x7FFULL) << 37) | ((layer & 0x1FULL) << 32) | ((x & 0xFFFFULL) << 16) | (y & 0xFFFFULL));
+    char* buffer = new char[21]; //16 hex digits, .dat and the terminator
+    sprintf(buffer, "%016llX.dat", CellId(world, layer, x, y));
     return buffer;
 }
 
-Eso::Toc::Toc(char* path) {
+unsigned long long Eso::World::CellId(unsigned int world, unsigned int layer, unsigned int x, unsigned int y) {
+    return 0x4000000000000000ULL | ((world & 0x7FFULL) << 37) | ((layer & 0x1FULL) << 32) | ((x & 0xFFFFULL) << 16) | (y & 0xFFFFULL);
+}
+
+Eso::Toc::Toc(const char* path) {
     BinaryReader reader(path);
     //stream.seekg(4, std::ios_base::cur);
     std::cout << "POS " << reader.Pos() << "\n";
@@ -35,58 +42,156 @@ Eso::Toc::Toc(char* path) {
     */
 }
 
+Eso::CellIndex::CellIndex(const Toc& toc, unsigned int world, const char* directory) {
+    this->world = world;
+    sizeX = toc.sizeX;
+    sizeY = toc.sizeY;
+
+    //the rest of the toc isn't understood yet, so list the directory once and decode the cell ids from the filenames
+    std::vector<unsigned long long> found;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() != 20 || name.compare(16, 4, ".dat") != 0) continue;
+        char* end;
+        unsigned long long id = strtoull(name.c_str(), &end, 16);
+        if (end != name.c_str() + 16) continue;
+        if ((id & 0xFFFF000000000000ULL) != 0x4000000000000000ULL) continue; //not a cell, the toc is 0x44...
+        if (((id >> 37) & 0x7FF) != (world & 0x7FF)) continue;
+        found.push_back(id);
+        //grow the grid if the toc is missing or smaller than what's on disk
+        sizeX = std::max(sizeX, (unsigned int)((id >> 16) & 0xFFFF) + 1);
+        sizeY = std::max(sizeY, (unsigned int)(id & 0xFFFF) + 1);
+    }
+    if (error) std::cout << "Could not list world directory " << directory << ": " << error.message() << "\n";
 
-Eso::FixtureFile::FixtureFile(char* path) {
+    size_t words = ((size_t)sizeX * sizeY + 63) / 64;
+    for (unsigned long long id : found) {
+        unsigned int layer = (id >> 32) & 0x1F;
+        unsigned int x = (id >> 16) & 0xFFFF;
+        unsigned int y = id & 0xFFFF;
+        if (layer >= layers.size()) layers.resize(layer + 1);
+        if (layers[layer].empty()) layers[layer].resize(words, 0);
+        size_t bit = (size_t)y * sizeX + x;
+        layers[layer][bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+size_t Eso::CellIndex::Count(unsigned int layer) const {
+    if (layer >= layers.size()) return 0;
+    size_t count = 0;
+    for (unsigned long long word : layers[layer]) count += std::popcount(word);
+    return count;
+}
+
+
+Eso::FixtureFile::FixtureFile(const char* path) {
     BinaryReader reader(path);
+    Parse(reader);
+}
+
+Eso::FixtureFile::FixtureFile(BinaryReader& reader) {
+    Parse(reader);
+}
+
+void Eso::FixtureFile::Parse(BinaryReader& reader) {
     reader >> version >> fixtureCount;
     //std::cout << "Fixture Cell Version " << version << "\n";
     std::cout << fixtureCount << " Fixtures\n";
 
-    fixtures = new Fixture[fixtureCount];
-    for (unsigned int i = 0; i < fixtureCount; i++) {
-        reader >> fixtures[i].id;
-        reader.Seek(8);
-        reader >> fixtures[i].rotX >> fixtures[i].rotY >> fixtures[i].rotZ >> 
-            fixtures[i].x >> fixtures[i].y >> fixtures[i].z;
-        reader.Seek(12); //fixture header end
-        reader.Seek(16); //static start
+    //record layout: id, 8 skipped, rot xyz, pos xyz, 12 header end, 16 static start, model, 8 skipped (+16 if version != 22)
+    const size_t stride = RecordStride(version);
+    if ((size_t)fixtureCount * stride > reader.Remaining()) {
+        std::cout << "Fixture file truncated, expected " << fixtureCount << " fixtures\n";
+        fixtureCount = (unsigned int)(reader.Remaining() / stride);
+    }
+    const char* records = reader.Span((size_t)fixtureCount * stride).data();
 
-        reader >> fixtures[i].model;
-        reader.Seek(8);
-        if (version != 22) reader.Seek(16);
+    ids.resize(fixtureCount);
+    x.resize(fixtureCount); y.resize(fixtureCount); z.resize(fixtureCount);
+    rotX.resize(fixtureCount); rotY.resize(fixtureCount); rotZ.resize(fixtureCount);
+    models.resize(fixtureCount);
+
+    for (size_t i = 0; i < fixtureCount; i++) {
+        const char* record = records + i * stride;
+        float rot[3];
+        float pos[3];
+        std::memcpy(&ids[i], record, 8);
+        std::memcpy(rot, record + 16, 12);
+        std::memcpy(pos, record + 28, 12);
+        std::memcpy(&models[i], record + 68, 4);
+        rotX[i] = rot[0]; rotY[i] = rot[1]; rotZ[i] = rot[2];
+        x[i] = pos[0]; y[i] = pos[1]; z[i] = pos[2];
     }
 }
 
+Eso::FixtureSpan Eso::FixtureFile::View() const {
+    FixtureSpan view;
+    view.count = fixtureCount;
+    view.ids = ids;
+    view.x = x; view.y = y; view.z = z;
+    view.rotX = rotX; view.rotY = rotY; view.rotZ = rotZ;
+    view.models = models;
+    return view;
+}
+
+Eso::Fixture Eso::FixtureSpan::operator[](size_t i) const {
+    Fixture fixture;
+    fixture.id = ids[i];
+    fixture.x = x[i]; fixture.y = y[i]; fixture.z = z[i];
+    fixture.rotX = rotX[i]; fixture.rotY = rotY[i]; fixture.rotZ = rotZ[i];
+    fixture.model = models[i];
+    return fixture;
+}
+
 Eso::TerrainLayer::TerrainLayer() {
     type = 0;
     rowSize = 0;
     rowCount = 0;
+    rowStride = 0;
+    rows = nullptr;
     data = nullptr;
 }
 
 void Eso::TerrainLayer::Read(BinaryReader& r, unsigned int type) {
     this->type = type;
+    //checks its own bounds, the reader's fail flag is sticky and may be left over from another layer
+    bool fits = r.Remaining() >= 16;
     r.Seek(4);
     r >> rowCount;
     r.Seek(4);
     r >> rowSize;
-    data = new char[rowCount * rowSize];
-    for (unsigned int i = 0; i < rowCount; i++) {
-        r.Seek(2);
-        r.Read(data + i * rowSize, rowSize);
-
-        //
+    //each row is a 2 byte prefix followed by the row data, then 4 bytes after the last one
+    size_t rowBytes = (size_t)rowCount * ((size_t)rowSize + 2);
+    fits = fits && rowSize <= 0xFFFFFFFD && rowBytes <= r.Remaining() && r.Remaining() - rowBytes >= 4;
+    if (!fits) {
+        std::cout << "Terrain layer " << type << " truncated\n";
+        rowCount = 0;
+        rowStride = 0;
+        rows = nullptr;
+        return;
     }
+    rowStride = rowSize + 2;
+    rows = r.Span(rowBytes).data() + 2;
     r.Seek(4);
 }
 
+const char* Eso::TerrainLayer::Data() {
+    if (rowStride == rowSize) return rows;
+    if (data == nullptr && rowCount > 0) {
+        data = new char[(size_t)rowCount * rowSize];
+        for (unsigned int i = 0; i < rowCount; i++) {
+            std::memcpy(data + (size_t)i * rowSize, rows + (size_t)i * rowStride, rowSize);
+        }
+    }
+    return data;
+}
+
 Eso::TerrainLayer::~TerrainLayer() {
-    if(rowSize > 0)
     delete[] data;
 }
 
-Eso::TerrainFile::TerrainFile(const char* path) {
-    BinaryReader reader(path);
+Eso::TerrainFile::TerrainFile(const char* path) : reader(path) {
     reader >> version;
     reader.Seek(7);
     reader >> layerCount;
@@ -96,16 +201,69 @@ Eso::TerrainFile::TerrainFile(const char* path) {
         reader >> layerSizes[i];
     }
     reader.Seek(82);
-    layers = new TerrainLayer[layerCount];
+
+    //walk the layer headers to find where each one starts, without touching the row data
+    layerOffsets = new size_t[layerCount];
     for (int i = 0; i < layerCount; i++) {
-        if (layerSizes[i] != 0) {
-            //std::cout << "Reading layer " << i << "\n";
-            layers[i].Read(reader, i);
+        layerOffsets[i] = 0;
+        if (layerSizes[i] == 0) continue;
+        layerOffsets[i] = reader.Pos();
+        unsigned int rowCount = 0, rowSize = 0;
+        bool fits = reader.Remaining() >= 16;
+        reader.Seek(4);
+        reader >> rowCount;
+        reader.Seek(4);
+        reader >> rowSize;
+        size_t layerBytes = (size_t)rowCount * ((size_t)rowSize + 2);
+        fits = fits && rowSize <= 0xFFFFFFFD && layerBytes <= reader.Remaining() && reader.Remaining() - layerBytes >= 4;
+        if (!fits) {
+            //nothing after a bad header can be found, those layers read as empty
+            std::cout << "Terrain file " << path << " truncated at layer " << i << "\n";
+            for (int j = i; j < layerCount; j++) {
+                layerSizes[j] = 0;
+                layerOffsets[j] = 0;
+            }
+            break;
         }
+        reader.SeekTo((size_t)reader.Pos() + layerBytes + 4);
+    }
+
+    layers = new TerrainLayer[layerCount];
+    layerLoaded = new bool[layerCount]();
+}
+
+Eso::TerrainFile::TerrainFile(std::span<const char> cooked) : reader(cooked) {
+    //version, layer count, 5 pad, then 32 byte layer entries: type, rowSize, rowCount, original size, offset, pad
+    reader >> version >> layerCount;
+    reader.Seek(5);
+    layerSizes = new unsigned int[layerCount];
+    layerOffsets = new size_t[layerCount];
+    layers = new TerrainLayer[layerCount];
+    layerLoaded = new bool[layerCount];
+    for (int i = 0; i < layerCount; i++) {
+        unsigned long long offset;
+        reader >> layers[i].type >> layers[i].rowSize >> layers[i].rowCount >> layerSizes[i] >> offset;
+        reader.Seek(8);
+        layers[i].rowStride = layers[i].rowSize;
+        layers[i].rows = cooked.data() + offset;
+        layerOffsets[i] = (size_t)offset;
+        layerLoaded[i] = true;
+    }
+}
+
+Eso::TerrainLayer* Eso::TerrainFile::Layer(int i) {
+    if (i < 0 || i >= layerCount || layerSizes[i] == 0) return nullptr;
+    if (!layerLoaded[i]) {
+        reader.SeekTo(layerOffsets[i]);
+        layers[i].Read(reader, i);
+        layerLoaded[i] = true;
     }
+    return &layers[i];
 }
 
 Eso::TerrainFile::~TerrainFile() {
-    delete layerSizes;
+    delete[] layerSizes;
+    delete[] layerOffsets;
     delete[] layers;
+    delete[] layerLoaded;
 }
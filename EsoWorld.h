@@ -1,19 +1,42 @@
 #pragma once
 #include "BinaryReader.h"
+#include <span>
+#include <vector>
 
 namespace Eso {
+    enum class CellKind { Fixture, Terrain };
+
     class World
     {
     public:
         static char* WorldTocFilename(unsigned int world);
         static char* WorldCellFilename(unsigned int world, unsigned int layer, unsigned int x, unsigned int y);
+        static unsigned long long CellId(unsigned int world, unsigned int layer, unsigned int x, unsigned int y);
     };
 
     struct Toc {
         unsigned int sizeX;
         unsigned int sizeY;
 
-        Toc(char* path);
+        Toc(const char* path);
+    };
+
+    //which cells exist on disk, one bitset per layer over the sizeX x sizeY grid
+    //built from a single directory listing so existence checks never touch the filesystem
+    struct CellIndex {
+        unsigned int world;
+        unsigned int sizeX;
+        unsigned int sizeY;
+        std::vector<std::vector<unsigned long long>> layers; //indexed by layer, bit y * sizeX + x
+
+        CellIndex(const Toc& toc, unsigned int world, const char* directory);
+
+        bool Exists(unsigned int layer, unsigned int x, unsigned int y) const {
+            if (layer >= layers.size() || x >= sizeX || y >= sizeY || layers[layer].empty()) return false;
+            size_t bit = (size_t)y * sizeX + x;
+            return (layers[layer][bit >> 6] >> (bit & 63)) & 1;
+        }
+        size_t Count(unsigned int layer) const;
     };
 
     struct Fixture {
@@ -23,34 +46,79 @@ namespace Eso {
         unsigned int model;
     };
 
+    //read only view over fixture arrays, one span per field
+    struct FixtureSpan {
+        size_t count = 0;
+        std::span<const unsigned long long> ids;
+        std::span<const float> x, y, z;
+        std::span<const float> rotX, rotY, rotZ;
+        std::span<const unsigned int> models;
+
+        Fixture operator[](size_t i) const;
+    };
+
+    //fixtures are stored as structure of arrays so culling and instancing can stream one field at a time
     struct FixtureFile {
         unsigned int version;
         unsigned int fixtureCount;
-        Fixture* fixtures;
+        std::vector<unsigned long long> ids;
+        std::vector<float> x, y, z;
+        std::vector<float> rotX, rotY, rotZ;
+        std::vector<unsigned int> models;
+
+        FixtureFile(const char* path);
+        FixtureFile(BinaryReader& reader);
 
-        FixtureFile(char* path);
+        FixtureSpan View() const;
+        Fixture operator[](size_t i) const { return View()[i]; }
+
+        //records are a fixed size per version
+        static unsigned int RecordStride(unsigned int version) { return version == 22 ? 80 : 96; }
+
+    private:
+        void Parse(BinaryReader& reader);
     };
 
+    //rows are a strided view into the file, in loose files every row has a 2 byte prefix
     struct TerrainLayer {
         unsigned int type;
         unsigned int rowSize;
         unsigned int rowCount;
-        char* data;
+        unsigned int rowStride;
+        const char* rows;
 
         TerrainLayer();
         void Read(BinaryReader& r, unsigned int type);
         ~TerrainLayer();
+
+        std::span<const char> Row(unsigned int row) const { return { rows + (size_t)row * rowStride, rowSize }; }
+        //contiguous rowCount * rowSize grid, only copies if the rows are strided
+        const char* Data();
+
+    private:
+        char* data;
     };
 
+    //only the header is read up front, layers are located lazily on first access
     struct TerrainFile {
         unsigned short version;
         unsigned char layerCount;
         unsigned int* layerSizes;
-        TerrainLayer* layers;
+        size_t* layerOffsets; //0 for empty layers
 
         TerrainFile(const char* path);
+        //cooked terrain blob from a WorldArchive, layers are contiguous and ready immediately
+        TerrainFile(std::span<const char> cooked);
         ~TerrainFile();
-    };
 
+        //nullptr for empty layers. not thread safe, the first call for a layer fills it in
+        TerrainLayer* Layer(int i);
+        size_t MappedSize() const { return reader.Size(); }
+
+    private:
+        BinaryReader reader;
+        TerrainLayer* layers;
+        bool* layerLoaded;
+    };
 
 }
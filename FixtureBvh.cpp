@@ -0,0 +1,266 @@
+#include "FixtureBvh.h"
+#include <algorithm>
+#include <cfloat>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FIXTURE_BVH_SSE
+#endif
+
+namespace {
+    struct Bounds {
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        void Grow(float x, float y, float z, float r) {
+            min[0] = std::min(min[0], x - r); max[0] = std::max(max[0], x + r);
+            min[1] = std::min(min[1], y - r); max[1] = std::max(max[1], y + r);
+            min[2] = std::min(min[2], z - r); max[2] = std::max(max[2], z + r);
+        }
+    };
+
+    //splits [begin, end) at the median of the longest centroid axis
+    size_t SplitMedian(std::vector<unsigned int>& order, size_t begin, size_t end, const Eso::FixtureSpan& fixtures) {
+        Bounds centroids;
+        for (size_t i = begin; i < end; i++) centroids.Grow(fixtures.x[order[i]], fixtures.y[order[i]], fixtures.z[order[i]], 0.f);
+        int axis = 0;
+        float extent = centroids.max[0] - centroids.min[0];
+        for (int a = 1; a < 3; a++) {
+            if (centroids.max[a] - centroids.min[a] > extent) {
+                extent = centroids.max[a] - centroids.min[a];
+                axis = a;
+            }
+        }
+        std::span<const float> key = axis == 0 ? fixtures.x : axis == 1 ? fixtures.y : fixtures.z;
+        size_t middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+            [&key](unsigned int a, unsigned int b) { return key[a] < key[b]; });
+        return middle;
+    }
+
+    //bitmask of the 4 boxes that are completely behind some plane
+    unsigned int BoxesOutside(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ, const float planes[6][4]) {
+#ifdef FIXTURE_BVH_SSE
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            //the corner furthest along the normal, if that's behind the plane the whole box is
+            const float* plane = planes[p];
+            __m128 x = _mm_load_ps(plane[0] >= 0.f ? maxX : minX);
+            __m128 y = _mm_load_ps(plane[1] >= 0.f ? maxY : minY);
+            __m128 z = _mm_load_ps(plane[2] >= 0.f ? maxZ : minZ);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane[0])), _mm_mul_ps(y, _mm_set1_ps(plane[1]))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+        }
+        return (unsigned int)_mm_movemask_ps(outside);
+#else
+        unsigned int outside = 0;
+        for (int i = 0; i < 4; i++) {
+            for (int p = 0; p < 6; p++) {
+                const float* plane = planes[p];
+                float d = plane[0] * (plane[0] >= 0.f ? maxX[i] : minX[i]) + plane[1] * (plane[1] >= 0.f ? maxY[i] : minY[i])
+                    + plane[2] * (plane[2] >= 0.f ? maxZ[i] : minZ[i]) + plane[3];
+                if (d < 0.f) outside |= 1 << i;
+            }
+        }
+        return outside;
+#endif
+    }
+
+    //bitmask of the 4 boxes that the sphere touches
+    unsigned int BoxesTouching(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ, float x, float y, float z, float radius) {
+#ifdef FIXTURE_BVH_SSE
+        __m128 zero = _mm_setzero_ps();
+        __m128 cx = _mm_set1_ps(x), cy = _mm_set1_ps(y), cz = _mm_set1_ps(z);
+        __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(minX), cx), _mm_sub_ps(cx, _mm_load_ps(maxX))), zero);
+        __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(minY), cy), _mm_sub_ps(cy, _mm_load_ps(maxY))), zero);
+        __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(minZ), cz), _mm_sub_ps(cz, _mm_load_ps(maxZ))), zero);
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(distance, _mm_set1_ps(radius * radius)));
+#else
+        unsigned int touching = 0;
+        for (int i = 0; i < 4; i++) {
+            float dx = std::max(std::max(minX[i] - x, x - maxX[i]), 0.f);
+            float dy = std::max(std::max(minY[i] - y, y - maxY[i]), 0.f);
+            float dz = std::max(std::max(minZ[i] - z, z - maxZ[i]), 0.f);
+            if (dx * dx + dy * dy + dz * dz <= radius * radius) touching |= 1 << i;
+        }
+        return touching;
+#endif
+    }
+}
+
+void Eso::FixtureBvh::AddCell(unsigned long long cellId, const FixtureSpan& fixtures, std::span<const float> radii) {
+    RemoveCell(cellId);
+    auto tree = std::make_unique<CellTree>();
+    tree->id = cellId;
+    tree->count = fixtures.count;
+    Bounds bounds;
+    for (size_t i = 0; i < fixtures.count; i++) bounds.Grow(fixtures.x[i], fixtures.y[i], fixtures.z[i], i < radii.size() ? radii[i] : 0.f);
+    for (int a = 0; a < 3; a++) {
+        tree->min[a] = bounds.min[a];
+        tree->max[a] = bounds.max[a];
+    }
+
+    if (fixtures.count > 0) {
+        std::vector<unsigned int> order(fixtures.count);
+        for (size_t i = 0; i < order.size(); i++) order[i] = (unsigned int)i;
+        tree->nodes.reserve(fixtures.count / 8 + 1);
+        Build(*tree, order, 0, order.size(), fixtures, radii);
+    }
+
+    fixtureCount += fixtures.count;
+    cellSlots[cellId] = cells.size();
+    cells.push_back(std::move(tree));
+}
+
+void Eso::FixtureBvh::RemoveCell(unsigned long long cellId) {
+    auto it = cellSlots.find(cellId);
+    if (it == cellSlots.end()) return;
+    size_t slot = it->second;
+    fixtureCount -= cells[slot]->count;
+    cellSlots.erase(it);
+    //swap with the last cell so the list stays dense
+    if (slot != cells.size() - 1) {
+        cells[slot] = std::move(cells.back());
+        cellSlots[cells[slot]->id] = slot;
+    }
+    cells.pop_back();
+}
+
+void Eso::FixtureBvh::Clear() {
+    cells.clear();
+    cellSlots.clear();
+    fixtureCount = 0;
+}
+
+int Eso::FixtureBvh::Build(CellTree& tree, std::vector<unsigned int>& order, size_t begin, size_t end,
+    const FixtureSpan& fixtures, std::span<const float> radii) {
+    int nodeIndex = (int)tree.nodes.size();
+    tree.nodes.emplace_back();
+
+    //two median splits make up to 4 children
+    size_t bounds[5] = { begin, begin, begin, begin, end };
+    size_t middle = SplitMedian(order, begin, end, fixtures);
+    bounds[2] = middle;
+    bounds[1] = middle - begin > LeafSize ? SplitMedian(order, begin, middle, fixtures) : middle;
+    bounds[3] = end - middle > LeafSize ? SplitMedian(order, middle, end, fixtures) : end;
+
+    Node node = {};
+    for (int c = 0; c < 4; c++) {
+        size_t childBegin = bounds[c], childEnd = bounds[c + 1];
+        Bounds childBounds;
+        if (childBegin == childEnd) {
+            //empty, masked out by valid, the bounds just need to be finite
+            node.minX[c] = node.minY[c] = node.minZ[c] = node.maxX[c] = node.maxY[c] = node.maxZ[c] = 0.f;
+            continue;
+        }
+        for (size_t i = childBegin; i < childEnd; i++) {
+            unsigned int f = order[i];
+            childBounds.Grow(fixtures.x[f], fixtures.y[f], fixtures.z[f], f < radii.size() ? radii[f] : 0.f);
+        }
+        node.minX[c] = childBounds.min[0]; node.minY[c] = childBounds.min[1]; node.minZ[c] = childBounds.min[2];
+        node.maxX[c] = childBounds.max[0]; node.maxY[c] = childBounds.max[1]; node.maxZ[c] = childBounds.max[2];
+        node.valid |= 1 << c;
+
+        if (childEnd - childBegin <= LeafSize) {
+            //leaf, fixtures copied out in a padded run of 4 so the leaf test can load them straight
+            int first = (int)tree.x.size();
+            for (size_t i = childBegin; i < childBegin + LeafSize; i++) {
+                bool used = i < childEnd;
+                unsigned int f = used ? order[i] : 0;
+                tree.x.push_back(used ? fixtures.x[f] : 0.f);
+                tree.y.push_back(used ? fixtures.y[f] : 0.f);
+                tree.z.push_back(used ? fixtures.z[f] : 0.f);
+                tree.radius.push_back(used && f < radii.size() ? radii[f] : 0.f);
+                if (used) tree.index.push_back(f);
+                else tree.index.push_back(0xFFFFFFFF);
+            }
+            node.child[c] = ~first;
+            node.count[c] = (unsigned char)(childEnd - childBegin);
+        }
+        else {
+            node.child[c] = Build(tree, order, childBegin, childEnd, fixtures, radii);
+        }
+    }
+    tree.nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+void Eso::FixtureBvh::QueryFrustum(const float planes[6][4], std::vector<Hit>& hits) const {
+    std::vector<int> stack;
+    for (const std::unique_ptr<CellTree>& cell : cells) {
+        const CellTree& tree = *cell;
+        if (tree.nodes.empty()) continue;
+        //whole cell first, the same test with one real lane
+        alignas(16) float cellBounds[6][4] = {};
+        for (int a = 0; a < 3; a++) {
+            cellBounds[a][0] = tree.min[a];
+            cellBounds[a + 3][0] = tree.max[a];
+        }
+        if (BoxesOutside(cellBounds[0], cellBounds[1], cellBounds[2], cellBounds[3], cellBounds[4], cellBounds[5], planes) & 1) continue;
+
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+            const Node& node = tree.nodes[stack.back()];
+            stack.pop_back();
+            unsigned int inside = node.valid & ~BoxesOutside(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, planes);
+            for (int c = 0; c < 4; c++) {
+                if (!(inside & (1 << c))) continue;
+                if (node.count[c] == 0) {
+                    stack.push_back(node.child[c]);
+                    continue;
+                }
+                //leaf, test the fixture spheres 4 at a time as degenerate boxes grown by their radius
+                int first = ~node.child[c];
+                alignas(16) float leafBounds[6][4];
+                for (int i = 0; i < 4; i++) {
+                    float r = tree.radius[first + i];
+                    leafBounds[0][i] = tree.x[first + i] - r; leafBounds[3][i] = tree.x[first + i] + r;
+                    leafBounds[1][i] = tree.y[first + i] - r; leafBounds[4][i] = tree.y[first + i] + r;
+                    leafBounds[2][i] = tree.z[first + i] - r; leafBounds[5][i] = tree.z[first + i] + r;
+                }
+                unsigned int visible = ~BoxesOutside(leafBounds[0], leafBounds[1], leafBounds[2], leafBounds[3], leafBounds[4], leafBounds[5], planes);
+                for (int i = 0; i < node.count[c]; i++) {
+                    if (visible & (1 << i)) hits.push_back({ tree.id, tree.index[first + i] });
+                }
+            }
+        }
+    }
+}
+
+void Eso::FixtureBvh::QuerySphere(float x, float y, float z, float radius, std::vector<Hit>& hits) const {
+    std::vector<int> stack;
+    for (const std::unique_ptr<CellTree>& cell : cells) {
+        const CellTree& tree = *cell;
+        if (tree.nodes.empty()) continue;
+        alignas(16) float cellBounds[6][4] = {};
+        for (int a = 0; a < 3; a++) {
+            cellBounds[a][0] = tree.min[a];
+            cellBounds[a + 3][0] = tree.max[a];
+        }
+        if (!(BoxesTouching(cellBounds[0], cellBounds[1], cellBounds[2], cellBounds[3], cellBounds[4], cellBounds[5], x, y, z, radius) & 1)) continue;
+
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+            const Node& node = tree.nodes[stack.back()];
+            stack.pop_back();
+            unsigned int touching = node.valid & BoxesTouching(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, x, y, z, radius);
+            for (int c = 0; c < 4; c++) {
+                if (!(touching & (1 << c))) continue;
+                if (node.count[c] == 0) {
+                    stack.push_back(node.child[c]);
+                    continue;
+                }
+                int first = ~node.child[c];
+                for (int i = 0; i < node.count[c]; i++) {
+                    float dx = tree.x[first + i] - x, dy = tree.y[first + i] - y, dz = tree.z[first + i] - z;
+                    float reach = radius + tree.radius[first + i];
+                    if (dx * dx + dy * dy + dz * dz <= reach * reach) hits.push_back({ tree.id, tree.index[first + i] });
+                }
+            }
+        }
+    }
+}
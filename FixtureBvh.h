@@ -0,0 +1,61 @@
+#pragma once
+#include "EsoWorld.h"
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace Eso {
+    //two level spatial index over the fixtures of every loaded cell
+    //each cell gets its own 4 wide bvh when it's added, the top level is just the list of cell bounds,
+    //so streaming a cell in or out never touches the others
+    class FixtureBvh {
+    public:
+        struct Hit {
+            unsigned long long cell;
+            unsigned int index; //into the cell's FixtureSpan
+        };
+
+        //radii are the bounding radius of each fixture's model (same order as the span), 0 treats it as a point
+        void AddCell(unsigned long long cellId, const FixtureSpan& fixtures, std::span<const float> radii);
+        void RemoveCell(unsigned long long cellId);
+        void Clear();
+
+        //planes are a, b, c, d with the normal pointing inwards, anything touching the frustum is returned
+        void QueryFrustum(const float planes[6][4], std::vector<Hit>& hits) const;
+        void QuerySphere(float x, float y, float z, float radius, std::vector<Hit>& hits) const;
+
+        size_t CellCount() const { return cells.size(); }
+        size_t FixtureCount() const { return fixtureCount; }
+
+    private:
+        static const int LeafSize = 4;
+
+        //bounds of up to 4 children side by side so one node is tested with one set of 4 wide ops
+        struct alignas(16) Node {
+            float minX[4], minY[4], minZ[4];
+            float maxX[4], maxY[4], maxZ[4];
+            int child[4];    //node index, or ~first fixture for leaves
+            unsigned char count[4]; //fixtures in a leaf child, 0 for internal children
+            unsigned char valid; //bitmask of used children
+        };
+
+        struct CellTree {
+            unsigned long long id;
+            size_t count;
+            float min[3];
+            float max[3];
+            std::vector<Node> nodes; //root is 0
+            //fixtures in leaf order, 4 aligned runs so leaves can be tested 4 at a time
+            std::vector<float> x, y, z, radius;
+            std::vector<unsigned int> index; //back to the FixtureSpan
+        };
+
+        std::vector<std::unique_ptr<CellTree>> cells;
+        std::unordered_map<unsigned long long, size_t> cellSlots;
+        size_t fixtureCount = 0;
+
+        static int Build(CellTree& tree, std::vector<unsigned int>& order, size_t begin, size_t end,
+            const FixtureSpan& fixtures, std::span<const float> radii);
+    };
+}
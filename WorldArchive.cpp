@@ -0,0 +1,237 @@
+#include "WorldArchive.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static_assert(sizeof(Eso::WorldArchive::Header) == 64, "archive header layout changed");
+static_assert(sizeof(Eso::WorldArchive::Entry) == 32, "archive entry layout changed");
+
+namespace {
+    size_t Align16(size_t offset) {
+        return (offset + 15) & ~(size_t)15;
+    }
+
+    //offsets of the ids, x, y, z, rotX, rotY, rotZ and models arrays inside a fixture cell, plus the total size
+    void FixtureLayout(size_t count, size_t offsets[9]) {
+        size_t offset = 16;
+        size_t sizes[8] = { 8, 4, 4, 4, 4, 4, 4, 4 };
+        for (int i = 0; i < 8; i++) {
+            offsets[i] = offset;
+            offset = Align16(offset + sizes[i] * count);
+        }
+        offsets[8] = offset;
+    }
+
+    //whether [offset, offset + size) lies inside a file of fileSize bytes, without overflowing
+    bool InBounds(unsigned long long offset, unsigned long long size, size_t fileSize) {
+        return offset <= fileSize && size <= fileSize - offset;
+    }
+
+    //the cell's bytes are inside the file and aligned, and whatever its layout points at is inside the cell
+    bool EntryValid(const Eso::WorldArchive::Entry& entry, std::span<const char> bytes) {
+        if (entry.offset % 16 != 0 || !InBounds(entry.offset, entry.size, bytes.size())) return false;
+        const char* cell = bytes.data() + entry.offset;
+        if (entry.kind == (unsigned int)Eso::CellKind::Fixture) {
+            size_t offsets[9];
+            FixtureLayout(entry.count, offsets);
+            return offsets[8] <= entry.size;
+        }
+        if (entry.kind != (unsigned int)Eso::CellKind::Terrain) return false;
+        //8 byte cell header then 32 byte layer entries, see TerrainFile(std::span)
+        if (entry.count > 255 || 8 + 32 * (unsigned long long)entry.count > entry.size) return false;
+        //TerrainFile goes by the cell's own layer count, only the entry's layers were checked
+        if ((unsigned char)cell[2] != entry.count) return false;
+        for (unsigned int i = 0; i < entry.count; i++) {
+            unsigned int layer[4];
+            unsigned long long gridOffset;
+            std::memcpy(layer, cell + 8 + 32 * i, sizeof(layer));
+            std::memcpy(&gridOffset, cell + 8 + 32 * i + 16, sizeof(gridOffset));
+            if (!InBounds(gridOffset, (unsigned long long)layer[1] * layer[2], entry.size)) return false;
+        }
+        return true;
+    }
+
+    void Pad(std::ofstream& out, size_t& pos) {
+        static const char zeros[16] = {};
+        size_t aligned = Align16(pos);
+        out.write(zeros, aligned - pos);
+        pos = aligned;
+    }
+
+    void Write(std::ofstream& out, size_t& pos, const void* data, size_t size) {
+        out.write((const char*)data, size);
+        pos += size;
+    }
+}
+
+Eso::WorldArchive::WorldArchive(const char* path) : reader(path) {
+    std::span<const char> bytes = reader.Bytes();
+    if (bytes.size() < sizeof(Header)) {
+        std::cout << "World archive " << path << " is missing or too small\n";
+        return;
+    }
+    const Header* candidate = (const Header*)bytes.data();
+    if (candidate->magic != Magic || candidate->version != FormatVersion || candidate->tableOffset % alignof(Entry) != 0 ||
+        !InBounds(candidate->tableOffset, (unsigned long long)candidate->cellCount * sizeof(Entry), bytes.size()) ||
+        !InBounds(candidate->tocOffset, candidate->tocSize, bytes.size())) {
+        std::cout << "World archive " << path << " has a bad header\n";
+        return;
+    }
+    //a truncated or corrupt archive is rejected whole here, so CellBytes and Fixtures never have to check
+    std::span<const Entry> entries((const Entry*)(bytes.data() + candidate->tableOffset), candidate->cellCount);
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!EntryValid(entries[i], bytes) || (i > 0 && entries[i - 1].id >= entries[i].id)) {
+            std::cout << "World archive " << path << " has a bad entry for cell " << std::hex << entries[i].id << std::dec << "\n";
+            return;
+        }
+    }
+    header = candidate;
+    table = entries;
+}
+
+std::span<const char> Eso::WorldArchive::TocBytes() const {
+    if (!header) return {};
+    return reader.Bytes().subspan(header->tocOffset, header->tocSize);
+}
+
+const Eso::WorldArchive::Entry* Eso::WorldArchive::Find(unsigned long long id) const {
+    auto it = std::lower_bound(table.begin(), table.end(), id, [](const Entry& entry, unsigned long long id) { return entry.id < id; });
+    if (it == table.end() || it->id != id) return nullptr;
+    return &*it;
+}
+
+std::span<const char> Eso::WorldArchive::CellBytes(const Entry& entry) const {
+    return reader.Bytes().subspan(entry.offset, entry.size);
+}
+
+Eso::FixtureSpan Eso::WorldArchive::Fixtures(const Entry& entry) const {
+    FixtureSpan view;
+    if (entry.kind != (unsigned int)CellKind::Fixture) return view;
+    const char* base = reader.Bytes().data() + entry.offset;
+    size_t count = entry.count;
+    size_t offsets[9];
+    FixtureLayout(count, offsets);
+    view.count = count;
+    view.ids = { (const unsigned long long*)(base + offsets[0]), count };
+    view.x = { (const float*)(base + offsets[1]), count };
+    view.y = { (const float*)(base + offsets[2]), count };
+    view.z = { (const float*)(base + offsets[3]), count };
+    view.rotX = { (const float*)(base + offsets[4]), count };
+    view.rotY = { (const float*)(base + offsets[5]), count };
+    view.rotZ = { (const float*)(base + offsets[6]), count };
+    view.models = { (const unsigned int*)(base + offsets[7]), count };
+    return view;
+}
+
+bool Eso::WorldArchive::Cook(const char* directory, unsigned int world, const std::vector<std::pair<unsigned int, CellKind>>& layers, const char* outPath) {
+    char* tocFilename = World::WorldTocFilename(world);
+    std::filesystem::path tocPath = std::filesystem::path(directory) / tocFilename;
+    delete[] tocFilename;
+    Toc toc(tocPath.string().c_str());
+    CellIndex index(toc, world, directory);
+
+    std::ofstream out(outPath, std::ios_base::binary);
+    if (!out) {
+        std::cout << "Could not open " << outPath << " for writing\n";
+        return false;
+    }
+
+    Header header = {};
+    header.magic = Magic;
+    header.version = FormatVersion;
+    header.world = world;
+    header.sizeX = index.sizeX;
+    header.sizeY = index.sizeY;
+    size_t pos = 0;
+    Write(out, pos, &header, sizeof(Header));
+
+    //raw toc, kept so nothing is lost if we learn more of its layout later
+    {
+        BinaryReader tocReader(tocPath.string().c_str());
+        header.tocOffset = pos;
+        header.tocSize = tocReader.Size();
+        Write(out, pos, tocReader.Bytes().data(), tocReader.Size());
+        Pad(out, pos);
+    }
+
+    std::vector<Entry> entries;
+    for (auto& [layer, kind] : layers) {
+        for (unsigned int y = 0; y < index.sizeY; y++) {
+            for (unsigned int x = 0; x < index.sizeX; x++) {
+                if (!index.Exists(layer, x, y)) continue;
+                char* filename = World::WorldCellFilename(world, layer, x, y);
+                std::string path = (std::filesystem::path(directory) / filename).string();
+                delete[] filename;
+
+                Entry entry = {};
+                entry.id = World::CellId(world, layer, x, y);
+                entry.offset = pos;
+                entry.kind = (unsigned int)kind;
+
+                if (kind == CellKind::Fixture) {
+                    FixtureFile fixtures(path.c_str());
+                    size_t count = fixtures.fixtureCount;
+                    size_t offsets[9];
+                    FixtureLayout(count, offsets);
+                    unsigned int cellHeader[4] = { fixtures.version, fixtures.fixtureCount, 0, 0 };
+                    Write(out, pos, cellHeader, sizeof(cellHeader));
+                    Write(out, pos, fixtures.ids.data(), count * 8); Pad(out, pos);
+                    for (const std::vector<float>* field : { &fixtures.x, &fixtures.y, &fixtures.z, &fixtures.rotX, &fixtures.rotY, &fixtures.rotZ }) {
+                        Write(out, pos, field->data(), count * 4); Pad(out, pos);
+                    }
+                    Write(out, pos, fixtures.models.data(), count * 4); Pad(out, pos);
+                    entry.count = fixtures.fixtureCount;
+                }
+                else {
+                    TerrainFile terrain(path.c_str());
+                    unsigned char layerCount = terrain.layerCount;
+                    unsigned char cellHeader[8] = {};
+                    std::memcpy(cellHeader, &terrain.version, 2);
+                    cellHeader[2] = layerCount;
+                    Write(out, pos, cellHeader, sizeof(cellHeader));
+
+                    //grids go after the layer entries
+                    size_t gridOffset = Align16(8 + 32 * (size_t)layerCount);
+                    for (int i = 0; i < layerCount; i++) {
+                        TerrainLayer* source = terrain.Layer(i);
+                        unsigned int layerEntry[4] = { (unsigned int)i, 0, 0, terrain.layerSizes[i] };
+                        unsigned long long offsets[2] = { 0, 0 };
+                        if (source) {
+                            layerEntry[1] = source->rowSize;
+                            layerEntry[2] = source->rowCount;
+                            offsets[0] = gridOffset;
+                            gridOffset = Align16(gridOffset + (size_t)source->rowSize * source->rowCount);
+                        }
+                        Write(out, pos, layerEntry, sizeof(layerEntry));
+                        Write(out, pos, offsets, sizeof(offsets));
+                    }
+                    Pad(out, pos);
+                    for (int i = 0; i < layerCount; i++) {
+                        TerrainLayer* source = terrain.Layer(i);
+                        if (!source) continue;
+                        for (unsigned int row = 0; row < source->rowCount; row++) {
+                            std::span<const char> bytes = source->Row(row);
+                            Write(out, pos, bytes.data(), bytes.size());
+                        }
+                        Pad(out, pos);
+                    }
+                    entry.count = layerCount;
+                }
+                entry.size = pos - entry.offset;
+                entries.push_back(entry);
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.id < b.id; });
+    header.tableOffset = pos;
+    header.cellCount = (unsigned int)entries.size();
+    Write(out, pos, entries.data(), entries.size() * sizeof(Entry));
+
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(Header));
+    std::cout << "Cooked " << entries.size() << " cells into " << outPath << " (" << pos / 1024 << " KB)\n";
+    return (bool)out;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "EsoWorld.h"
+#include <utility>
+#include <vector>
+
+namespace Eso {
+    //a whole world cooked into one file: header, the raw toc, every cell pre-decoded, then a cell table sorted by id
+    //everything is little endian and 16 byte aligned so it can be used straight out of the mapping
+    //
+    //fixture cell: version, count, 8 pad, then ids, x, y, z, rotX, rotY, rotZ, models arrays, each 16 byte aligned
+    //terrain cell: version, layerCount, 5 pad, 32 byte layer entries (see TerrainFile(std::span)), then contiguous grids
+    class WorldArchive {
+    public:
+        static const unsigned int Magic = 0x52415745; //EWAR
+        static const unsigned int FormatVersion = 1;
+
+        struct Header {
+            unsigned int magic;
+            unsigned int version;
+            unsigned int world;
+            unsigned int sizeX;
+            unsigned int sizeY;
+            unsigned int cellCount;
+            unsigned long long tocOffset;
+            unsigned long long tocSize;
+            unsigned long long tableOffset;
+            unsigned long long padding[2];
+        };
+
+        struct Entry {
+            unsigned long long id;
+            unsigned long long offset;
+            unsigned long long size;
+            unsigned int kind;  //CellKind
+            unsigned int count; //fixtures for fixture cells, layers for terrain cells
+        };
+
+        WorldArchive(const char* path);
+
+        bool Good() const { return header != nullptr; }
+        const Header& Info() const { return *header; }
+        std::span<const char> TocBytes() const;
+
+        //binary search over the cell table, nullptr if the cell isn't in the archive
+        const Entry* Find(unsigned long long id) const;
+        std::span<const char> CellBytes(const Entry& entry) const;
+        //zero copy views, both empty if the entry isn't the right kind
+        FixtureSpan Fixtures(const Entry& entry) const;
+
+        //reads every cell of the given layers from a loose world directory and writes the archive
+        static bool Cook(const char* directory, unsigned int world, const std::vector<std::pair<unsigned int, CellKind>>& layers, const char* outPath);
+
+    private:
+        BinaryReader reader;
+        const Header* header = nullptr;
+        std::span<const Entry> table;
+    };
+}
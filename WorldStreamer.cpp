@@ -0,0 +1,250 @@
+#include "WorldStreamer.h"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+
+bool Eso::ParseLayers(const char* spec, std::vector<std::pair<unsigned int, CellKind>>& layers) {
+    std::vector<std::pair<unsigned int, CellKind>> parsed;
+    const char* p = spec;
+    while (*p) {
+        char* end;
+        unsigned long layer = std::strtoul(p, &end, 0);
+        if (end == p || *end != ':') return false;
+        p = end + 1;
+        size_t length = std::strcspn(p, ",");
+        if (length == 7 && std::strncmp(p, "fixture", 7) == 0) parsed.emplace_back((unsigned int)layer, CellKind::Fixture);
+        else if (length == 7 && std::strncmp(p, "terrain", 7) == 0) parsed.emplace_back((unsigned int)layer, CellKind::Terrain);
+        else return false;
+        p += length;
+        if (*p == ',') p++;
+    }
+    if (parsed.empty()) return false;
+    layers = std::move(parsed);
+    return true;
+}
+
+Eso::WorldStreamer::WorldStreamer(const StreamerSettings& settings) : settings(settings) {
+    int threadCount = std::max(1, settings.threadCount);
+    for (int i = 0; i < threadCount; i++) {
+        workers.emplace_back(&WorldStreamer::WorkerLoop, this);
+    }
+}
+
+Eso::WorldStreamer::~WorldStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (auto& request : queue) request->cancelled = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void Eso::WorldStreamer::Update(float cameraX, float cameraY, float velocityX, float velocityY) {
+    frame++;
+
+    //pick up finished loads, dropping any that were cancelled or superseded while loading
+    std::vector<std::pair<std::shared_ptr<Request>, std::unique_ptr<StreamedCell>>> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(completed);
+    }
+    for (auto& [request, cell] : finished) {
+        auto it = inFlight.find(request->id);
+        if (it == inFlight.end() || it->second != request) continue;
+        inFlight.erase(it);
+
+        unsigned long long id = cell->id;
+        residentBytes += cell->bytes;
+        lru.push_front(id);
+        CacheEntry& entry = cache[id];
+        entry.cell = std::move(cell);
+        entry.lru = lru.begin();
+        entry.lastTouched = frame;
+        loaded.push_back(entry.cell.get());
+    }
+
+    //direction of travel, cells ahead of the camera load up to twice as early as ones behind it
+    float speed = std::sqrt(velocityX * velocityX + velocityY * velocityY);
+    float dirX = speed > 1e-4f ? velocityX / speed : 0.f;
+    float dirY = speed > 1e-4f ? velocityY / speed : 0.f;
+
+    float cellSize = settings.cellSize;
+    float reach = settings.radius + cellSize * 0.7072f; //cell centre to corner
+    int minX = std::max(0, (int)std::floor((cameraX - settings.radius) / cellSize));
+    int maxX = std::min(0xFFFF, (int)std::floor((cameraX + settings.radius) / cellSize));
+    int minY = std::max(0, (int)std::floor((cameraY - settings.radius) / cellSize));
+    int maxY = std::min(0xFFFF, (int)std::floor((cameraY + settings.radius) / cellSize));
+
+    std::unordered_set<unsigned long long> wanted;
+    std::vector<std::pair<std::shared_ptr<Request>, float>> reprioritised;
+    std::vector<std::shared_ptr<Request>> created;
+    for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            float toX = (x + 0.5f) * cellSize - cameraX;
+            float toY = (y + 0.5f) * cellSize - cameraY;
+            float distance = std::sqrt(toX * toX + toY * toY);
+            if (distance > reach) continue;
+            float facing = distance > 1e-4f ? (toX * dirX + toY * dirY) / distance : 1.f;
+            float priority = distance * (1.f - 0.5f * facing);
+
+            for (auto& [layer, kind] : settings.layers) {
+                if (settings.index && !settings.index->Exists(layer, x, y)) continue;
+                unsigned long long id = World::CellId(settings.world, layer, x, y);
+                if (settings.archive && !settings.archive->Find(id)) continue;
+                wanted.insert(id);
+
+                auto cached = cache.find(id);
+                if (cached != cache.end()) {
+                    Touch(cached->second);
+                    continue;
+                }
+                auto pending = inFlight.find(id);
+                if (pending != inFlight.end()) {
+                    reprioritised.emplace_back(pending->second, priority);
+                    continue;
+                }
+                auto request = std::make_shared<Request>();
+                request->id = id;
+                request->layer = layer;
+                request->x = x;
+                request->y = y;
+                request->kind = kind;
+                request->priority = priority;
+                inFlight[id] = request;
+                created.push_back(request);
+            }
+        }
+    }
+
+    //cancel everything that left the radius, a load already running finishes but is thrown away
+    for (auto it = inFlight.begin(); it != inFlight.end();) {
+        if (wanted.count(it->first) == 0) {
+            it->second->cancelled = true;
+            it = inFlight.erase(it);
+        }
+        else it++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [request, priority] : reprioritised) request->priority = priority;
+        queue.erase(std::remove_if(queue.begin(), queue.end(), [](const std::shared_ptr<Request>& r) { return r->cancelled.load(); }), queue.end());
+        queue.insert(queue.end(), created.begin(), created.end());
+        std::make_heap(queue.begin(), queue.end(), Later);
+    }
+    if (!created.empty()) wake.notify_all();
+
+    Evict();
+}
+
+const Eso::StreamedCell* Eso::WorldStreamer::Find(unsigned long long id) const {
+    auto it = cache.find(id);
+    return it == cache.end() ? nullptr : it->second.cell.get();
+}
+
+std::vector<const Eso::StreamedCell*> Eso::WorldStreamer::TakeLoaded() {
+    std::vector<const StreamedCell*> result;
+    result.swap(loaded);
+    return result;
+}
+
+std::vector<unsigned long long> Eso::WorldStreamer::TakeEvicted() {
+    std::vector<unsigned long long> result;
+    result.swap(evicted);
+    return result;
+}
+
+size_t Eso::WorldStreamer::PendingCells() const {
+    return inFlight.size();
+}
+
+void Eso::WorldStreamer::Touch(CacheEntry& entry) {
+    entry.lastTouched = frame;
+    lru.splice(lru.begin(), lru, entry.lru);
+}
+
+void Eso::WorldStreamer::Evict() {
+    //never evict cells inside the radius this frame, that would just reload them next frame
+    while (residentBytes > settings.memoryCap && !lru.empty()) {
+        unsigned long long id = lru.back();
+        auto it = cache.find(id);
+        if (it->second.lastTouched == frame) break;
+
+        StreamedCell* cell = it->second.cell.get();
+        loaded.erase(std::remove(loaded.begin(), loaded.end(), cell), loaded.end());
+        residentBytes -= cell->bytes;
+        evicted.push_back(id);
+        cache.erase(it);
+        lru.pop_back();
+    }
+}
+
+bool Eso::WorldStreamer::Later(const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b) {
+    return a->priority > b->priority;
+}
+
+void Eso::WorldStreamer::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+
+        std::pop_heap(queue.begin(), queue.end(), Later);
+        std::shared_ptr<Request> request = std::move(queue.back());
+        queue.pop_back();
+        if (request->cancelled) continue;
+
+        lock.unlock();
+        std::unique_ptr<StreamedCell> cell = Load(*request);
+        if (settings.prepare && !request->cancelled) cell->prepared = settings.prepare(*cell);
+        lock.lock();
+        if (!request->cancelled) completed.emplace_back(std::move(request), std::move(cell));
+    }
+}
+
+std::unique_ptr<Eso::StreamedCell> Eso::WorldStreamer::Load(const Request& request) {
+    PROFILE_SCOPE("load cell");
+    auto cell = std::make_unique<StreamedCell>();
+    cell->id = request.id;
+    cell->layer = request.layer;
+    cell->x = request.x;
+    cell->y = request.y;
+    cell->kind = request.kind;
+    cell->bytes = sizeof(StreamedCell);
+
+    if (settings.archive) {
+        const WorldArchive::Entry* entry = settings.archive->Find(request.id);
+        if (!entry) return cell;
+        if (request.kind == CellKind::Fixture) {
+            cell->fixtureView = settings.archive->Fixtures(*entry);
+        }
+        else {
+            cell->terrain = std::make_unique<TerrainFile>(settings.archive->CellBytes(*entry));
+        }
+        cell->bytes += (size_t)entry->size;
+        return cell;
+    }
+
+    char* filename = World::WorldCellFilename(settings.world, request.layer, request.x, request.y);
+    std::filesystem::path path = std::filesystem::path(settings.directory) / filename;
+    delete[] filename;
+    //missing cells are cached too so we don't keep probing for them. with an index they never get here
+    if (!settings.index && !std::filesystem::exists(path)) return cell;
+
+    std::string pathString = path.string();
+    if (request.kind == CellKind::Fixture) {
+        cell->fixtures = std::make_unique<FixtureFile>(pathString.c_str());
+        cell->fixtureView = cell->fixtures->View();
+        cell->bytes += (size_t)cell->fixtures->fixtureCount * (sizeof(unsigned long long) + 6 * sizeof(float) + sizeof(unsigned int));
+    }
+    else {
+        cell->terrain = std::make_unique<TerrainFile>(pathString.c_str());
+        cell->bytes += cell->terrain->MappedSize();
+    }
+    return cell;
+}
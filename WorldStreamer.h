@@ -0,0 +1,113 @@
+#pragma once
+#include "EsoWorld.h"
+#include "WorldArchive.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Eso {
+    struct StreamedCell {
+        unsigned long long id;
+        unsigned int layer;
+        unsigned int x;
+        unsigned int y;
+        CellKind kind;
+        std::unique_ptr<FixtureFile> fixtures; //null for terrain cells, missing files or archive cells
+        std::unique_ptr<TerrainFile> terrain;
+        FixtureSpan fixtureView; //the fixtures wherever they came from, use this rather than fixtures
+        size_t bytes; //resident estimate, counted against the cache cap
+        std::shared_ptr<void> prepared; //whatever StreamerSettings::prepare returned for it, dropped with the cell
+    };
+
+    struct StreamerSettings {
+        std::string directory;
+        unsigned int world = 0;
+        std::vector<std::pair<unsigned int, CellKind>> layers; //which layers to stream and what they hold, see ParseLayers
+        float cellSize = 100.f;
+        float radius = 500.f;
+        size_t memoryCap = 256 * 1024 * 1024;
+        int threadCount = 2;
+        const CellIndex* index = nullptr; //optional, cells it doesn't list are never queued
+        const WorldArchive* archive = nullptr; //optional, cells come from here instead of the loose files in directory
+        //optional, runs on the worker once a cell has loaded, for work on it that shouldn't happen on the thread calling Update.
+        //the result is kept in StreamedCell::prepared, destroyed wherever the cell is (a worker, for cancelled loads)
+        std::function<std::shared_ptr<void>(const StreamedCell&)> prepare;
+    };
+
+    //comma separated layer:kind pairs, kind is fixture or terrain. false if anything doesn't parse, layers is only set on success
+    bool ParseLayers(const char* spec, std::vector<std::pair<unsigned int, CellKind>>& layers);
+    //the layers the worlds looked at so far use
+    inline const char* DefaultLayers = "0:terrain,1:fixture";
+
+    //loads the cells around the camera on worker threads and keeps them in an lru cache keyed by cell id
+    //everything except the loading itself happens on the thread that calls Update
+    class WorldStreamer {
+    public:
+        WorldStreamer(const StreamerSettings& settings);
+        ~WorldStreamer();
+
+        //queues cells inside the radius by distance and direction of travel, cancels ones that left it,
+        //picks up finished loads and evicts least recently used cells over the memory cap
+        void Update(float cameraX, float cameraY, float velocityX, float velocityY);
+
+        //nullptr if not loaded (yet)
+        const StreamedCell* Find(unsigned long long id) const;
+
+        //cells that were added to or dropped from the cache since the last call
+        std::vector<const StreamedCell*> TakeLoaded();
+        std::vector<unsigned long long> TakeEvicted();
+
+        size_t ResidentBytes() const { return residentBytes; }
+        size_t ResidentCells() const { return cache.size(); }
+        size_t PendingCells() const;
+
+    private:
+        struct Request {
+            unsigned long long id;
+            unsigned int layer;
+            unsigned int x;
+            unsigned int y;
+            CellKind kind;
+            float priority; //lower loads first
+            std::atomic<bool> cancelled = false;
+        };
+
+        struct CacheEntry {
+            std::unique_ptr<StreamedCell> cell;
+            std::list<unsigned long long>::iterator lru;
+            unsigned long long lastTouched;
+        };
+
+        StreamerSettings settings;
+
+        //shared with the workers
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::shared_ptr<Request>> queue; //heap ordered by priority
+        std::vector<std::pair<std::shared_ptr<Request>, std::unique_ptr<StreamedCell>>> completed;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+
+        //render thread only
+        std::unordered_map<unsigned long long, std::shared_ptr<Request>> inFlight; //queued or loading
+        std::unordered_map<unsigned long long, CacheEntry> cache;
+        std::list<unsigned long long> lru; //front is most recently used
+        size_t residentBytes = 0;
+        unsigned long long frame = 0;
+        std::vector<const StreamedCell*> loaded;
+        std::vector<unsigned long long> evicted;
+
+        static bool Later(const std::shared_ptr<Request>& a, const std::shared_ptr<Request>& b); //min heap on priority
+        void WorkerLoop();
+        std::unique_ptr<StreamedCell> Load(const Request& request);
+        void Touch(CacheEntry& entry);
+        void Evict();
+    };
+}
@@ -0,0 +1,1613 @@
+#include "benchmarks.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <random>
+#include <thread>
+#include "webgpu\wgpu.h"
+#include "glm\ext.hpp"
+#include "rendwgpu.hpp"
+#include "BinaryReader.h"
+#include "EsoWorld.h"
+#include "WorldArchive.h"
+#include "WorldStreamer.h"
+#include "FixtureBvh.h"
+#include "gpuCull.hpp"
+#include "instanceTransforms.hpp"
+#include "meshPool.hpp"
+#include "offsetAllocator.hpp"
+#include "pipelineCache.hpp"
+#include "threadPool.hpp"
+#include "uploadRing.hpp"
+#include "vertexConvert.hpp"
+using glm::vec3;
+using glm::mat4;
+using namespace std;
+using namespace wgpu;
+
+namespace {
+	//uv sphere in the 32 byte full layout (position, pad, colour, pad), detail picks the ring count
+	void SphereMesh(int detail, float hue, vector<float>& verts, vector<unsigned int>& idx) {
+		int rings = 6 + 4 * detail;
+		int segments = rings * 2;
+		verts.clear();
+		idx.clear();
+		for (int r = 0; r <= rings; r++) {
+			float phi = glm::pi<float>() * r / rings;
+			for (int s = 0; s <= segments; s++) {
+				float theta = glm::two_pi<float>() * s / segments;
+				vec3 p(std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta), std::cos(phi));
+				vec3 color = glm::mix(vec3(hue, 0.4f, 1.f - hue), vec3(1.f), 0.5f * (p.z + 1.f) * 0.5f);
+				verts.insert(verts.end(), { p.x, p.y, p.z, 0.f, color.r, color.g, color.b, 0.f });
+			}
+		}
+		for (int r = 0; r < rings; r++) {
+			for (int s = 0; s < segments; s++) {
+				unsigned int a = r * (segments + 1) + s, b = a + segments + 1;
+				idx.insert(idx.end(), { a, a + 1, b, a + 1, b + 1, b });
+			}
+		}
+	}
+
+	double Percentile(vector<double> values, double p) {
+		if (values.empty()) return 0.0;
+		std::sort(values.begin(), values.end());
+		return values[(size_t)std::lround(p * (values.size() - 1))];
+	}
+
+	void WriteTimings(std::ostream& out, const char* name, const vector<double>& values) {
+		double mean = 0.0;
+		for (double v : values) mean += v;
+		mean /= std::max<size_t>(values.size(), 1);
+		out << "  \"" << name << "\": { \"mean\": " << mean << ", \"p50\": " << Percentile(values, 0.5) << ", \"p95\": " << Percentile(values, 0.95)
+			<< ", \"p99\": " << Percentile(values, 0.99) << ", \"max\": " << Percentile(values, 1.0) << " }";
+	}
+
+	//binary ppm, rows of rgba8 with rowBytes between them
+	bool WritePpm(const char* path, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int rowBytes) {
+		std::ofstream out(path, std::ios_base::binary);
+		out << "P6\n" << width << " " << height << "\n255\n";
+		for (unsigned int y = 0; y < height; y++) {
+			for (unsigned int x = 0; x < width; x++) out.write((const char*)pixels + y * rowBytes + x * 4, 3);
+		}
+		return (bool)out;
+	}
+
+	bool ReadPpm(const char* path, unsigned int& width, unsigned int& height, vector<unsigned char>& rgb) {
+		std::ifstream in(path, std::ios_base::binary);
+		std::string magic;
+		int maxValue;
+		in >> magic >> width >> height >> maxValue;
+		in.get();
+		if (!in || magic != "P6" || maxValue != 255) return false;
+		rgb.resize((size_t)width * height * 3);
+		in.read((char*)rgb.data(), rgb.size());
+		return (bool)in;
+	}
+
+	//copies size bytes (a multiple of 4) from the start of a CopySrc buffer into out, waiting on the gpu for it
+	bool ReadBuffer(Device& device, Queue& queue, Buffer source, size_t size, vector<char>& out) {
+		out.assign(size, 0);
+		if (size == 0) return true;
+		BufferDescriptor readbackDesc;
+		readbackDesc.size = size;
+		readbackDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+		readbackDesc.mappedAtCreation = false;
+		readbackDesc.label = "readback";
+		Buffer readback = device.createBuffer(readbackDesc);
+		CommandEncoderDescriptor encoderDesc;
+		encoderDesc.label = "readback encoder";
+		CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+		encoder.copyBufferToBuffer(source, 0, readback, 0, readbackDesc.size);
+		CommandBufferDescriptor commandDesc;
+		commandDesc.label = "readback commands";
+		CommandBuffer commands = encoder.finish(commandDesc);
+		queue.submit(commands);
+		commands.drop();
+		encoder.drop();
+
+		struct MapState {
+			bool done = false;
+			WGPUBufferMapAsyncStatus status;
+		} mapState;
+		auto onMapped = [](WGPUBufferMapAsyncStatus status, void* userData) {
+			MapState& state = *reinterpret_cast<MapState*>(userData);
+			state.status = status;
+			state.done = true;
+		};
+		wgpuBufferMapAsync(readback, WGPUMapMode_Read, 0, readbackDesc.size, onMapped, &mapState);
+		while (!mapState.done) wgpuDevicePoll(device, true, nullptr);
+		bool mapped = mapState.status == WGPUBufferMapAsyncStatus_Success;
+		if (mapped) {
+			std::memcpy(out.data(), readback.getConstMappedRange(0, readbackDesc.size), size);
+			readback.unmap();
+		}
+		readback.drop();
+		return mapped;
+	}
+}
+
+//--bench-bvh [fixture count], random fixtures in 10k fixture cells, bvh build and queries against scanning everything
+int BenchmarkBvh(int argc, char** argv) {
+	size_t count = argc >= 3 ? (size_t)strtoull(argv[2], nullptr, 0) : 1000000;
+	const size_t perCell = 10000;
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(0.f, 4000.f);
+	std::uniform_real_distribution<float> size(0.5f, 8.f);
+	vector<float> x(count), y(count), z(count), radii(count);
+	vector<unsigned long long> ids(count);
+	vector<unsigned int> modelIds(count);
+	for (size_t i = 0; i < count; i++) {
+		x[i] = position(random);
+		y[i] = position(random) * 0.05f;
+		z[i] = position(random);
+		radii[i] = size(random);
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	Eso::FixtureBvh bvh;
+	auto buildStart = Clock::now();
+	for (size_t first = 0; first < count; first += perCell) {
+		size_t n = std::min(perCell, count - first);
+		Eso::FixtureSpan span;
+		span.count = n;
+		span.ids = { &ids[first], n };
+		span.x = { &x[first], n };
+		span.y = { &y[first], n };
+		span.z = { &z[first], n };
+		span.models = { &modelIds[first], n };
+		bvh.AddCell(first / perCell, span, { &radii[first], n });
+	}
+	double buildTime = ms(Clock::now() - buildStart);
+
+	//a camera in the middle of the world looking along x
+	mat4 proj = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 800.f);
+	mat4 view = glm::lookAt(vec3(2000.f, 50.f, 2000.f), vec3(2100.f, 40.f, 2000.f), vec3(0.f, 1.f, 0.f));
+	glm::vec4 frustum[6];
+	ExtractFrustum(proj * view, frustum);
+	float planes[6][4];
+	for (int p = 0; p < 6; p++) {
+		for (int c = 0; c < 4; c++) planes[p][c] = frustum[p][c];
+	}
+
+	const int runs = 20;
+	vector<Eso::FixtureBvh::Hit> hits;
+	auto queryStart = Clock::now();
+	for (int run = 0; run < runs; run++) {
+		hits.clear();
+		bvh.QueryFrustum(planes, hits);
+	}
+	double frustumTime = ms(Clock::now() - queryStart) / runs;
+	size_t frustumHits = hits.size();
+
+	queryStart = Clock::now();
+	for (int run = 0; run < runs; run++) {
+		hits.clear();
+		bvh.QuerySphere(2000.f, 50.f, 2000.f, 200.f, hits);
+	}
+	double sphereTime = ms(Clock::now() - queryStart) / runs;
+	size_t sphereHits = hits.size();
+
+	//brute force, the same box against plane test on every fixture
+	size_t bruteHits = 0;
+	queryStart = Clock::now();
+	for (int run = 0; run < runs; run++) {
+		bruteHits = 0;
+		for (size_t i = 0; i < count; i++) {
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++) {
+				float r = radii[i];
+				float d = planes[p][0] * (x[i] + (planes[p][0] >= 0.f ? r : -r)) + planes[p][1] * (y[i] + (planes[p][1] >= 0.f ? r : -r))
+					+ planes[p][2] * (z[i] + (planes[p][2] >= 0.f ? r : -r)) + planes[p][3];
+				inside = d >= 0.f;
+			}
+			bruteHits += inside;
+		}
+	}
+	double bruteTime = ms(Clock::now() - queryStart) / runs;
+
+	cout << count << " fixtures in " << bvh.CellCount() << " cells\n";
+	cout << "build " << buildTime << " ms\n";
+	cout << "frustum " << frustumTime << " ms, " << frustumHits << " hits (brute force " << bruteTime << " ms, " << bruteHits << " hits)\n";
+	cout << "sphere " << sphereTime << " ms, " << sphereHits << " hits\n";
+	return frustumHits == bruteHits ? 0 : 1;
+}
+
+//--bench-instances [count], the old chained glm loop against InstanceTransforms, all dirty and with 1% dirty
+int BenchmarkInstances(int argc, char** argv) {
+	unsigned int count = argc >= 3 ? (unsigned int)strtoul(argv[2], nullptr, 0) : 1000000;
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> value(-10.f, 10.f);
+	vector<float> position(count * 3), rotation(count * 3), scale(count);
+	for (float& v : position) v = value(random);
+	for (float& v : rotation) v = value(random);
+	for (float& v : scale) v = std::abs(value(random)) * 0.1f + 0.1f;
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	const int runs = 10;
+
+	vector<mat4> reference(count);
+	auto start = Clock::now();
+	for (int run = 0; run < runs; run++) {
+		for (unsigned int i = 0; i < count; i++) {
+			reference[i] = glm::translate(mat4(1), vec3(position[i * 3], position[i * 3 + 1], position[i * 3 + 2]));
+			reference[i] = glm::scale(reference[i], vec3(scale[i]));
+			reference[i] = glm::rotate(reference[i], rotation[i * 3 + 2], vec3(0.f, 0.f, 1.f));
+			reference[i] = glm::rotate(reference[i], rotation[i * 3 + 1], vec3(0.f, 1.f, 0.f));
+			reference[i] = glm::rotate(reference[i], rotation[i * 3], vec3(1.f, 0.f, 0.f));
+		}
+	}
+	double glmTime = ms(Clock::now() - start) / runs;
+
+	ThreadPool pool;
+	InstanceTransforms transforms(count);
+	auto setAll = [&](float offset) {
+		for (unsigned int i = 0; i < count; i++) {
+			transforms.SetPosition(i, position[i * 3] + offset, position[i * 3 + 1], position[i * 3 + 2]);
+			transforms.SetRotation(i, rotation[i * 3], rotation[i * 3 + 1], rotation[i * 3 + 2]);
+			transforms.SetScale(i, scale[i]);
+		}
+	};
+	double serialTime = 0.0, pooledTime = 0.0, sparseTime = 0.0;
+	for (int run = 0; run < runs; run++) {
+		setAll((float)run);
+		start = Clock::now();
+		transforms.Update();
+		serialTime += ms(Clock::now() - start);
+
+		setAll((float)run + 0.5f);
+		start = Clock::now();
+		transforms.Update(&pool);
+		pooledTime += ms(Clock::now() - start);
+
+		for (unsigned int i = 0; i < count; i += 100) transforms.SetScale(i, scale[i] * (run + 2));
+		start = Clock::now();
+		transforms.Update(&pool);
+		sparseTime += ms(Clock::now() - start);
+	}
+
+	//back to the reference values, they should come out the same as glm
+	setAll(0.f);
+	for (unsigned int i = 0; i < count; i++) transforms.SetScale(i, scale[i]);
+	transforms.Update(&pool);
+	float maxError = 0.f;
+	for (unsigned int i = 0; i < count; i++) {
+		const float* m = transforms.Instance(i);
+		for (int e = 0; e < 16; e++) maxError = std::max(maxError, std::abs(m[e] - glm::value_ptr(reference[i])[e]));
+	}
+
+	cout << count << " instances, " << pool.ThreadCount() + 1 << " threads\n";
+	cout << "glm loop " << glmTime << " ms\n";
+	cout << "all dirty, serial " << serialTime / runs << " ms, pooled " << pooledTime / runs << " ms\n";
+	//the packed layout has to describe the same transform
+	InstanceTransforms packed(count, InstanceLayout::Packed);
+	double packedTime = 0.0;
+	for (int run = 0; run < runs; run++) {
+		for (unsigned int i = 0; i < count; i++) {
+			packed.SetPosition(i, position[i * 3] + run, position[i * 3 + 1], position[i * 3 + 2]);
+			packed.SetRotation(i, rotation[i * 3], rotation[i * 3 + 1], rotation[i * 3 + 2]);
+			packed.SetScale(i, scale[i]);
+		}
+		start = Clock::now();
+		packed.Update(&pool);
+		packedTime += ms(Clock::now() - start);
+	}
+	float packedError = 0.f;
+	for (unsigned int i = 0; i < count; i++) {
+		packed.SetPosition(i, position[i * 3], position[i * 3 + 1], position[i * 3 + 2]);
+	}
+	packed.Update(&pool);
+	for (unsigned int i = 0; i < count; i += 97) {
+		float corner[3] = { 1.f, -2.f, 0.5f }, a[3], b[3];
+		transforms.TransformPoint(i, corner, a);
+		packed.TransformPoint(i, corner, b);
+		for (int c = 0; c < 3; c++) packedError = std::max(packedError, std::abs(a[c] - b[c]));
+	}
+
+	cout << "1% dirty, pooled " << sparseTime / runs << " ms\n";
+	cout << "packed, all dirty, pooled " << packedTime / runs << " ms, " << count * sizeof(PackedInstance) / 1024 << " KB instead of " << count * sizeof(mat4) / 1024 << " KB\n";
+	cout << "max difference from glm " << maxError << ", packed against matrix " << packedError << "\n";
+	return maxError < 1e-3f && packedError < 1e-3f ? 0 : 1;
+}
+
+//--bench-render [models] [instances per model] [frames], renders offscreen without a window on whatever adapter there is
+//(add --software for the fallback adapter) while the camera flies a fixed path over a grid of synthetic spheres.
+//prints cpu encode, submit and whole frame times as json. --readback out.ppm saves the last frame,
+//--reference in.ppm compares the last frame against an earlier readback and fails if they differ
+int BenchmarkRender(int argc, char** argv) {
+	//the counts are optional, flags can follow straight after --bench-render
+	auto count = [&](int i, unsigned int fallback) {
+		return argc > i && strncmp(argv[i], "--", 2) != 0 ? (unsigned int)strtoul(argv[i], nullptr, 0) : fallback;
+	};
+	unsigned int modelCount = count(2, 8);
+	unsigned int perModel = count(3, 1024);
+	unsigned int frameCount = count(4, 300);
+	const unsigned int warmupFrames = 10;
+	const unsigned int width = 1280, height = 720;
+	const char* readbackPath = nullptr;
+	const char* referencePath = nullptr;
+	bool software = false;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--software") == 0) software = true;
+		if (strcmp(argv[i], "--readback") == 0 && i + 1 < argc) readbackPath = argv[i + 1];
+		if (strcmp(argv[i], "--reference") == 0 && i + 1 < argc) referencePath = argv[i + 1];
+	}
+	modelCount = std::max(modelCount, 1u);
+	unsigned int totalInstances = modelCount * perModel;
+
+	Instance instance = wgpu::createInstance(InstanceDescriptor());
+	RequestAdapterOptions adapterOptions;
+	adapterOptions.compatibleSurface = nullptr;
+	adapterOptions.forceFallbackAdapter = software;
+	Adapter adapter = instance.requestAdapter(adapterOptions);
+	if (!adapter) {
+		std::cerr << "No adapter" << (software ? " (software)" : "") << "\n";
+		return 1;
+	}
+	AdapterProperties adapterProperties = Default;
+	adapter.getProperties(&adapterProperties);
+	Device device = CreateDevice(adapter);
+	Queue queue = device.getQueue();
+
+	//offscreen targets
+	TextureFormat colorFormat = TextureFormat::RGBA8Unorm;
+	TextureFormat depthFormat = TextureFormat::Depth24Plus;
+	TextureDescriptor colorDesc;
+	colorDesc.dimension = TextureDimension::_2D;
+	colorDesc.format = colorFormat;
+	colorDesc.mipLevelCount = 1;
+	colorDesc.sampleCount = 1;
+	colorDesc.size = { width, height, 1 };
+	colorDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+	colorDesc.viewFormatCount = 0;
+	colorDesc.viewFormats = nullptr;
+	Texture colorTexture = device.createTexture(colorDesc);
+	TextureView colorView = wgpuTextureCreateView(colorTexture, nullptr);
+	TextureDescriptor depthDesc = colorDesc;
+	depthDesc.format = depthFormat;
+	depthDesc.usage = TextureUsage::RenderAttachment;
+	Texture depthTexture = device.createTexture(depthDesc);
+	TextureView depthView = wgpuTextureCreateView(depthTexture, nullptr);
+
+	//same bindings as the windowed renderer
+	BindGroupLayoutEntry uniformLayoutEntry = Default;
+	uniformLayoutEntry.binding = 0;
+	uniformLayoutEntry.visibility = ShaderStage::Vertex | ShaderStage::Compute;
+	uniformLayoutEntry.buffer.type = BufferBindingType::Uniform;
+	uniformLayoutEntry.buffer.minBindingSize = sizeof(Uniforms);
+	BindGroupLayoutDescriptor uniformLayoutDesc;
+	uniformLayoutDesc.entryCount = 1;
+	uniformLayoutDesc.entries = &uniformLayoutEntry;
+	BindGroupLayout uniformLayout = device.createBindGroupLayout(uniformLayoutDesc);
+	BufferDescriptor uniformBufferDesc;
+	uniformBufferDesc.size = sizeof(Uniforms);
+	uniformBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	uniformBufferDesc.mappedAtCreation = false;
+	uniformBufferDesc.label = "bench uniform buffer";
+	Buffer uniformBuffer = device.createBuffer(uniformBufferDesc);
+	BindGroupEntry uniformEntry = Default;
+	uniformEntry.binding = 0;
+	uniformEntry.buffer = uniformBuffer;
+	uniformEntry.offset = 0;
+	uniformEntry.size = sizeof(Uniforms);
+	BindGroupDescriptor uniformGroupDesc;
+	uniformGroupDesc.layout = uniformLayout;
+	uniformGroupDesc.entryCount = 1;
+	uniformGroupDesc.entries = &uniformEntry;
+	BindGroup uniformGroup = device.createBindGroup(uniformGroupDesc);
+	PipelineLayoutDescriptor layoutDesc;
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = &(WGPUBindGroupLayout)uniformLayout;
+	PipelineLayout layout = device.createPipelineLayout(layoutDesc);
+
+	std::unique_ptr<PipelineCache> pipelines = std::make_unique<PipelineCache>(device, ShaderDirectory());
+	PipelineKey key;
+	key.shader = pipelines->Shader("defaultshader.wgsl");
+	key.instances = InstanceLayout::Packed;
+	key.colorFormat = colorFormat;
+	key.depthFormat = depthFormat;
+	key.layout = layout;
+	RenderPipeline pipeline = pipelines->Wait(key);
+	if (!pipeline) {
+		std::cerr << "Could not build the benchmark pipeline\n";
+		return 1;
+	}
+
+	//models get finer as m goes up, instances are one grid over all of them, model by model
+	MeshPool pool(device, queue, 32, 1 << 16, 1 << 20);
+	vector<GpuCuller::Draw> draws(modelCount);
+	vector<float> sphereVerts;
+	vector<unsigned int> sphereIdx;
+	for (unsigned int m = 0; m < modelCount; m++) {
+		SphereMesh(m % 8, (float)m / modelCount, sphereVerts, sphereIdx);
+		unsigned int slot = pool.Add({ (const char*)sphereVerts.data(), sphereVerts.size() * sizeof(float) }, { (const char*)sphereIdx.data(), sphereIdx.size() * 4 });
+		MeshPool::Range range = pool.Get(slot);
+		draws[m] = {};
+		draws[m].indexCount = (unsigned int)sphereIdx.size();
+		draws[m].firstIndex = range.idxOffset / 4;
+		draws[m].baseVertex = range.baseVertex;
+		draws[m].firstInstance = m * perModel;
+		draws[m].instanceCount = perModel;
+		draws[m].radius = 1.f;
+	}
+	unsigned int side = (unsigned int)std::ceil(std::sqrt((double)std::max(totalInstances, 1u)));
+	float spacing = 3.f;
+	float extent = side * spacing;
+	InstanceTransforms transforms(totalInstances, InstanceLayout::Packed);
+	for (unsigned int i = 0; i < totalInstances; i++) {
+		transforms.SetPosition(i, (i % side + 0.5f) * spacing - extent * 0.5f, (i / side + 0.5f) * spacing - extent * 0.5f, 0.f);
+		transforms.SetRotation(i, 0.f, 0.f, i * 0.1f);
+		transforms.SetScale(i, 0.5f + 0.5f * ((i * 7919u) % 100) / 100.f);
+	}
+	transforms.Update();
+
+	ShaderModule cullShader = pipelines->Module(pipelines->Shader("cull.wgsl"));
+	GpuCuller culler(device, queue, cullShader, uniformLayout, std::max(totalInstances, 1u), modelCount, InstanceLayout::Packed);
+	culler.Update(transforms.Data(), draws);
+	auto uploads = std::make_unique<UploadRing>(device, queue, 1 << 16);
+
+	Uniforms uniformData = {};
+	float fov = glm::radians(45.f);
+	uniformData.proj = glm::perspective(fov, (float)width / height, 0.1f, extent * 4.f + 10.f);
+	uniformData.rotationSpeed = 0.f;
+	queue.writeBuffer(uniformBuffer, 0, &uniformData, sizeof(Uniforms));
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	vector<double> encodeTimes, submitTimes, frameTimes;
+	unsigned int bytesPerRow = (width * 4 + 255) & ~255u;
+	Buffer readback = nullptr;
+	for (unsigned int frame = 0; frame < warmupFrames + frameCount; frame++) {
+		auto frameStart = Clock::now();
+		//the camera circles the grid while bobbing up and down, the same path every run
+		float t = (float)frame / std::max(frameCount, 1u);
+		float angle = glm::two_pi<float>() * t;
+		vec3 eye(std::cos(angle) * extent * 0.6f, std::sin(angle) * extent * 0.6f, extent * (0.25f + 0.15f * std::sin(angle * 3.f)) + 2.f);
+		uniformData.view = glm::lookAt(eye, vec3(0.f), vec3(0.f, 0.f, 1.f));
+		uniformData.time = t;
+		ExtractFrustum(uniformData.proj * uniformData.view, uniformData.frustum);
+
+		uploads->BeginFrame();
+		uploads->Write(uniformBuffer, 0, &uniformData, sizeof(Uniforms));
+		culler.ResetCounts(uploads.get());
+
+		CommandEncoderDescriptor encoderDesc;
+		encoderDesc.label = "bench encoder";
+		CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+		uploads->Flush(encoder);
+		culler.Cull(encoder, uniformGroup);
+
+		RenderPassColorAttachment colorAttachment;
+		colorAttachment.view = colorView;
+		colorAttachment.resolveTarget = nullptr;
+		colorAttachment.loadOp = LoadOp::Clear;
+		colorAttachment.storeOp = StoreOp::Store;
+		colorAttachment.clearValue = WGPUColor{ 0.05, 0.1, 0.11, 1.0 };
+		RenderPassDepthStencilAttachment depthAttachment;
+		depthAttachment.view = depthView;
+		depthAttachment.depthClearValue = 1.0f;
+		depthAttachment.depthLoadOp = LoadOp::Clear;
+		depthAttachment.depthStoreOp = StoreOp::Store;
+		depthAttachment.depthReadOnly = false;
+		depthAttachment.stencilClearValue = 0;
+		depthAttachment.stencilLoadOp = LoadOp::Clear;
+		depthAttachment.stencilStoreOp = StoreOp::Store;
+		depthAttachment.stencilReadOnly = false;
+		RenderPassDescriptor passDesc;
+		passDesc.label = "bench pass";
+		passDesc.colorAttachmentCount = 1;
+		passDesc.colorAttachments = &colorAttachment;
+		passDesc.depthStencilAttachment = &depthAttachment;
+		passDesc.timestampWriteCount = 0;
+		passDesc.timestampWrites = nullptr;
+		RenderPassEncoder pass = encoder.beginRenderPass(passDesc);
+		pass.setPipeline(pipeline);
+		pass.setBindGroup(0, uniformGroup, 0, nullptr);
+		pass.setVertexBuffer(0, pool.VertBuffer(), 0, (unsigned long long)pool.VertCapacity() * pool.VertStride());
+		pass.setIndexBuffer(pool.IdxBuffer(), IndexFormat::Uint32, 0, pool.IdxCapacity());
+		for (unsigned int m = 0; m < modelCount; m++) culler.DrawVisible(pass, m, 1);
+		pass.end();
+
+		bool last = frame + 1 == warmupFrames + frameCount;
+		if (last && (readbackPath || referencePath)) {
+			BufferDescriptor readbackDesc;
+			readbackDesc.size = (unsigned long long)bytesPerRow * height;
+			readbackDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+			readbackDesc.mappedAtCreation = false;
+			readbackDesc.label = "bench readback";
+			readback = device.createBuffer(readbackDesc);
+			ImageCopyTexture source = Default;
+			source.texture = colorTexture;
+			source.mipLevel = 0;
+			source.origin = { 0, 0, 0 };
+			source.aspect = TextureAspect::All;
+			ImageCopyBuffer destination = Default;
+			destination.buffer = readback;
+			destination.layout.offset = 0;
+			destination.layout.bytesPerRow = bytesPerRow;
+			destination.layout.rowsPerImage = height;
+			Extent3D copySize = { width, height, 1 };
+			encoder.copyTextureToBuffer(source, destination, copySize);
+		}
+
+		CommandBufferDescriptor commandDesc;
+		commandDesc.label = "bench commands";
+		CommandBuffer commands = encoder.finish(commandDesc);
+		auto submitStart = Clock::now();
+		queue.submit(commands);
+		auto submitEnd = Clock::now();
+		uploads->Submitted();
+		//frame time includes the gpu, with nothing to present there's no other way to pace it
+		wgpuDevicePoll(device, true, nullptr);
+		auto frameEnd = Clock::now();
+
+		pass.drop();
+		commands.drop();
+		encoder.drop();
+		if (frame < warmupFrames) continue;
+		encodeTimes.push_back(ms(submitStart - frameStart));
+		submitTimes.push_back(ms(submitEnd - submitStart));
+		frameTimes.push_back(ms(frameEnd - frameStart));
+	}
+
+	int result = 0;
+	double imageRmse = -1.0;
+	if (readback) {
+		struct MapState {
+			bool done = false;
+			WGPUBufferMapAsyncStatus status;
+		} mapState;
+		auto onMapped = [](WGPUBufferMapAsyncStatus status, void* userData) {
+			MapState& state = *reinterpret_cast<MapState*>(userData);
+			state.status = status;
+			state.done = true;
+		};
+		wgpuBufferMapAsync(readback, WGPUMapMode_Read, 0, (size_t)bytesPerRow * height, onMapped, &mapState);
+		while (!mapState.done) wgpuDevicePoll(device, true, nullptr);
+		if (mapState.status == WGPUBufferMapAsyncStatus_Success) {
+			const unsigned char* pixels = (const unsigned char*)readback.getConstMappedRange(0, (size_t)bytesPerRow * height);
+			if (readbackPath && !WritePpm(readbackPath, pixels, width, height, bytesPerRow)) {
+				std::cerr << "Could not write " << readbackPath << "\n";
+				result = 1;
+			}
+			if (referencePath) {
+				unsigned int refWidth, refHeight;
+				vector<unsigned char> reference;
+				if (!ReadPpm(referencePath, refWidth, refHeight, reference) || refWidth != width || refHeight != height) {
+					std::cerr << "Reference " << referencePath << " is missing or a different size\n";
+					result = 1;
+				}
+				else {
+					double sum = 0.0;
+					for (unsigned int y = 0; y < height; y++) {
+						for (unsigned int x = 0; x < width * 3; x++) {
+							double d = (double)pixels[y * bytesPerRow + x / 3 * 4 + x % 3] - reference[((size_t)y * width) * 3 + x];
+							sum += d * d;
+						}
+					}
+					imageRmse = std::sqrt(sum / ((double)width * height * 3));
+					//different adapters rasterise edges slightly differently, anything beyond that is a real change
+					if (imageRmse > 2.0) result = 1;
+				}
+			}
+			readback.unmap();
+		}
+		else {
+			std::cerr << "Readback failed to map\n";
+			result = 1;
+		}
+		readback.drop();
+	}
+
+	std::ostream& out = std::cout;
+	out << "{\n";
+	out << "  \"adapter\": \"" << (adapterProperties.name ? adapterProperties.name : "") << "\",\n";
+	out << "  \"backend\": " << (int)adapterProperties.backendType << ",\n";
+	out << "  \"software\": " << (adapterProperties.adapterType == WGPUAdapterType_CPU ? "true" : "false") << ",\n";
+	out << "  \"width\": " << width << ", \"height\": " << height << ",\n";
+	out << "  \"models\": " << modelCount << ", \"instancesPerModel\": " << perModel << ", \"frames\": " << frameCount << ",\n";
+	WriteTimings(out, "encodeMs", encodeTimes);
+	out << ",\n";
+	WriteTimings(out, "submitMs", submitTimes);
+	out << ",\n";
+	WriteTimings(out, "frameMs", frameTimes);
+	if (imageRmse >= 0.0) out << ",\n  \"imageRmse\": " << imageRmse;
+	out << "\n}\n";
+
+	uploads.reset();
+	pipelines.reset();
+	depthView.drop();
+	depthTexture.drop();
+	colorView.drop();
+	colorTexture.drop();
+	uniformGroup.drop();
+	uniformBuffer.drop();
+	layout.drop();
+	uniformLayout.drop();
+	device.drop();
+	adapter.drop();
+	instance.drop();
+	return result;
+}
+
+//--bench-record [cells] [draws per cell], recording a frame's worth of newly visible cells on one thread up to every core.
+//every cell becomes its own render bundle like in CellBundles, recorded on a ThreadPool and replayed in cell order in one pass,
+//compared against encoding every draw straight into that pass on one thread. add --software for the fallback adapter. prints json
+int BenchmarkRecord(int argc, char** argv) {
+	auto count = [&](int i, unsigned int fallback) {
+		return argc > i && strncmp(argv[i], "--", 2) != 0 ? (unsigned int)strtoul(argv[i], nullptr, 0) : fallback;
+	};
+	unsigned int cellCount = std::max(count(2, 512), 1u);
+	unsigned int drawsPerCell = std::max(count(3, 64), 1u);
+	const unsigned int instancesPerDraw = 4;
+	const unsigned int meshCount = 8;
+	const unsigned int warmupRuns = 3;
+	const unsigned int runs = 20;
+	bool software = false;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--software") == 0) software = true;
+	}
+
+	Instance instance = wgpu::createInstance(InstanceDescriptor());
+	RequestAdapterOptions adapterOptions;
+	adapterOptions.compatibleSurface = nullptr;
+	adapterOptions.forceFallbackAdapter = software;
+	Adapter adapter = instance.requestAdapter(adapterOptions);
+	if (!adapter) {
+		std::cerr << "No adapter" << (software ? " (software)" : "") << "\n";
+		return 1;
+	}
+	AdapterProperties adapterProperties = Default;
+	adapter.getProperties(&adapterProperties);
+	Device device = CreateDevice(adapter);
+	Queue queue = device.getQueue();
+
+	//small targets, the gpu side isn't what's measured
+	const unsigned int width = 256, height = 256;
+	TextureFormat colorFormat = TextureFormat::RGBA8Unorm;
+	TextureFormat depthFormat = TextureFormat::Depth24Plus;
+	TextureDescriptor colorDesc;
+	colorDesc.dimension = TextureDimension::_2D;
+	colorDesc.format = colorFormat;
+	colorDesc.mipLevelCount = 1;
+	colorDesc.sampleCount = 1;
+	colorDesc.size = { width, height, 1 };
+	colorDesc.usage = TextureUsage::RenderAttachment;
+	colorDesc.viewFormatCount = 0;
+	colorDesc.viewFormats = nullptr;
+	Texture colorTexture = device.createTexture(colorDesc);
+	TextureView colorView = wgpuTextureCreateView(colorTexture, nullptr);
+	TextureDescriptor depthDesc = colorDesc;
+	depthDesc.format = depthFormat;
+	Texture depthTexture = device.createTexture(depthDesc);
+	TextureView depthView = wgpuTextureCreateView(depthTexture, nullptr);
+
+	BindGroupLayoutEntry uniformLayoutEntry = Default;
+	uniformLayoutEntry.binding = 0;
+	uniformLayoutEntry.visibility = ShaderStage::Vertex | ShaderStage::Compute;
+	uniformLayoutEntry.buffer.type = BufferBindingType::Uniform;
+	uniformLayoutEntry.buffer.minBindingSize = sizeof(Uniforms);
+	BindGroupLayoutDescriptor uniformLayoutDesc;
+	uniformLayoutDesc.entryCount = 1;
+	uniformLayoutDesc.entries = &uniformLayoutEntry;
+	BindGroupLayout uniformLayout = device.createBindGroupLayout(uniformLayoutDesc);
+	BufferDescriptor uniformBufferDesc;
+	uniformBufferDesc.size = sizeof(Uniforms);
+	uniformBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	uniformBufferDesc.mappedAtCreation = false;
+	uniformBufferDesc.label = "bench uniform buffer";
+	Buffer uniformBuffer = device.createBuffer(uniformBufferDesc);
+	Uniforms uniformData = {};
+	uniformData.proj = glm::perspective(glm::radians(45.f), 1.f, 0.1f, 1000.f);
+	uniformData.view = glm::lookAt(vec3(0.f, -40.f, 40.f), vec3(0.f), vec3(0.f, 0.f, 1.f));
+	queue.writeBuffer(uniformBuffer, 0, &uniformData, sizeof(Uniforms));
+	BindGroupEntry uniformEntry = Default;
+	uniformEntry.binding = 0;
+	uniformEntry.buffer = uniformBuffer;
+	uniformEntry.offset = 0;
+	uniformEntry.size = sizeof(Uniforms);
+	BindGroupDescriptor uniformGroupDesc;
+	uniformGroupDesc.layout = uniformLayout;
+	uniformGroupDesc.entryCount = 1;
+	uniformGroupDesc.entries = &uniformEntry;
+	BindGroup uniformGroup = device.createBindGroup(uniformGroupDesc);
+	PipelineLayoutDescriptor layoutDesc;
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = &(WGPUBindGroupLayout)uniformLayout;
+	PipelineLayout layout = device.createPipelineLayout(layoutDesc);
+
+	std::unique_ptr<PipelineCache> pipelines = std::make_unique<PipelineCache>(device, ShaderDirectory());
+	PipelineKey key;
+	key.shader = pipelines->Shader("defaultshader.wgsl");
+	key.instances = InstanceLayout::Packed;
+	key.colorFormat = colorFormat;
+	key.depthFormat = depthFormat;
+	key.layout = layout;
+	RenderPipeline pipeline = pipelines->Wait(key);
+	if (!pipeline) {
+		std::cerr << "Could not build the benchmark pipeline\n";
+		return 1;
+	}
+
+	MeshPool pool(device, queue, 32, 1 << 16, 1 << 20);
+	vector<GpuCuller::Draw> meshes(meshCount);
+	vector<float> sphereVerts;
+	vector<unsigned int> sphereIdx;
+	for (unsigned int m = 0; m < meshCount; m++) {
+		SphereMesh(m, (float)m / meshCount, sphereVerts, sphereIdx);
+		unsigned int slot = pool.Add({ (const char*)sphereVerts.data(), sphereVerts.size() * sizeof(float) }, { (const char*)sphereIdx.data(), sphereIdx.size() * 4 });
+		MeshPool::Range range = pool.Get(slot);
+		meshes[m] = {};
+		meshes[m].indexCount = (unsigned int)sphereIdx.size();
+		meshes[m].firstIndex = range.idxOffset / 4;
+		meshes[m].baseVertex = range.baseVertex;
+	}
+
+	//one instance buffer per cell, its fixtures spread over the cell's square of a grid of cells
+	unsigned int perCell = drawsPerCell * instancesPerDraw;
+	unsigned int side = (unsigned int)std::ceil(std::sqrt((double)cellCount));
+	vector<Buffer> cellInstances(cellCount);
+	InstanceTransforms transforms(perCell, InstanceLayout::Packed);
+	unsigned long long cellBytes = (unsigned long long)perCell * transforms.Stride() * sizeof(float);
+	for (unsigned int c = 0; c < cellCount; c++) {
+		for (unsigned int i = 0; i < perCell; i++) {
+			unsigned int hash = (c * 7919u + i * 104729u) % 10007u;
+			transforms.SetPosition(i, (c % side) * 10.f + (hash % 100) * 0.1f - side * 5.f, (c / side) * 10.f + (hash / 100) * 0.1f - side * 5.f, 0.f);
+			transforms.SetRotation(i, 0.f, 0.f, hash * 0.01f);
+			transforms.SetScale(i, 0.2f);
+		}
+		transforms.Update();
+		BufferDescriptor desc;
+		desc.size = cellBytes;
+		desc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+		desc.mappedAtCreation = false;
+		desc.label = "bench cell instances";
+		cellInstances[c] = device.createBuffer(desc);
+		queue.writeBuffer(cellInstances[c], 0, transforms.Data(), cellBytes);
+	}
+
+	//the same commands for a pass and a bundle encoder
+	auto bindShared = [&](auto& encoder) {
+		encoder.setPipeline(pipeline);
+		encoder.setBindGroup(0, uniformGroup, 0, nullptr);
+		encoder.setVertexBuffer(0, pool.VertBuffer(), 0, (unsigned long long)pool.VertCapacity() * pool.VertStride());
+		encoder.setIndexBuffer(pool.IdxBuffer(), IndexFormat::Uint32, 0, pool.IdxCapacity());
+	};
+	auto drawCell = [&](auto& encoder, unsigned int c) {
+		encoder.setVertexBuffer(1, cellInstances[c], 0, cellBytes);
+		for (unsigned int d = 0; d < drawsPerCell; d++) {
+			const GpuCuller::Draw& mesh = meshes[(c + d) % meshCount];
+			encoder.drawIndexed(mesh.indexCount, instancesPerDraw, mesh.firstIndex, mesh.baseVertex, d * instancesPerDraw);
+		}
+	};
+	RenderBundleEncoderDescriptor bundleEncoderDesc;
+	bundleEncoderDesc.label = "bench cell bundle";
+	bundleEncoderDesc.colorFormatsCount = 1;
+	bundleEncoderDesc.colorFormats = (WGPUTextureFormat*)&colorFormat;
+	bundleEncoderDesc.depthStencilFormat = depthFormat;
+	bundleEncoderDesc.sampleCount = 1;
+	bundleEncoderDesc.depthReadOnly = false;
+	bundleEncoderDesc.stencilReadOnly = false;
+	RenderBundleDescriptor bundleDesc;
+	bundleDesc.label = "bench cell bundle";
+
+	RenderPassColorAttachment colorAttachment;
+	colorAttachment.view = colorView;
+	colorAttachment.resolveTarget = nullptr;
+	colorAttachment.loadOp = LoadOp::Clear;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = WGPUColor{ 0.05, 0.1, 0.11, 1.0 };
+	RenderPassDepthStencilAttachment depthAttachment;
+	depthAttachment.view = depthView;
+	depthAttachment.depthClearValue = 1.0f;
+	depthAttachment.depthLoadOp = LoadOp::Clear;
+	depthAttachment.depthStoreOp = StoreOp::Store;
+	depthAttachment.depthReadOnly = false;
+	depthAttachment.stencilClearValue = 0;
+	depthAttachment.stencilLoadOp = LoadOp::Clear;
+	depthAttachment.stencilStoreOp = StoreOp::Store;
+	depthAttachment.stencilReadOnly = false;
+	RenderPassDescriptor passDesc;
+	passDesc.label = "bench pass";
+	passDesc.colorAttachmentCount = 1;
+	passDesc.colorAttachments = &colorAttachment;
+	passDesc.depthStencilAttachment = &depthAttachment;
+	passDesc.timestampWriteCount = 0;
+	passDesc.timestampWrites = nullptr;
+	CommandEncoderDescriptor encoderDesc;
+	encoderDesc.label = "bench encoder";
+	CommandBufferDescriptor commandDesc;
+	commandDesc.label = "bench commands";
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	//records everything, submits it and waits for the gpu outside the timings. encode is from the start up to the submit
+	auto runFrame = [&](ThreadPool* threads, double& recordMs, double& encodeMs) {
+		auto start = Clock::now();
+		vector<WGPURenderBundle> bundles(cellCount);
+		auto recordCells = [&](size_t begin, size_t end) {
+			for (size_t c = begin; c < end; c++) {
+				RenderBundleEncoder bundleEncoder = device.createRenderBundleEncoder(bundleEncoderDesc);
+				bindShared(bundleEncoder);
+				drawCell(bundleEncoder, (unsigned int)c);
+				bundles[c] = bundleEncoder.finish(bundleDesc);
+				bundleEncoder.drop();
+			}
+		};
+		if (threads) threads->ParallelFor(cellCount, 1, recordCells);
+		else recordCells(0, cellCount);
+		auto recordEnd = Clock::now();
+
+		//stitched together in cell order whichever thread recorded what
+		CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+		RenderPassEncoder pass = encoder.beginRenderPass(passDesc);
+		pass.executeBundles(cellCount, bundles.data());
+		pass.end();
+		CommandBuffer commands = encoder.finish(commandDesc);
+		auto encodeEnd = Clock::now();
+		queue.submit(commands);
+		wgpuDevicePoll(device, true, nullptr);
+
+		for (WGPURenderBundle bundle : bundles) RenderBundle(bundle).drop();
+		pass.drop();
+		commands.drop();
+		encoder.drop();
+		recordMs = ms(recordEnd - start);
+		encodeMs = ms(encodeEnd - start);
+	};
+
+	//one encoder, one pass, one thread, how the windowed renderer drew before bundles
+	vector<double> directTimes;
+	for (unsigned int run = 0; run < warmupRuns + runs; run++) {
+		auto start = Clock::now();
+		CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+		RenderPassEncoder pass = encoder.beginRenderPass(passDesc);
+		bindShared(pass);
+		for (unsigned int c = 0; c < cellCount; c++) drawCell(pass, c);
+		pass.end();
+		CommandBuffer commands = encoder.finish(commandDesc);
+		auto encodeEnd = Clock::now();
+		queue.submit(commands);
+		wgpuDevicePoll(device, true, nullptr);
+		pass.drop();
+		commands.drop();
+		encoder.drop();
+		if (run >= warmupRuns) directTimes.push_back(ms(encodeEnd - start));
+	}
+
+	//1, 2, 4 ... threads and every core, the caller counts as one
+	vector<unsigned int> threadCounts;
+	unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+	for (unsigned int t = 1; t < cores; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(cores);
+
+	std::ostream& out = std::cout;
+	out << "{\n";
+	out << "  \"adapter\": \"" << (adapterProperties.name ? adapterProperties.name : "") << "\",\n";
+	out << "  \"backend\": " << (int)adapterProperties.backendType << ",\n";
+	out << "  \"cells\": " << cellCount << ", \"drawsPerCell\": " << drawsPerCell << ", \"runs\": " << runs << ",\n";
+	WriteTimings(out, "directEncodeMs", directTimes);
+	out << ",\n  \"bundles\": [\n";
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		std::unique_ptr<ThreadPool> threads = threadCounts[t] > 1 ? std::make_unique<ThreadPool>((int)threadCounts[t] - 1) : nullptr;
+		vector<double> recordTimes, encodeTimes;
+		for (unsigned int run = 0; run < warmupRuns + runs; run++) {
+			double recordMs, encodeMs;
+			runFrame(threads.get(), recordMs, encodeMs);
+			if (run < warmupRuns) continue;
+			recordTimes.push_back(recordMs);
+			encodeTimes.push_back(encodeMs);
+		}
+		out << "  { \"threads\": " << threadCounts[t] << ",\n";
+		WriteTimings(out, "recordMs", recordTimes);
+		out << ",\n";
+		WriteTimings(out, "encodeMs", encodeTimes);
+		out << " }" << (t + 1 < threadCounts.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+
+	for (Buffer& buffer : cellInstances) buffer.drop();
+	pipelines.reset();
+	depthView.drop();
+	depthTexture.drop();
+	colorView.drop();
+	colorTexture.drop();
+	uniformGroup.drop();
+	uniformBuffer.drop();
+	layout.drop();
+	uniformLayout.drop();
+	device.drop();
+	adapter.drop();
+	instance.drop();
+	return 0;
+}
+
+//--bench-fixtures [count], the old per-field FixtureFile loop against the bulk structure of arrays parse on one synthetic cell,
+//once with version 22 records and once with the 96 byte ones. fails if any field comes out different
+int BenchmarkFixtures(int argc, char** argv) {
+	unsigned int count = argc >= 3 ? (unsigned int)strtoul(argv[2], nullptr, 0) : 100000;
+	const int runs = 10;
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+	int result = 0;
+	for (unsigned int version : { 22u, 23u }) {
+		//random bytes everywhere, then the fields the parsers read
+		unsigned int stride = Eso::FixtureFile::RecordStride(version);
+		std::mt19937 random(version);
+		vector<char> cell(8 + (size_t)count * stride);
+		for (char& c : cell) c = (char)random();
+		std::memcpy(&cell[0], &version, 4);
+		std::memcpy(&cell[4], &count, 4);
+		std::uniform_real_distribution<float> value(-4000.f, 4000.f);
+		for (unsigned int i = 0; i < count; i++) {
+			char* record = &cell[8 + (size_t)i * stride];
+			unsigned long long id = ((unsigned long long)random() << 32) | random();
+			float fields[6];
+			for (float& f : fields) f = value(random);
+			unsigned int model = random() % 3000000;
+			std::memcpy(record, &id, 8);
+			std::memcpy(record + 16, fields, sizeof(fields));
+			std::memcpy(record + 68, &model, 4);
+		}
+		std::span<const char> bytes(cell.data(), cell.size());
+
+		//how FixtureFile read records before the bulk parse
+		vector<Eso::Fixture> reference(count);
+		double referenceTime = 0.0;
+		for (int run = 0; run < runs; run++) {
+			auto start = Clock::now();
+			BinaryReader reader(bytes);
+			unsigned int fileVersion, fixtureCount;
+			reader >> fileVersion >> fixtureCount;
+			for (unsigned int i = 0; i < fixtureCount; i++) {
+				Eso::Fixture& fixture = reference[i];
+				reader >> fixture.id;
+				reader.Seek(8);
+				reader >> fixture.rotX >> fixture.rotY >> fixture.rotZ >> fixture.x >> fixture.y >> fixture.z;
+				reader.Seek(12); //fixture header end
+				reader.Seek(16); //static start
+				reader >> fixture.model;
+				reader.Seek(8);
+				if (fileVersion != 22) reader.Seek(16);
+			}
+			referenceTime += ms(Clock::now() - start);
+		}
+
+		std::unique_ptr<Eso::FixtureFile> fixtures;
+		double bulkTime = 0.0;
+		for (int run = 0; run < runs; run++) {
+			auto start = Clock::now();
+			BinaryReader reader(bytes);
+			fixtures = std::make_unique<Eso::FixtureFile>(reader);
+			bulkTime += ms(Clock::now() - start);
+		}
+
+		//bitwise, both only copy bytes
+		size_t mismatches = fixtures->fixtureCount == count ? 0 : 1;
+		for (unsigned int i = 0; i < std::min(count, fixtures->fixtureCount); i++) {
+			Eso::Fixture a = reference[i], b = (*fixtures)[i];
+			bool same = a.id == b.id && a.model == b.model && std::memcmp(&a.x, &b.x, 6 * sizeof(float)) == 0;
+			if (!same && mismatches++ == 0) std::cerr << "Version " << version << " fixture " << i << " differs from the per-field parse\n";
+		}
+		cout << "version " << version << ", " << count << " fixtures, per-field " << referenceTime / runs << " ms, bulk " << bulkTime / runs << " ms, "
+			<< mismatches << " mismatches\n";
+		if (mismatches) result = 1;
+	}
+	return result;
+}
+
+//--bench-world <world directory> <archive> <world id> [--layers <layer:kind,...>], loads every cell of a world from the loose files
+//and from its cooked archive. the first load of each is cold as far as this process goes, drop the os file cache before running
+//for a truly cold one. the rest are warm. fails if the two paths don't see the same cells
+int BenchmarkWorld(int argc, char** argv) {
+	if (argc < 5) {
+		std::cerr << "--bench-world <world directory> <archive> <world id>\n";
+		return 1;
+	}
+	const char* directory = argv[2];
+	const char* archivePath = argv[3];
+	unsigned int world = (unsigned int)strtoul(argv[4], nullptr, 0);
+	vector<pair<unsigned int, Eso::CellKind>> layers;
+	Eso::ParseLayers(Eso::DefaultLayers, layers);
+	for (int i = 5; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--layers") == 0 && !Eso::ParseLayers(argv[i + 1], layers)) {
+			std::cerr << "Could not parse --layers " << argv[i + 1] << "\n";
+			return 1;
+		}
+	}
+	const int runs = 6;
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+	//what a load saw, so both paths can be checked against each other
+	struct Loaded {
+		size_t cells = 0;
+		size_t fixtures = 0;
+		size_t terrainBytes = 0;
+		double sum = 0.0; //touches every fixture position, not compared
+		bool operator==(const Loaded& other) const { return cells == other.cells && fixtures == other.fixtures && terrainBytes == other.terrainBytes; }
+	};
+	auto touchFixtures = [](const Eso::FixtureSpan& fixtures, Loaded& loaded) {
+		loaded.fixtures += fixtures.count;
+		for (size_t i = 0; i < fixtures.count; i++) loaded.sum += fixtures.x[i] + fixtures.y[i] + fixtures.z[i];
+	};
+	auto touchTerrain = [](Eso::TerrainFile& terrain, Loaded& loaded) {
+		for (int i = 0; i < terrain.layerCount; i++) {
+			Eso::TerrainLayer* layer = terrain.Layer(i);
+			if (layer && layer->Data()) loaded.terrainBytes += (size_t)layer->rowSize * layer->rowCount;
+		}
+	};
+
+	//the way WorldStreamer finds and parses loose cells, one file each
+	auto loadLoose = [&]() {
+		Loaded loaded;
+		char* tocFilename = Eso::World::WorldTocFilename(world);
+		std::string tocPath = std::string(directory) + "/" + tocFilename;
+		delete[] tocFilename;
+		Eso::Toc toc(tocPath.c_str());
+		Eso::CellIndex index(toc, world, directory);
+		for (auto& [layer, kind] : layers) {
+			for (unsigned int y = 0; y < index.sizeY; y++) {
+				for (unsigned int x = 0; x < index.sizeX; x++) {
+					if (!index.Exists(layer, x, y)) continue;
+					char* filename = Eso::World::WorldCellFilename(world, layer, x, y);
+					std::string path = std::string(directory) + "/" + filename;
+					delete[] filename;
+					loaded.cells++;
+					if (kind == Eso::CellKind::Fixture) touchFixtures(Eso::FixtureFile(path.c_str()).View(), loaded);
+					else {
+						Eso::TerrainFile terrain(path.c_str());
+						touchTerrain(terrain, loaded);
+					}
+				}
+			}
+		}
+		return loaded;
+	};
+	//one mapping, cells are found in the table and used in place
+	auto loadArchive = [&]() {
+		Loaded loaded;
+		Eso::WorldArchive archive(archivePath);
+		if (!archive.Good()) return loaded;
+		for (auto& [layer, kind] : layers) {
+			for (unsigned int y = 0; y < archive.Info().sizeY; y++) {
+				for (unsigned int x = 0; x < archive.Info().sizeX; x++) {
+					const Eso::WorldArchive::Entry* entry = archive.Find(Eso::World::CellId(world, layer, x, y));
+					if (!entry) continue;
+					loaded.cells++;
+					if (kind == Eso::CellKind::Fixture) touchFixtures(archive.Fixtures(*entry), loaded);
+					else {
+						Eso::TerrainFile terrain(archive.CellBytes(*entry));
+						touchTerrain(terrain, loaded);
+					}
+				}
+			}
+		}
+		return loaded;
+	};
+
+	Loaded loose, cooked;
+	vector<double> looseTimes, archiveTimes;
+	for (int run = 0; run < runs; run++) {
+		//FixtureFile prints every cell's count
+		cout.setstate(std::ios_base::failbit);
+		auto start = Clock::now();
+		loose = loadLoose();
+		auto looseEnd = Clock::now();
+		cooked = loadArchive();
+		auto archiveEnd = Clock::now();
+		cout.clear();
+		looseTimes.push_back(ms(looseEnd - start));
+		archiveTimes.push_back(ms(archiveEnd - looseEnd));
+	}
+	auto warm = [](const vector<double>& times) { return vector<double>(times.begin() + 1, times.end()); };
+
+	std::ostream& out = std::cout;
+	out << "{\n";
+	out << "  \"cells\": " << loose.cells << ", \"fixtures\": " << loose.fixtures << ", \"terrainBytes\": " << loose.terrainBytes << ",\n";
+	out << "  \"looseColdMs\": " << looseTimes[0] << ", \"archiveColdMs\": " << archiveTimes[0] << ",\n";
+	WriteTimings(out, "looseWarmMs", warm(looseTimes));
+	out << ",\n";
+	WriteTimings(out, "archiveWarmMs", warm(archiveTimes));
+	out << "\n}\n";
+	if (!(loose == cooked)) {
+		std::cerr << "The archive has " << cooked.cells << " cells, " << cooked.fixtures << " fixtures and " << cooked.terrainBytes
+			<< " terrain bytes, the loose files " << loose.cells << ", " << loose.fixtures << " and " << loose.terrainBytes << "\n";
+		return 1;
+	}
+	return 0;
+}
+
+//--bench-vertices [count], ConvertEsoVertsScalar against the simd kernel on one thread and ConvertEsoVerts across threads.
+//random verts behind every pair of the signed nx/ny edge cases, the outputs have to match the scalar one byte for byte
+int BenchmarkVertices(int argc, char** argv) {
+	int count = argc >= 3 ? (int)strtol(argv[2], nullptr, 0) : 1000000;
+	const int runs = 10;
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+	//wrapping, both signs, the ends of the range and normals whose z comes out nan
+	const short edges[] = { 0, 1, -1, 8192, -8192, 16383, 16384, -16384, -16385, 32767, -32767, -32768 };
+	vector<EsoVert> source;
+	for (short nx : edges) {
+		for (short ny : edges) {
+			EsoVert vert = {};
+			vert.x = source.size() % 2 ? -0.f : 0.f;
+			vert.nx = nx;
+			vert.ny = ny;
+			source.push_back(vert);
+		}
+	}
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-100.f, 100.f);
+	std::uniform_int_distribution<int> word(-32768, 32767);
+	//never a multiple of 4 so the simd path's scalar tail gets some too
+	size_t target = std::max((size_t)std::max(count, 0), source.size());
+	if (target % 4 == 0) target += 3;
+	while (source.size() < target) {
+		EsoVert vert;
+		vert.x = position(random); vert.y = position(random); vert.z = position(random);
+		vert.r = (char)word(random); vert.g = (char)word(random); vert.b = (char)word(random); vert.a = (char)word(random);
+		vert.nx = (short)word(random); vert.ny = (short)word(random);
+		vert.tx = (short)word(random); vert.ty = (short)word(random); vert.bx = (short)word(random); vert.by = (short)word(random);
+		vert.u = (short)word(random); vert.v = (short)word(random);
+		source.push_back(vert);
+	}
+	count = (int)source.size();
+	static_assert(sizeof(EsoVert) == 32, "verts are converted in place at 32 bytes");
+	const char* sourceBytes = (const char*)source.data();
+	size_t bytes = (size_t)count * 32;
+
+	vector<char> reference(bytes), converted(bytes);
+	auto time = [&](vector<char>& out, auto convert) {
+		double total = 0.0;
+		for (int run = 0; run < runs; run++) {
+			std::memcpy(out.data(), sourceBytes, bytes);
+			auto start = Clock::now();
+			convert(out.data());
+			total += ms(Clock::now() - start);
+		}
+		return total / runs;
+	};
+	//first differing byte, -1 if there's none
+	auto firstDifference = [&]() -> long long {
+		for (size_t i = 0; i < bytes; i++) {
+			if (reference[i] != converted[i]) return (long long)i;
+		}
+		return -1;
+	};
+
+	int result = 0;
+	double scalarTime = time(reference, [&](char* verts) { ConvertEsoVertsScalar(verts, 0, count); });
+	cout << count << " verts\n";
+	cout << "scalar " << scalarTime << " ms\n";
+	struct Variant {
+		const char* name;
+		std::function<void(char*)> convert;
+	};
+	//the simd one also starts off a multiple of 4 and ends in the scalar tail
+	Variant variants[] = {
+		{ "simd", [&](char* verts) { ConvertEsoVertsSimd(verts, 0, count); } },
+		{ "simd, unaligned range", [&](char* verts) { ConvertEsoVertsScalar(verts, 0, 1); ConvertEsoVertsSimd(verts, 1, count); } },
+		{ "threaded", [&](char* verts) { ConvertEsoVerts(verts, count); } },
+	};
+	for (Variant& variant : variants) {
+		double variantTime = time(converted, variant.convert);
+		long long difference = firstDifference();
+		cout << variant.name << " " << variantTime << " ms, " << scalarTime / std::max(variantTime, 1e-9) << "x";
+		if (difference >= 0) {
+			cout << ", vert " << difference / 32 << " byte " << difference % 32 << " differs from the scalar output\n";
+			result = 1;
+			break;
+		}
+		cout << ", identical\n";
+	}
+	return result;
+}
+
+//--test-allocator [operations] [seed], random allocates and frees on an OffsetAllocator checked against a map of the live ranges:
+//nothing overlaps or runs past the end, FreeStorage adds up and a request no bigger than LargestFree never fails.
+//then a free between two free neighbours has to merge all three, and Repack (what MeshPool::Defragment and growing run on) has to place
+//every range back to back and leave one free range, growing when a nearly full one doesn't fit
+int TestAllocator(int argc, char** argv) {
+	int operations = argc >= 3 ? (int)strtol(argv[2], nullptr, 0) : 1000000;
+	unsigned int seed = argc >= 4 ? (unsigned int)strtoul(argv[3], nullptr, 0) : 1;
+	const unsigned int size = 1 << 20;
+
+	int failures = 0;
+	auto check = [&](bool ok, const char* what, int operation) {
+		if (!ok && failures++ < 10) std::cerr << "Operation " << operation << ": " << what << "\n";
+		return ok;
+	};
+
+	OffsetAllocator allocator(size);
+	std::map<unsigned int, OffsetAllocator::Allocation> live; //by offset
+	unsigned int liveTotal = 0;
+	std::mt19937 random(seed);
+	//mostly small, sometimes big enough to hit the upper bins
+	auto randomSize = [&]() { return random() % 16 == 0 ? 1 + random() % (size / 16) : 1 + random() % 512; };
+	int allocations = 0, misses = 0;
+	for (int operation = 0; operation < operations && !failures; operation++) {
+		//drift between mostly full and mostly empty so both ends get exercised
+		bool filling = (operation / 50000) % 2 == 0;
+		if (live.empty() || random() % 100 < (filling ? 60u : 40u)) {
+			unsigned int request = randomSize();
+			unsigned int largest = allocator.LargestFree();
+			OffsetAllocator::Allocation allocation = allocator.Allocate(request);
+			if (allocation.offset == OffsetAllocator::NoSpace) {
+				check(request > largest, "failed under LargestFree", operation);
+				misses++;
+				continue;
+			}
+			allocations++;
+			check(allocation.offset < size && request <= size - allocation.offset, "past the end", operation);
+			check(allocator.AllocationSize(allocation) == request, "wrong AllocationSize", operation);
+			auto next = live.lower_bound(allocation.offset);
+			if (next != live.end()) check(allocation.offset + request <= next->first, "overlaps the next range", operation);
+			if (next != live.begin()) {
+				auto prev = std::prev(next);
+				check(prev->first + allocator.AllocationSize(prev->second) <= allocation.offset, "overlaps the previous range", operation);
+			}
+			live[allocation.offset] = allocation;
+			liveTotal += request;
+		}
+		else {
+			auto it = live.begin();
+			std::advance(it, random() % live.size());
+			liveTotal -= allocator.AllocationSize(it->second);
+			allocator.Free(it->second);
+			live.erase(it);
+		}
+		check(allocator.FreeStorage() == size - liveTotal, "FreeStorage doesn't add up", operation);
+	}
+
+	//everything freed has to merge back into the one range it started as
+	for (auto& [offset, allocation] : live) allocator.Free(allocation);
+	live.clear();
+	check(allocator.FreeStorage() == size, "not all free after freeing everything", operations);
+	OffsetAllocator::Allocation whole = allocator.Allocate(size);
+	check(whole.offset == 0, "whole range not available after freeing everything", operations);
+	allocator.Free(whole);
+
+	//takes whatever is free in the biggest pieces that always fit, if all of it is one range they come out back to back from start
+	auto fillFrom = [&](unsigned int start) {
+		for (unsigned int next = start; allocator.FreeStorage() > 0;) {
+			OffsetAllocator::Allocation allocation = allocator.Allocate(allocator.LargestFree());
+			if (allocation.offset != next) return false;
+			next += allocator.AllocationSize(allocation);
+		}
+		return true;
+	};
+
+	//a b c back to back and the rest full, freeing a and c then b has to leave one range of all three at a
+	OffsetAllocator::Allocation a = allocator.Allocate(64), b = allocator.Allocate(32), c = allocator.Allocate(928);
+	check(a.offset == 0 && b.offset == 64 && c.offset == 96, "a b c not back to back from the start", operations);
+	check(fillFrom(1024), "the rest isn't one range after a b c", operations);
+	allocator.Free(a);
+	allocator.Free(c);
+	allocator.Free(b);
+	check(allocator.FreeStorage() == 1024, "FreeStorage wrong after freeing between two free neighbours", operations);
+	check(allocator.Allocate(1024).offset == 0, "free between two free neighbours didn't merge both", operations);
+	allocator.Reset(size);
+
+	//fragment it again, then Repack like MeshPool::Rebuild does, every live range again in order of its old offset
+	for (int i = 0; i < 20000; i++) {
+		OffsetAllocator::Allocation allocation = allocator.Allocate(randomSize());
+		if (allocation.offset != OffsetAllocator::NoSpace) live[allocation.offset] = allocation;
+	}
+	for (auto it = live.begin(); it != live.end();) {
+		if (random() % 2) {
+			allocator.Free(it->second);
+			it = live.erase(it);
+		}
+		else it++;
+	}
+	unsigned int fragmentedFree = allocator.FreeStorage();
+	vector<unsigned int> liveSizes;
+	for (auto& [offset, allocation] : live) liveSizes.push_back(allocator.AllocationSize(allocation));
+	vector<OffsetAllocator::Allocation> placed;
+	//all placed back to back from 0, true when the size stayed at minSize
+	auto repack = [&](unsigned int minSize, const vector<unsigned int>& sizes) {
+		unsigned int newSize = allocator.Repack(minSize, sizes, placed);
+		unsigned int packed = 0;
+		for (size_t i = 0; i < sizes.size(); i++) {
+			check(placed[i].offset == packed, "repacked range not straight after the previous one", operations);
+			packed += sizes[i];
+		}
+		check(newSize >= minSize && allocator.Size() == newSize, "Repack shrank", operations);
+		check(allocator.FreeStorage() == newSize - packed, "FreeStorage wrong after the repack", operations);
+		check(fillFrom(packed), "free space after the repack isn't one range", operations);
+		return newSize == minSize;
+	};
+	check(repack(size, liveSizes), "half empty repack had to grow", operations);
+	check(size - std::accumulate(liveSizes.begin(), liveSizes.end(), 0u) == fragmentedFree, "repack changed the free total", operations);
+
+	//nearly full, 1047 doesn't fit the 1047 left after the first range since that free range sits in the bin below it
+	vector<unsigned int> nearlyFull = { 1, 1047 };
+	check(!repack(1048, nearlyFull), "nearly full repack fit at the same size, the bins changed", operations);
+	//how MeshPool::Add grows, 1000 of 1024 used and 1047 more needs double. still short on bins, so Repack doubles again
+	vector<unsigned int> growing = { 1000, 1047 };
+	repack(2048, growing);
+
+	cout << allocations << " allocations, " << misses << " out of space, " << live.size() << " ranges repacked, free "
+		<< fragmentedFree << " of " << size << ", " << failures << " failures\n";
+	return failures ? 1 : 0;
+}
+
+//--test-cull [--software], GpuCuller::Cull on a fixed set of instances and draws against a few fixed frusta, in both instance layouts.
+//the indirect args and visible instances are read back and compared with sphereVisible from cull.wgsl redone on the cpu.
+//spheres within rounding of a plane may go either way, anything else that differs fails it
+int TestCull(int argc, char** argv) {
+	bool software = false;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--software") == 0) software = true;
+	}
+
+	Instance instance = wgpu::createInstance(InstanceDescriptor());
+	RequestAdapterOptions adapterOptions;
+	adapterOptions.compatibleSurface = nullptr;
+	adapterOptions.forceFallbackAdapter = software;
+	Adapter adapter = instance.requestAdapter(adapterOptions);
+	if (!adapter) {
+		std::cerr << "No adapter" << (software ? " (software)" : "") << "\n";
+		return 1;
+	}
+	Device device = CreateDevice(adapter);
+	Queue queue = device.getQueue();
+
+	//group 0 like the windowed renderer, the cull pass only reads the frustum out of it
+	BindGroupLayoutEntry uniformLayoutEntry = Default;
+	uniformLayoutEntry.binding = 0;
+	uniformLayoutEntry.visibility = ShaderStage::Vertex | ShaderStage::Compute;
+	uniformLayoutEntry.buffer.type = BufferBindingType::Uniform;
+	uniformLayoutEntry.buffer.minBindingSize = sizeof(Uniforms);
+	BindGroupLayoutDescriptor uniformLayoutDesc;
+	uniformLayoutDesc.entryCount = 1;
+	uniformLayoutDesc.entries = &uniformLayoutEntry;
+	BindGroupLayout uniformLayout = device.createBindGroupLayout(uniformLayoutDesc);
+	BufferDescriptor uniformBufferDesc;
+	uniformBufferDesc.size = sizeof(Uniforms);
+	uniformBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	uniformBufferDesc.mappedAtCreation = false;
+	uniformBufferDesc.label = "cull test uniform buffer";
+	Buffer uniformBuffer = device.createBuffer(uniformBufferDesc);
+	BindGroupEntry uniformEntry = Default;
+	uniformEntry.binding = 0;
+	uniformEntry.buffer = uniformBuffer;
+	uniformEntry.offset = 0;
+	uniformEntry.size = sizeof(Uniforms);
+	BindGroupDescriptor uniformGroupDesc;
+	uniformGroupDesc.layout = uniformLayout;
+	uniformGroupDesc.entryCount = 1;
+	uniformGroupDesc.entries = &uniformEntry;
+	BindGroup uniformGroup = device.createBindGroup(uniformGroupDesc);
+	std::unique_ptr<PipelineCache> pipelines = std::make_unique<PipelineCache>(device, ShaderDirectory());
+	ShaderModule cullShader = pipelines->Module(pipelines->Shader("cull.wgsl"));
+
+	//draws back to back over the instances, one of them empty, with spheres off centre and of different sizes
+	const unsigned int drawCounts[] = { 700, 1, 0, 333, 1000 };
+	const unsigned int drawCount = sizeof(drawCounts) / sizeof(drawCounts[0]);
+	vector<GpuCuller::Draw> draws(drawCount);
+	unsigned int instanceCount = 0;
+	for (unsigned int d = 0; d < drawCount; d++) {
+		draws[d] = {};
+		draws[d].indexCount = 36 + d;
+		draws[d].firstIndex = 100 * d;
+		draws[d].baseVertex = 10 * (int)d - 20;
+		draws[d].firstInstance = instanceCount;
+		draws[d].instanceCount = drawCounts[d];
+		draws[d].center[0] = 0.5f * d;
+		draws[d].center[1] = -0.25f * d;
+		draws[d].center[2] = 0.1f;
+		draws[d].radius = 0.5f + 0.75f * d;
+		instanceCount += drawCounts[d];
+	}
+	std::mt19937 random(14);
+	std::uniform_real_distribution<float> position(-60.f, 60.f), angle(-glm::pi<float>(), glm::pi<float>()), scale(0.25f, 3.f);
+	struct Placement {
+		float p[3], r[3], s;
+	};
+	vector<Placement> placements(instanceCount);
+	for (Placement& placement : placements) {
+		for (float& p : placement.p) p = position(random);
+		for (float& r : placement.r) r = angle(random);
+		placement.s = scale(random);
+	}
+
+	//outside looking in, inside the cloud, looking away from everything, a narrow one and an orthographic one over all of it
+	struct View {
+		mat4 proj, view;
+	};
+	const View views[] = {
+		{ glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 500.f), glm::lookAt(vec3(150.f, 20.f, 40.f), vec3(0.f), vec3(0.f, 0.f, 1.f)) },
+		{ glm::perspective(glm::radians(90.f), 1.f, 0.5f, 40.f), glm::lookAt(vec3(5.f, -3.f, 2.f), vec3(30.f, 10.f, -5.f), vec3(0.f, 0.f, 1.f)) },
+		{ glm::perspective(glm::radians(60.f), 1.f, 0.1f, 100.f), glm::lookAt(vec3(200.f, 0.f, 0.f), vec3(400.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f)) },
+		{ glm::perspective(glm::radians(10.f), 2.f, 1.f, 300.f), glm::lookAt(vec3(-80.f, -80.f, 30.f), vec3(0.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f)) },
+		{ glm::ortho(-50.f, 50.f, -30.f, 30.f, 0.f, 200.f), glm::lookAt(vec3(0.f, 0.f, 100.f), vec3(0.f), vec3(0.f, 1.f, 0.f)) },
+	};
+
+	int failures = 0;
+	auto fail = [&](const char* layoutName, unsigned int v, const std::string& what) {
+		if (failures++ < 20) std::cerr << layoutName << " view " << v << ": " << what << "\n";
+	};
+	for (InstanceLayout layout : { InstanceLayout::Matrix, InstanceLayout::Packed }) {
+		const char* layoutName = layout == InstanceLayout::Matrix ? "matrix" : "packed";
+		InstanceTransforms transforms(instanceCount, layout);
+		for (unsigned int i = 0; i < instanceCount; i++) {
+			transforms.SetPosition(i, placements[i].p[0], placements[i].p[1], placements[i].p[2]);
+			transforms.SetRotation(i, placements[i].r[0], placements[i].r[1], placements[i].r[2]);
+			transforms.SetScale(i, placements[i].s);
+		}
+		transforms.Update();
+		size_t instanceBytes = transforms.Stride() * sizeof(float);
+
+		GpuCuller culler(device, queue, cullShader, uniformLayout, instanceCount, drawCount, layout);
+		culler.Update(transforms.Data(), draws);
+
+		for (unsigned int v = 0; v < sizeof(views) / sizeof(views[0]); v++) {
+			Uniforms uniformData = {};
+			uniformData.proj = views[v].proj;
+			uniformData.view = views[v].view;
+			ExtractFrustum(uniformData.proj * uniformData.view, uniformData.frustum);
+			queue.writeBuffer(uniformBuffer, 0, &uniformData, sizeof(Uniforms));
+			culler.ResetCounts();
+
+			CommandEncoderDescriptor encoderDesc;
+			encoderDesc.label = "cull test encoder";
+			CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+			culler.Cull(encoder, uniformGroup);
+			CommandBufferDescriptor commandDesc;
+			commandDesc.label = "cull test commands";
+			CommandBuffer commands = encoder.finish(commandDesc);
+			queue.submit(commands);
+			commands.drop();
+			encoder.drop();
+
+			vector<char> argsBytes, visibleBytes;
+			if (!ReadBuffer(device, queue, culler.ArgsBuffer(), (size_t)drawCount * 5 * sizeof(unsigned int), argsBytes)
+				|| !ReadBuffer(device, queue, culler.VisibleBuffer(), (size_t)instanceCount * instanceBytes, visibleBytes)) {
+				fail(layoutName, v, "readback failed to map");
+				continue;
+			}
+			const unsigned int* args = (const unsigned int*)argsBytes.data();
+
+			unsigned int visibleTotal = 0, edgeTotal = 0;
+			for (unsigned int d = 0; d < drawCount; d++) {
+				const GpuCuller::Draw& draw = draws[d];
+				const unsigned int* drawArgs = args + d * 5;
+				if (drawArgs[0] != draw.indexCount || drawArgs[2] != draw.firstIndex || (int)drawArgs[3] != draw.baseVertex || drawArgs[4] != 0) {
+					fail(layoutName, v, "draw " + std::to_string(d) + " args other than the instance count changed");
+				}
+
+				//same test as sphereVisible, the smallest distance inside a plane is negative when it's culled
+				vector<char> expected(draw.instanceCount), seen(draw.instanceCount, 0);
+				unsigned int sure = 0, edge = 0;
+				for (unsigned int j = 0; j < draw.instanceCount; j++) {
+					unsigned int i = draw.firstInstance + j;
+					float worldCenter[3];
+					transforms.TransformPoint(i, draw.center, worldCenter);
+					vec3 center(worldCenter[0], worldCenter[1], worldCenter[2]);
+					float radius = draw.radius * placements[i].s;
+					float inside = std::numeric_limits<float>::max();
+					for (const glm::vec4& plane : uniformData.frustum) inside = std::min(inside, glm::dot(vec3(plane), center) + plane.w + radius);
+					float tolerance = 1e-4f * (1.f + glm::length(center) + radius);
+					if (std::abs(inside) <= tolerance) {
+						expected[j] = 2; //either way
+						edge++;
+					}
+					else if (inside > 0.f) {
+						expected[j] = 1;
+						sure++;
+					}
+				}
+				edgeTotal += edge;
+
+				unsigned int count = drawArgs[1];
+				if (count < sure || count > sure + edge) {
+					fail(layoutName, v, "draw " + std::to_string(d) + " has " + std::to_string(count) + " visible, expected " + std::to_string(sure)
+						+ (edge ? " to " + std::to_string(sure + edge) : ""));
+					continue;
+				}
+				visibleTotal += count;
+
+				//every visible slot has to be a distinct instance of the draw that the cpu didn't cull
+				for (unsigned int slot = 0; slot < count; slot++) {
+					const char* visible = visibleBytes.data() + (draw.firstInstance + slot) * instanceBytes;
+					unsigned int j = 0;
+					while (j < draw.instanceCount && std::memcmp(visible, transforms.Instance(draw.firstInstance + j), instanceBytes) != 0) j++;
+					if (j == draw.instanceCount) fail(layoutName, v, "draw " + std::to_string(d) + " slot " + std::to_string(slot) + " isn't one of its instances");
+					else if (seen[j]++) fail(layoutName, v, "draw " + std::to_string(d) + " instance " + std::to_string(j) + " is visible twice");
+					else if (!expected[j]) fail(layoutName, v, "draw " + std::to_string(d) + " instance " + std::to_string(j) + " should have been culled");
+				}
+			}
+			cout << layoutName << " view " << v << ": " << visibleTotal << " of " << instanceCount << " visible, " << edgeTotal << " on a plane\n";
+		}
+	}
+
+	cout << failures << " failures\n";
+	pipelines.reset();
+	uniformGroup.drop();
+	uniformBuffer.drop();
+	uniformLayout.drop();
+	device.drop();
+	adapter.drop();
+	instance.drop();
+	return failures ? 1 : 0;
+}
+
+//--test-rotations, PackFixture on known euler triples against the glm matrix of the same rotation, z then y then x like
+//BenchmarkInstances builds it. identity, quarter and half turns about each axis, pitch at +-90 degrees where x and z lock together,
+//and random triples. the quaternion is applied the way cull.wgsl and the packed vertex shader do it, fails past the tolerance
+int TestRotations(int argc, char** argv) {
+	const float tolerance = 1e-5f;
+	const float scale = 2.5f;
+	const float quarter = glm::half_pi<float>(), half = glm::pi<float>();
+	struct Case {
+		std::string name;
+		float x, y, z;
+	};
+	vector<Case> cases = {
+		{ "identity", 0.f, 0.f, 0.f },
+		{ "x 90", quarter, 0.f, 0.f }, { "x -90", -quarter, 0.f, 0.f }, { "x 180", half, 0.f, 0.f },
+		{ "y 90", 0.f, quarter, 0.f }, { "y -90", 0.f, -quarter, 0.f }, { "y 180", 0.f, half, 0.f },
+		{ "z 90", 0.f, 0.f, quarter }, { "z -90", 0.f, 0.f, -quarter }, { "z 180", 0.f, 0.f, half },
+		{ "pitch 90, x 30 z 60", glm::radians(30.f), quarter, glm::radians(60.f) },
+		{ "pitch 90, x 60 z 90", glm::radians(60.f), quarter, quarter },
+		{ "pitch -90, x -45 z 120", glm::radians(-45.f), -quarter, glm::radians(120.f) },
+		{ "pitch -90, x 180 z 180", half, -quarter, half },
+		{ "x 180 y 180 z 180", half, half, half },
+	};
+	std::mt19937 random(17);
+	std::uniform_real_distribution<float> angle(-glm::two_pi<float>(), glm::two_pi<float>());
+	for (int i = 0; i < 1000; i++) {
+		float x = angle(random), y = angle(random), z = angle(random);
+		cases.push_back({ "random " + std::to_string(i), x, y, z });
+	}
+
+	int failures = 0;
+	float worst = 0.f;
+	for (const Case& test : cases) {
+		Eso::Fixture fixture = {};
+		fixture.x = 100.f;
+		fixture.y = -2000.f;
+		fixture.z = 37.5f;
+		fixture.rotX = test.x;
+		fixture.rotY = test.y;
+		fixture.rotZ = test.z;
+		PackedInstance packed = PackFixture(fixture, scale);
+
+		mat4 expected = glm::translate(mat4(1), vec3(fixture.x, fixture.y, fixture.z));
+		expected = glm::scale(expected, vec3(scale));
+		expected = glm::rotate(expected, test.z, vec3(0.f, 0.f, 1.f));
+		expected = glm::rotate(expected, test.y, vec3(0.f, 1.f, 0.f));
+		expected = glm::rotate(expected, test.x, vec3(1.f, 0.f, 0.f));
+
+		//each axis through the quaternion against the matching column, then the translation
+		vec3 q(packed.qx, packed.qy, packed.qz);
+		float error = std::abs(glm::length(glm::vec4(q, packed.qw)) - 1.f);
+		for (int c = 0; c < 3; c++) {
+			vec3 v(0.f);
+			v[c] = packed.scale;
+			vec3 t = 2.f * glm::cross(q, v);
+			vec3 rotated = v + packed.qw * t + glm::cross(q, t);
+			error = std::max(error, glm::length(rotated - vec3(expected[c])) / scale);
+		}
+		error = std::max(error, glm::length(vec3(packed.x, packed.y, packed.z) - vec3(expected[3])));
+		worst = std::max(worst, error);
+		if (error > tolerance && failures++ < 20) {
+			std::cerr << test.name << " (" << test.x << ", " << test.y << ", " << test.z << ") is off by " << error << "\n";
+		}
+	}
+	cout << cases.size() << " rotations, worst error " << worst << ", " << failures << " over " << tolerance << "\n";
+	return failures ? 1 : 0;
+}
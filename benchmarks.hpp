@@ -0,0 +1,25 @@
+#pragma once
+
+//command line modes that run instead of the window. each takes main's arguments with its own flag in argv[1]
+//and returns the exit code, non-zero when one of its checks failed
+
+//--bench-bvh [fixture count]
+int BenchmarkBvh(int argc, char** argv);
+//--bench-instances [count]
+int BenchmarkInstances(int argc, char** argv);
+//--bench-render [models] [instances per model] [frames] [--software] [--readback out.ppm] [--reference in.ppm]
+int BenchmarkRender(int argc, char** argv);
+//--bench-record [cells] [draws per cell] [--software]
+int BenchmarkRecord(int argc, char** argv);
+//--bench-fixtures [count]
+int BenchmarkFixtures(int argc, char** argv);
+//--bench-world <world directory> <archive> <world id> [--layers <layer:kind,...>]
+int BenchmarkWorld(int argc, char** argv);
+//--bench-vertices [count]
+int BenchmarkVertices(int argc, char** argv);
+//--test-allocator [operations] [seed]
+int TestAllocator(int argc, char** argv);
+//--test-cull [--software]
+int TestCull(int argc, char** argv);
+//--test-rotations
+int TestRotations(int argc, char** argv);
@@ -0,0 +1,174 @@
+#include "cellBundles.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+using namespace wgpu;
+
+CellBundles::CellBundles(Device device, Queue queue, ModelRegistry& models, MeshPool& pool, const Targets& targets, InstanceLayout layout,
+	ThreadPool* threads)
+	: device(device), queue(queue), models(models), pool(pool), targets(targets), layout(layout), poolGeneration(pool.Generation()), threads(threads) {
+}
+
+CellBundles::~CellBundles() {
+	for (auto& [id, cell] : cells) Drop(cell);
+}
+
+void CellBundles::AddCell(unsigned long long id, const Eso::FixtureSpan& fixtures) {
+	RemoveCell(id);
+	Cell& cell = cells[id];
+
+	//one run per model, so one draw per model in the bundle
+	std::vector<unsigned int> order(fixtures.count);
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return fixtures.models[a] < fixtures.models[b]; });
+
+	InstanceTransforms transforms((unsigned int)fixtures.count, layout);
+	float boundsMin[3] = { INFINITY, INFINITY, INFINITY };
+	float boundsMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+	float maxRadius = 0.f;
+	for (unsigned int i = 0; i < fixtures.count; i++) {
+		unsigned int f = order[i];
+		unsigned int model = fixtures.models[f];
+		if (cell.runs.empty() || cell.runs.back().model != model) cell.runs.push_back({ model, i, 0 });
+		cell.runs.back().instanceCount++;
+
+		float position[3] = { fixtures.x[f], fixtures.y[f], fixtures.z[f] };
+		transforms.SetPosition(i, position[0], position[1], position[2]);
+		transforms.SetRotation(i, fixtures.rotX[f], fixtures.rotY[f], fixtures.rotZ[f]);
+		for (int c = 0; c < 3; c++) {
+			boundsMin[c] = std::min(boundsMin[c], position[c]);
+			boundsMax[c] = std::max(boundsMax[c], position[c]);
+		}
+	}
+	for (const Run& run : cell.runs) {
+		const Model* model = models.Find(run.model);
+		if (!model) continue;
+		float offset = std::sqrt(model->center[0] * model->center[0] + model->center[1] * model->center[1] + model->center[2] * model->center[2]);
+		maxRadius = std::max(maxRadius, offset + model->radius);
+	}
+	transforms.Update();
+
+	float halfDiagonal = 0.f;
+	for (int c = 0; c < 3; c++) {
+		cell.sphere[c] = fixtures.count ? (boundsMin[c] + boundsMax[c]) * 0.5f : 0.f;
+		float half = fixtures.count ? (boundsMax[c] - boundsMin[c]) * 0.5f : 0.f;
+		halfDiagonal += half * half;
+	}
+	cell.sphere[3] = std::sqrt(halfDiagonal) + maxRadius;
+
+	if (fixtures.count == 0) return;
+	unsigned long long bytes = (unsigned long long)fixtures.count * transforms.Stride() * sizeof(float);
+	BufferDescriptor desc;
+	desc.size = bytes;
+	desc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+	desc.mappedAtCreation = false;
+	desc.label = "cell instance buffer";
+	cell.instances = device.createBuffer(desc);
+	queue.writeBuffer(cell.instances, 0, transforms.Data(), bytes);
+}
+
+void CellBundles::RemoveCell(unsigned long long id) {
+	auto it = cells.find(id);
+	if (it == cells.end()) return;
+	Drop(it->second);
+	cells.erase(it);
+}
+
+void CellBundles::Invalidate(unsigned long long id) {
+	auto it = cells.find(id);
+	if (it == cells.end() || !it->second.bundle) return;
+	it->second.bundle.drop();
+	it->second.bundle = nullptr;
+}
+
+void CellBundles::Execute(RenderPassEncoder& pass, const float planes[6][4]) {
+	PROFILE_SCOPE("cell bundles");
+	//the pool replaced its buffers or moved meshes, every bundle points at the old ones
+	unsigned int generation = pool.Generation();
+	if (generation != poolGeneration) {
+		for (auto& [id, cell] : cells) {
+			if (cell.bundle) cell.bundle.drop();
+			cell.bundle = nullptr;
+		}
+		poolGeneration = generation;
+	}
+
+	visibleCells.clear();
+	for (auto& [id, cell] : cells) {
+		if (!cell.instances) continue;
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++) {
+			inside = planes[p][0] * cell.sphere[0] + planes[p][1] * cell.sphere[1] + planes[p][2] * cell.sphere[2] + planes[p][3] >= -cell.sphere[3];
+		}
+		if (inside) visibleCells.emplace_back(id, &cell);
+	}
+	//the map's order changes as cells come and go, the same cells should always replay the same way
+	std::sort(visibleCells.begin(), visibleCells.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+	stale.clear();
+	for (auto& [id, cell] : visibleCells) {
+		if (!cell->bundle) stale.push_back(cell);
+	}
+	if (threads && stale.size() > 1) {
+		threads->ParallelFor(stale.size(), 1, [this](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) Record(*stale[i]);
+		});
+	}
+	else {
+		for (Cell* cell : stale) Record(*cell);
+	}
+	recorded = (unsigned int)stale.size();
+
+	visible.clear();
+	for (auto& [id, cell] : visibleCells) visible.push_back(cell->bundle);
+	if (!visible.empty()) pass.executeBundles((uint32_t)visible.size(), visible.data());
+}
+
+void CellBundles::Record(Cell& cell) {
+	PROFILE_SCOPE("record bundle");
+	RenderBundleEncoderDescriptor encoderDesc;
+	encoderDesc.label = "cell bundle";
+	encoderDesc.colorFormatsCount = 1;
+	encoderDesc.colorFormats = (WGPUTextureFormat*)&targets.colorFormat;
+	encoderDesc.depthStencilFormat = targets.depthFormat;
+	encoderDesc.sampleCount = 1;
+	encoderDesc.depthReadOnly = false;
+	encoderDesc.stencilReadOnly = false;
+	RenderBundleEncoder encoder = device.createRenderBundleEncoder(encoderDesc);
+
+	unsigned long long instanceSize = (layout == InstanceLayout::Matrix ? 16 : 8) * sizeof(float);
+	encoder.setBindGroup(0, targets.uniformGroup, 0, nullptr);
+	encoder.setVertexBuffer(0, pool.VertBuffer(), 0, (unsigned long long)pool.VertCapacity() * pool.VertStride());
+	int boundCompact = -1;
+	int boundIdx32 = -1;
+	for (const Run& run : cell.runs) {
+		const Model* model = models.Find(run.model);
+		if (!model || model->lods.empty()) continue;
+		bool compact = model->layout == VertexLayout::Compact;
+		if (boundCompact != (int)compact) {
+			encoder.setPipeline(compact ? targets.compactPipeline : targets.pipeline);
+			boundCompact = (int)compact;
+		}
+		if (compact) encoder.setBindGroup(1, model->boundsGroup, 0, nullptr);
+		if (boundIdx32 != (int)model->idx32) {
+			encoder.setIndexBuffer(pool.IdxBuffer(), model->idx32 ? IndexFormat::Uint32 : IndexFormat::Uint16, 0, pool.IdxCapacity());
+			boundIdx32 = (int)model->idx32;
+		}
+		//full detail, a bundle can't pick lods per frame without being recorded again
+		encoder.setVertexBuffer(1, cell.instances, run.firstInstance * instanceSize, run.instanceCount * instanceSize);
+		encoder.drawIndexed(model->lods[0].idxCount, run.instanceCount, model->FirstIndex() + model->lods[0].firstIndex, model->BaseVertex(), 0);
+	}
+
+	RenderBundleDescriptor bundleDesc;
+	bundleDesc.label = "cell bundle";
+	cell.bundle = encoder.finish(bundleDesc);
+	encoder.drop();
+}
+
+void CellBundles::Drop(Cell& cell) {
+	if (cell.bundle) cell.bundle.drop();
+	if (cell.instances) cell.instances.drop();
+	cell.bundle = nullptr;
+	cell.instances = nullptr;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "webgpu\webgpu.hpp"
+#include "EsoWorld.h"
+#include "instanceTransforms.hpp"
+#include "meshPool.hpp"
+#include "modelRegistry.hpp"
+#include "threadPool.hpp"
+
+//the fixtures of every streamed cell, drawn through one render bundle per cell that is recorded once and replayed every frame
+//a cell is only recorded again when it changes or the mesh pool moved the meshes under it.
+//every cell has its own bundle encoder, so with a thread pool the stale cells of a frame record in parallel
+class CellBundles {
+public:
+	//what the bundles draw with, both pipelines take the instances in vertex slot 1
+	struct Targets {
+		wgpu::RenderPipeline pipeline = nullptr;
+		wgpu::RenderPipeline compactPipeline = nullptr;
+		wgpu::BindGroup uniformGroup = nullptr;
+		wgpu::TextureFormat colorFormat = wgpu::TextureFormat::Undefined;
+		wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;
+	};
+
+	CellBundles(wgpu::Device device, wgpu::Queue queue, ModelRegistry& models, MeshPool& pool, const Targets& targets, InstanceLayout layout,
+		ThreadPool* threads = nullptr);
+	~CellBundles();
+	CellBundles(const CellBundles&) = delete;
+	CellBundles& operator=(const CellBundles&) = delete;
+
+	//builds and uploads the cell's instances, grouped by model. the models have to be acquired by the caller already
+	void AddCell(unsigned long long id, const Eso::FixtureSpan& fixtures);
+	void RemoveCell(unsigned long long id);
+	//records the cell again on the next Execute, for when one of its models changed
+	void Invalidate(unsigned long long id);
+
+	//records whatever is stale, then replays the bundles of the cells touching the frustum (inward facing planes) in cell id order
+	//executeBundles clears the pass state, so anything drawn after this has to bind everything again
+	void Execute(wgpu::RenderPassEncoder& pass, const float planes[6][4]);
+
+	size_t CellCount() const { return cells.size(); }
+	unsigned int RecordedLastFrame() const { return recorded; }
+	unsigned int ExecutedLastFrame() const { return (unsigned int)visible.size(); }
+
+private:
+	//fixtures of one model, drawn with a single instanced draw
+	struct Run {
+		unsigned int model;
+		unsigned int firstInstance;
+		unsigned int instanceCount;
+	};
+
+	struct Cell {
+		wgpu::Buffer instances = nullptr;
+		std::vector<Run> runs;
+		float sphere[4]; //around every fixture, for skipping the whole cell
+		wgpu::RenderBundle bundle = nullptr;
+	};
+
+	wgpu::Device device;
+	wgpu::Queue queue;
+	ModelRegistry& models;
+	MeshPool& pool;
+	Targets targets;
+	InstanceLayout layout;
+	unsigned int poolGeneration;
+	std::unordered_map<unsigned long long, Cell> cells;
+	ThreadPool* threads;
+	std::vector<std::pair<unsigned long long, Cell*>> visibleCells;
+	std::vector<Cell*> stale;
+	std::vector<WGPURenderBundle> visible;
+	unsigned int recorded = 0;
+
+	void Record(Cell& cell);
+	static void Drop(Cell& cell);
+};
@@ -0,0 +1,107 @@
+//frustum culling for GpuCuller, one thread per instance. cs_cull takes matrices, cs_cull_packed PackedInstances
+//survivors are packed to the front of their draw's instance range and counted into its drawIndexedIndirect args
+
+struct Uniforms {
+    proj: mat4x4<f32>,
+    view: mat4x4<f32>,
+    time: f32,
+    rotationSpeed: f32,
+    padding: vec2f,
+    frustum: array<vec4f, 6>, //world space, xyz inward normal, w distance
+};
+
+struct CullDraw {
+    indexCount: u32,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+    instanceCount: u32,
+    padding0: u32,
+    padding1: u32,
+    padding2: u32,
+    sphere: vec4f, //model space centre and radius
+};
+
+//layout of drawIndexedIndirect
+struct DrawArgs {
+    indexCount: u32,
+    instanceCount: atomic<u32>,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+};
+
+struct CullParams {
+    instanceCount: u32,
+};
+
+//see PackedInstance
+struct PackedInstance {
+    posScale: vec4f,
+    rotation: vec4f,
+};
+
+@group(0) @binding(0) var<uniform> uniforms: Uniforms;
+@group(1) @binding(0) var<storage, read> instances: array<mat4x4<f32>>;
+@group(1) @binding(1) var<storage, read> instanceDraws: array<u32>;
+@group(1) @binding(2) var<storage, read> draws: array<CullDraw>;
+@group(1) @binding(3) var<storage, read_write> args: array<DrawArgs>;
+@group(1) @binding(4) var<storage, read_write> visible: array<mat4x4<f32>>;
+@group(1) @binding(5) var<uniform> params: CullParams;
+//cs_cull_packed only, same slots
+@group(1) @binding(0) var<storage, read> packedInstances: array<PackedInstance>;
+@group(1) @binding(4) var<storage, read_write> packedVisible: array<PackedInstance>;
+
+fn sphereVisible(center: vec3f, radius: f32) -> bool {
+    for (var p = 0u; p < 6u; p++) {
+        let plane = uniforms.frustum[p];
+        if (dot(plane.xyz, center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+@compute @workgroup_size(64)
+fn cs_cull(@builtin(global_invocation_id) id: vec3u) {
+    let i = id.x;
+    if (i >= params.instanceCount) {
+        return;
+    }
+    let d = instanceDraws[i];
+    let draw = draws[d];
+    let model = instances[i];
+
+    let center = (model * vec4f(draw.sphere.xyz, 1.0)).xyz;
+    let scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+    if (!sphereVisible(center, draw.sphere.w * scale)) {
+        return;
+    }
+
+    let slot = atomicAdd(&args[d].instanceCount, 1u);
+    visible[draw.firstInstance + slot] = model;
+}
+
+fn rotate(q: vec4f, v: vec3f) -> vec3f {
+    let t = 2.0 * cross(q.xyz, v);
+    return v + q.w * t + cross(q.xyz, t);
+}
+
+@compute @workgroup_size(64)
+fn cs_cull_packed(@builtin(global_invocation_id) id: vec3u) {
+    let i = id.x;
+    if (i >= params.instanceCount) {
+        return;
+    }
+    let d = instanceDraws[i];
+    let draw = draws[d];
+    let instance = packedInstances[i];
+
+    let center = instance.posScale.xyz + rotate(instance.rotation, draw.sphere.xyz * instance.posScale.w);
+    if (!sphereVisible(center, draw.sphere.w * instance.posScale.w)) {
+        return;
+    }
+
+    let slot = atomicAdd(&args[d].instanceCount, 1u);
+    packedVisible[draw.firstInstance + slot] = instance;
+}
@@ -7,6 +7,45 @@ struct VertexInput {
     @location(5) modelw: vec4<f32>
 };
 
+//compact vertex layout, see CompactVert
+struct CompactVertexInput {
+    @location(0) position: vec4f, //unorm16x4, relative to the mesh bounds
+    @location(1) normal: vec2f,   //snorm16x2 octahedral
+    @location(6) uv: vec2<i32>,
+    @location(2) modelx: vec4<f32>,
+    @location(3) modely: vec4<f32>,
+    @location(4) modelz: vec4<f32>,
+    @location(5) modelw: vec4<f32>
+};
+
+//PackedInstance instead of a matrix, vs_main_packed and vs_compact_packed
+struct PackedVertexInput {
+    @location(0) position: vec3f,
+    @location(1) color: vec3f,
+    @location(2) posScale: vec4f,
+    @location(3) rotation: vec4f, //unit quaternion
+};
+
+struct CompactPackedVertexInput {
+    @location(0) position: vec4f,
+    @location(1) normal: vec2f,
+    @location(6) uv: vec2<i32>,
+    @location(2) posScale: vec4f,
+    @location(3) rotation: vec4f,
+};
+
+//no instance buffer, vertices are already in world space. vs_main_world and vs_compact_world
+struct WorldVertexInput {
+    @location(0) position: vec3f,
+    @location(1) color: vec3f,
+};
+
+struct CompactWorldVertexInput {
+    @location(0) position: vec4f,
+    @location(1) normal: vec2f,
+    @location(6) uv: vec2<i32>,
+};
+
 /**
  * A structure with fields labeled with builtins and locations can also be used
  * as *output* of the vertex shader, which is also the input of the fragment
@@ -25,9 +64,18 @@ struct Uniforms {
     proj: mat4x4<f32>,
     view: mat4x4<f32>,
     time: f32,
+    rotationSpeed: f32,
+    padding: vec2f,
+    frustum: array<vec4f, 6>, //used by cull.wgsl
+};
+
+struct MeshBounds {
+    min: vec3f,
+    extent: vec3f,
 };
 
 @group(0) @binding(0) var<uniform> uniforms: Uniforms;
+@group(1) @binding(0) var<uniform> bounds: MeshBounds; //compact pipeline only
 //@group(0) @binding(1) var<uniform> model: mat4x4<f32>;
 
 
@@ -40,6 +88,72 @@ fn vs_main(in: VertexInput) -> VertexOutput {
     return out;
 }
 
+fn decodeOctahedral(e: vec2f) -> vec3f {
+    var n = vec3f(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    let t = max(-n.z, 0.0);
+    n.x += select(t, -t, n.x >= 0.0);
+    n.y += select(t, -t, n.y >= 0.0);
+    return normalize(n);
+}
+
+@vertex
+fn vs_compact(in: CompactVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    let model = mat4x4<f32>(in.modelx, in.modely, in.modelz, in.modelw);
+    let position = bounds.min + in.position.xyz * bounds.extent;
+    out.position = uniforms.proj * uniforms.view * model * vec4<f32>(position, 1.0);
+    out.color = decodeOctahedral(in.normal);
+    return out;
+}
+
+fn packedModel(posScale: vec4f, q: vec4f) -> mat4x4<f32> {
+    let x2 = q.x * 2.0;
+    let y2 = q.y * 2.0;
+    let z2 = q.z * 2.0;
+    let s = posScale.w;
+    return mat4x4<f32>(
+        vec4f(1.0 - q.y * y2 - q.z * z2, q.x * y2 + q.w * z2, q.x * z2 - q.w * y2, 0.0) * s,
+        vec4f(q.x * y2 - q.w * z2, 1.0 - q.x * x2 - q.z * z2, q.y * z2 + q.w * x2, 0.0) * s,
+        vec4f(q.x * z2 + q.w * y2, q.y * z2 - q.w * x2, 1.0 - q.x * x2 - q.y * y2, 0.0) * s,
+        vec4f(posScale.xyz, 1.0));
+}
+
+@vertex
+fn vs_main_packed(in: PackedVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    let model = packedModel(in.posScale, in.rotation);
+    out.position = uniforms.proj * uniforms.view * model * vec4<f32>(in.position, 1.0);
+    out.color = in.color;
+    return out;
+}
+
+@vertex
+fn vs_compact_packed(in: CompactPackedVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    let model = packedModel(in.posScale, in.rotation);
+    let position = bounds.min + in.position.xyz * bounds.extent;
+    out.position = uniforms.proj * uniforms.view * model * vec4<f32>(position, 1.0);
+    out.color = decodeOctahedral(in.normal);
+    return out;
+}
+
+@vertex
+fn vs_main_world(in: WorldVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    out.position = uniforms.proj * uniforms.view * vec4<f32>(in.position, 1.0);
+    out.color = in.color;
+    return out;
+}
+
+@vertex
+fn vs_compact_world(in: CompactWorldVertexInput) -> VertexOutput {
+    var out: VertexOutput;
+    let position = bounds.min + in.position.xyz * bounds.extent;
+    out.position = uniforms.proj * uniforms.view * vec4<f32>(position, 1.0);
+    out.color = decodeOctahedral(in.normal);
+    return out;
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
     return vec4f(in.color.xzy, 1.0);
@@ -0,0 +1,197 @@
+#include "gpuCull.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+using namespace wgpu;
+
+namespace {
+	const unsigned int workgroupSize = 64; //matches cs_cull
+	const unsigned int argsWords = 5; //drawIndexedIndirect
+	const size_t mergeGap = 16; //unchanged elements between two changed runs that are sent along to save a copy
+
+	void Upload(Queue& queue, UploadRing* uploads, Buffer buffer, const void* data, size_t size, size_t offset = 0) {
+		if (uploads) uploads->Write(buffer, offset, data, size);
+		else queue.writeBuffer(buffer, offset, data, size);
+	}
+
+	//uploads the runs of elements that differ from uploaded, the copy of what the buffer holds, and everything past its end
+	void UploadChanged(Queue& queue, UploadRing* uploads, Buffer buffer, const void* data, size_t count, size_t elementSize, std::vector<char>& uploaded) {
+		const char* bytes = (const char*)data;
+		size_t known = std::min(uploaded.size() / elementSize, count);
+		auto changed = [&](size_t e) { return std::memcmp(bytes + e * elementSize, uploaded.data() + e * elementSize, elementSize) != 0; };
+		size_t e = 0;
+		while (e < known) {
+			if (!changed(e)) {
+				e++;
+				continue;
+			}
+			size_t start = e, end = e + 1;
+			for (e = end; e < known && e - end < mergeGap; e++) {
+				if (changed(e)) end = e + 1;
+			}
+			Upload(queue, uploads, buffer, bytes + start * elementSize, (end - start) * elementSize, start * elementSize);
+			e = end;
+		}
+		if (count > known) Upload(queue, uploads, buffer, bytes + known * elementSize, (count - known) * elementSize, known * elementSize);
+		uploaded.assign(bytes, bytes + count * elementSize);
+	}
+
+	Buffer CreateCullBuffer(Device& device, unsigned long long size, WGPUBufferUsageFlags usage, const char* label) {
+		BufferDescriptor desc;
+		desc.size = std::max(size, 16ull);
+		desc.usage = usage;
+		desc.mappedAtCreation = false;
+		desc.label = label;
+		return device.createBuffer(desc);
+	}
+}
+
+GpuCuller::GpuCuller(Device device, Queue queue, ShaderModule shader, BindGroupLayout uniformLayout, unsigned int maxInstances, unsigned int maxDraws, InstanceLayout layout)
+	: queue(queue), maxInstances(maxInstances), maxDraws(maxDraws) {
+	instanceSize = layout == InstanceLayout::Matrix ? 16 * sizeof(float) : sizeof(PackedInstance);
+	instanceBuffer = CreateCullBuffer(device, (unsigned long long)maxInstances * instanceSize, BufferUsage::CopyDst | BufferUsage::Storage, "cull instance buffer");
+	instanceDrawBuffer = CreateCullBuffer(device, (unsigned long long)maxInstances * sizeof(unsigned int), BufferUsage::CopyDst | BufferUsage::Storage, "cull instance draw buffer");
+	drawBuffer = CreateCullBuffer(device, (unsigned long long)maxDraws * sizeof(GpuDraw), BufferUsage::CopyDst | BufferUsage::Storage, "cull draw buffer");
+	argsBuffer = CreateCullBuffer(device, (unsigned long long)maxDraws * argsWords * sizeof(unsigned int), BufferUsage::CopyDst | BufferUsage::CopySrc | BufferUsage::Storage | BufferUsage::Indirect, "cull indirect args buffer");
+	visibleBuffer = CreateCullBuffer(device, (unsigned long long)maxInstances * instanceSize, BufferUsage::CopySrc | BufferUsage::Storage | BufferUsage::Vertex, "visible instance buffer");
+	paramsBuffer = CreateCullBuffer(device, 16, BufferUsage::CopyDst | BufferUsage::Uniform, "cull params buffer");
+
+	std::vector<BindGroupLayoutEntry> layoutEntries(6, Default);
+	for (int i = 0; i < 6; i++) {
+		layoutEntries[i].binding = i;
+		layoutEntries[i].visibility = ShaderStage::Compute;
+	}
+	layoutEntries[0].buffer.type = BufferBindingType::ReadOnlyStorage;
+	layoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	layoutEntries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+	layoutEntries[3].buffer.type = BufferBindingType::Storage;
+	layoutEntries[4].buffer.type = BufferBindingType::Storage;
+	layoutEntries[5].buffer.type = BufferBindingType::Uniform;
+	layoutEntries[5].buffer.minBindingSize = 16;
+	BindGroupLayoutDescriptor cullLayoutDesc;
+	cullLayoutDesc.entryCount = (uint32_t)layoutEntries.size();
+	cullLayoutDesc.entries = layoutEntries.data();
+	cullLayout = device.createBindGroupLayout(cullLayoutDesc);
+
+	Buffer groupBuffers[6] = { instanceBuffer, instanceDrawBuffer, drawBuffer, argsBuffer, visibleBuffer, paramsBuffer };
+	unsigned long long groupSizes[6] = { (unsigned long long)maxInstances * instanceSize, (unsigned long long)maxInstances * sizeof(unsigned int),
+		(unsigned long long)maxDraws * sizeof(GpuDraw), (unsigned long long)maxDraws * argsWords * sizeof(unsigned int), (unsigned long long)maxInstances * instanceSize, 16 };
+	std::vector<BindGroupEntry> groupEntries(6, Default);
+	for (int i = 0; i < 6; i++) {
+		groupEntries[i].binding = i;
+		groupEntries[i].buffer = groupBuffers[i];
+		groupEntries[i].offset = 0;
+		groupEntries[i].size = std::max(groupSizes[i], 16ull);
+	}
+	BindGroupDescriptor cullGroupDesc;
+	cullGroupDesc.layout = cullLayout;
+	cullGroupDesc.entryCount = (uint32_t)groupEntries.size();
+	cullGroupDesc.entries = groupEntries.data();
+	cullGroup = device.createBindGroup(cullGroupDesc);
+
+	std::vector<WGPUBindGroupLayout> groupLayouts = { uniformLayout, cullLayout };
+	PipelineLayoutDescriptor pipelineLayoutDesc;
+	pipelineLayoutDesc.bindGroupLayoutCount = (uint32_t)groupLayouts.size();
+	pipelineLayoutDesc.bindGroupLayouts = groupLayouts.data();
+	pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+	ComputePipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "cull pipeline";
+	pipelineDesc.layout = pipelineLayout;
+	pipelineDesc.compute.module = shader;
+	pipelineDesc.compute.entryPoint = layout == InstanceLayout::Matrix ? "cs_cull" : "cs_cull_packed";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	pipeline = device.createComputePipeline(pipelineDesc);
+}
+
+GpuCuller::~GpuCuller() {
+	cullGroup.drop();
+	pipeline.drop();
+	pipelineLayout.drop();
+	cullLayout.drop();
+	instanceBuffer.drop();
+	instanceDrawBuffer.drop();
+	drawBuffer.drop();
+	argsBuffer.drop();
+	visibleBuffer.drop();
+	paramsBuffer.drop();
+}
+
+void GpuCuller::Update(const float* instances, std::span<const Draw> newDraws, UploadRing* uploads) {
+	static_assert(sizeof(GpuDraw) == 48, "GpuDraw has to match CullDraw in cull.wgsl");
+	unsigned int drawCount = (unsigned int)std::min(newDraws.size(), (size_t)maxDraws);
+	if (drawCount < newDraws.size()) std::cout << "Culler only has room for " << maxDraws << " draws, dropping " << newDraws.size() - drawCount << "\n";
+	draws.assign(newDraws.begin(), newDraws.begin() + drawCount);
+
+	//draws past the instance limit get clipped
+	instanceCount = 0;
+	for (Draw& draw : draws) {
+		draw.firstInstance = std::min(draw.firstInstance, maxInstances);
+		draw.instanceCount = std::min(draw.instanceCount, maxInstances - draw.firstInstance);
+		instanceCount = std::max(instanceCount, draw.firstInstance + draw.instanceCount);
+	}
+
+	instanceDraws.assign(instanceCount, 0);
+	gpuDraws.resize(drawCount);
+	args.resize(drawCount * argsWords);
+	for (unsigned int d = 0; d < drawCount; d++) {
+		const Draw& draw = draws[d];
+		std::fill(instanceDraws.begin() + draw.firstInstance, instanceDraws.begin() + draw.firstInstance + draw.instanceCount, d);
+
+		GpuDraw& gpuDraw = gpuDraws[d];
+		gpuDraw = {};
+		gpuDraw.indexCount = draw.indexCount;
+		gpuDraw.firstIndex = draw.firstIndex;
+		gpuDraw.baseVertex = draw.baseVertex;
+		gpuDraw.firstInstance = draw.firstInstance;
+		gpuDraw.instanceCount = draw.instanceCount;
+		gpuDraw.sphere[0] = draw.center[0];
+		gpuDraw.sphere[1] = draw.center[1];
+		gpuDraw.sphere[2] = draw.center[2];
+		gpuDraw.sphere[3] = draw.radius;
+
+		//instance count is filled in by the cull pass, first instance stays 0 since the
+		//visible range is bound as a vertex buffer offset instead (indirect first instance is an optional feature)
+		unsigned int* drawArgs = args.data() + d * argsWords;
+		drawArgs[0] = draw.indexCount;
+		drawArgs[1] = 0;
+		drawArgs[2] = draw.firstIndex;
+		drawArgs[3] = (unsigned int)draw.baseVertex;
+		drawArgs[4] = 0;
+	}
+
+	//the lod sort moves instances around whenever one changes, so the changed ranges come from comparing with the last upload.
+	//the args always go up whole, the cull pass writes their instance counts
+	UploadChanged(queue, uploads, instanceBuffer, instances, instanceCount, instanceSize, uploadedInstances);
+	UploadChanged(queue, uploads, instanceDrawBuffer, instanceDraws.data(), instanceCount, sizeof(unsigned int), uploadedInstanceDraws);
+	UploadChanged(queue, uploads, drawBuffer, gpuDraws.data(), drawCount, sizeof(GpuDraw), uploadedDraws);
+	if (drawCount > 0) Upload(queue, uploads, argsBuffer, args.data(), args.size() * sizeof(unsigned int));
+	unsigned int params[4] = { instanceCount, 0, 0, 0 };
+	Upload(queue, uploads, paramsBuffer, params, sizeof(params));
+}
+
+void GpuCuller::ResetCounts(UploadRing* uploads) {
+	if (!args.empty()) Upload(queue, uploads, argsBuffer, args.data(), args.size() * sizeof(unsigned int));
+}
+
+void GpuCuller::Cull(CommandEncoder& encoder, BindGroup uniformGroup, std::span<const WGPUComputePassTimestampWrite> timestamps) {
+	if (instanceCount == 0) return;
+	ComputePassDescriptor passDesc;
+	passDesc.label = "cull pass";
+	passDesc.timestampWriteCount = (uint32_t)timestamps.size();
+	passDesc.timestampWrites = timestamps.empty() ? nullptr : timestamps.data();
+	ComputePassEncoder pass = encoder.beginComputePass(passDesc);
+	pass.setPipeline(pipeline);
+	pass.setBindGroup(0, uniformGroup, 0, nullptr);
+	pass.setBindGroup(1, cullGroup, 0, nullptr);
+	pass.dispatchWorkgroups((instanceCount + workgroupSize - 1) / workgroupSize, 1, 1);
+	pass.end();
+}
+
+void GpuCuller::DrawVisible(RenderPassEncoder& pass, unsigned int draw, unsigned int instanceSlot) {
+	if (draw >= draws.size() || draws[draw].instanceCount == 0) return;
+	const Draw& info = draws[draw];
+	pass.setVertexBuffer(instanceSlot, visibleBuffer, (unsigned long long)info.firstInstance * instanceSize, (unsigned long long)info.instanceCount * instanceSize);
+	pass.drawIndexedIndirect(argsBuffer, (unsigned long long)draw * argsWords * sizeof(unsigned int));
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "webgpu\webgpu.hpp"
+#include "instanceTransforms.hpp"
+#include "uploadRing.hpp"
+
+//per instance frustum culling on the gpu (cull.wgsl), the cpu only records one indirect draw per Draw
+//however many instances there are or how many of them end up visible
+class GpuCuller {
+public:
+	struct Draw {
+		unsigned int indexCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int firstInstance; //range in the instances passed to Update
+		unsigned int instanceCount;
+		float center[3]; //bounding sphere in model space
+		float radius;
+	};
+
+	//uniformLayout is group 0, shared with the render pipelines, it needs compute visibility
+	GpuCuller(wgpu::Device device, wgpu::Queue queue, wgpu::ShaderModule shader, wgpu::BindGroupLayout uniformLayout, unsigned int maxInstances, unsigned int maxDraws,
+		InstanceLayout layout = InstanceLayout::Matrix);
+	~GpuCuller();
+
+	//instances in the layout given to the constructor (see InstanceTransforms::Stride). resets every draw's visible count
+	//with uploads the data goes through the ring and lands when it is flushed, otherwise through queue.writeBuffer.
+	//only the ranges that differ from the last Update are uploaded
+	void Update(const float* instances, std::span<const Draw> draws, UploadRing* uploads = nullptr);
+	//same instances and draws as the last Update, only zeroes the visible counts for the next cull pass
+	void ResetCounts(UploadRing* uploads = nullptr);
+	//records the cull pass, has to come before the render pass that calls Draw. timestamps go into the pass descriptor as is
+	void Cull(wgpu::CommandEncoder& encoder, wgpu::BindGroup uniformGroup, std::span<const WGPUComputePassTimestampWrite> timestamps = {});
+	//binds the draw's visible instances at instanceSlot and draws them indirectly
+	void DrawVisible(wgpu::RenderPassEncoder& pass, unsigned int draw, unsigned int instanceSlot);
+
+	unsigned int InstanceCount() const { return instanceCount; }
+	//the cull pass output, 5 words of drawIndexedIndirect args per draw and each draw's visible instances packed
+	//to the front of its instance range. both can be copied from, for reading the results back
+	wgpu::Buffer ArgsBuffer() const { return argsBuffer; }
+	wgpu::Buffer VisibleBuffer() const { return visibleBuffer; }
+
+private:
+	struct GpuDraw {
+		unsigned int indexCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int firstInstance;
+		unsigned int instanceCount;
+		unsigned int padding[3];
+		float sphere[4];
+	};
+
+	wgpu::Queue queue;
+	unsigned int instanceSize; //bytes
+	unsigned int maxInstances;
+	unsigned int maxDraws;
+	unsigned int instanceCount = 0;
+	std::vector<Draw> draws;
+	std::vector<unsigned int> instanceDraws;
+	std::vector<GpuDraw> gpuDraws;
+	std::vector<unsigned int> args;
+	//what the instance, instance draw and draw buffers hold, Update only uploads what differs
+	std::vector<char> uploadedInstances;
+	std::vector<char> uploadedInstanceDraws;
+	std::vector<char> uploadedDraws;
+
+	wgpu::Buffer instanceBuffer = nullptr;
+	wgpu::Buffer instanceDrawBuffer = nullptr;
+	wgpu::Buffer drawBuffer = nullptr;
+	wgpu::Buffer argsBuffer = nullptr;
+	wgpu::Buffer visibleBuffer = nullptr;
+	wgpu::Buffer paramsBuffer = nullptr;
+	wgpu::BindGroupLayout cullLayout = nullptr;
+	wgpu::PipelineLayout pipelineLayout = nullptr;
+	wgpu::ComputePipeline pipeline = nullptr;
+	wgpu::BindGroup cullGroup = nullptr;
+};
@@ -0,0 +1,250 @@
+#include "instanceTransforms.hpp"
+#include "threadPool.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#define INSTANCE_TRANSFORMS_SSE
+#endif
+
+namespace {
+	//dirty words handed to one pool task, 64 instances each
+	const size_t wordsPerTask = 32;
+	//below this many dirty words it isn't worth waking the pool
+	const size_t parallelWords = 64;
+
+#ifdef INSTANCE_TRANSFORMS_SSE
+	//sin and cos of 4 angles, range reduced to [-pi/2, pi/2] then taylor up to x^11 / x^12, about 1e-7 off
+	void SinCos4(__m128 x, __m128& s, __m128& c) {
+		const __m128 twoPi = _mm_set1_ps(6.28318530718f);
+		const __m128 invTwoPi = _mm_set1_ps(0.159154943092f);
+		const __m128 pi = _mm_set1_ps(3.14159265359f);
+		const __m128 halfPi = _mm_set1_ps(1.57079632679f);
+		const __m128 signMask = _mm_set1_ps(-0.f);
+
+		//x in [-pi, pi]
+		__m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, invTwoPi)));
+		x = _mm_sub_ps(x, _mm_mul_ps(k, twoPi));
+
+		//fold |x| > pi/2 back with sin(pi - x) = sin(x), cos(pi - x) = -cos(x)
+		__m128 sign = _mm_and_ps(x, signMask);
+		__m128 absX = _mm_andnot_ps(signMask, x);
+		__m128 folded = _mm_cmpgt_ps(absX, halfPi);
+		absX = _mm_or_ps(_mm_and_ps(folded, _mm_sub_ps(pi, absX)), _mm_andnot_ps(folded, absX));
+		x = _mm_or_ps(absX, sign);
+		__m128 cosSign = _mm_and_ps(folded, signMask);
+
+		__m128 x2 = _mm_mul_ps(x, x);
+		__m128 sp = _mm_set1_ps(-2.50521083854e-8f);
+		sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(2.75573192240e-6f));
+		sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(-1.98412698413e-4f));
+		sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(8.33333333333e-3f));
+		sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(-1.66666666667e-1f));
+		s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sp, x2), x), x);
+
+		__m128 cp = _mm_set1_ps(2.08767569879e-9f);
+		cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-2.75573192240e-7f));
+		cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(2.48015873016e-5f));
+		cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-1.38888888889e-3f));
+		cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(4.16666666667e-2f));
+		cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-0.5f));
+		c = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(1.f));
+		c = _mm_xor_ps(c, cosSign);
+	}
+
+	//4 instances from the soa arrays at i into 4 consecutive matrices
+	void Compose4(const float* px, const float* py, const float* pz, const float* rx, const float* ry, const float* rz, const float* scale, float* out) {
+		__m128 sx, cx, sy, cy, sz, cz;
+		SinCos4(_mm_loadu_ps(rx), sx, cx);
+		SinCos4(_mm_loadu_ps(ry), sy, cy);
+		SinCos4(_mm_loadu_ps(rz), sz, cz);
+		__m128 s = _mm_loadu_ps(scale);
+
+		//Rz * Ry * Rx, columns, times scale
+		__m128 szsy = _mm_mul_ps(sz, sy);
+		__m128 czsy = _mm_mul_ps(cz, sy);
+		__m128 c0x = _mm_mul_ps(_mm_mul_ps(cz, cy), s);
+		__m128 c0y = _mm_mul_ps(_mm_mul_ps(sz, cy), s);
+		__m128 c0z = _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), sy), s);
+		__m128 c1x = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(czsy, sx), _mm_mul_ps(sz, cx)), s);
+		__m128 c1y = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(szsy, sx), _mm_mul_ps(cz, cx)), s);
+		__m128 c1z = _mm_mul_ps(_mm_mul_ps(cy, sx), s);
+		__m128 c2x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(czsy, cx), _mm_mul_ps(sz, sx)), s);
+		__m128 c2y = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(szsy, cx), _mm_mul_ps(cz, sx)), s);
+		__m128 c2z = _mm_mul_ps(_mm_mul_ps(cy, cx), s);
+		__m128 zero = _mm_setzero_ps();
+		__m128 c0w = zero, c1w = zero, c2w = zero;
+		__m128 c3x = _mm_loadu_ps(px), c3y = _mm_loadu_ps(py), c3z = _mm_loadu_ps(pz), c3w = _mm_set1_ps(1.f);
+
+		//lanes are instances, transposing turns each column into 4 per instance vectors
+		_MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+		_MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+		_MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+		_MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+		__m128 columns[4][4] = { { c0x, c1x, c2x, c3x }, { c0y, c1y, c2y, c3y }, { c0z, c1z, c2z, c3z }, { c0w, c1w, c2w, c3w } };
+		for (int i = 0; i < 4; i++) {
+			for (int c = 0; c < 4; c++) _mm_storeu_ps(out + 16 * i + 4 * c, columns[i][c]);
+		}
+	}
+
+	//4 instances into 4 consecutive PackedInstances, q = qz * qy * qx from the half angles
+	void Pack4(const float* px, const float* py, const float* pz, const float* rx, const float* ry, const float* rz, const float* scale, float* out) {
+		const __m128 half = _mm_set1_ps(0.5f);
+		__m128 sx, cx, sy, cy, sz, cz;
+		SinCos4(_mm_mul_ps(_mm_loadu_ps(rx), half), sx, cx);
+		SinCos4(_mm_mul_ps(_mm_loadu_ps(ry), half), sy, cy);
+		SinCos4(_mm_mul_ps(_mm_loadu_ps(rz), half), sz, cz);
+
+		__m128 czcy = _mm_mul_ps(cz, cy), szsy = _mm_mul_ps(sz, sy);
+		__m128 czsy = _mm_mul_ps(cz, sy), szcy = _mm_mul_ps(sz, cy);
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(czcy, sx), _mm_mul_ps(szsy, cx));
+		__m128 qy = _mm_add_ps(_mm_mul_ps(czsy, cx), _mm_mul_ps(szcy, sx));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(szcy, cx), _mm_mul_ps(czsy, sx));
+		__m128 qw = _mm_add_ps(_mm_mul_ps(czcy, cx), _mm_mul_ps(szsy, sx));
+		__m128 x = _mm_loadu_ps(px), y = _mm_loadu_ps(py), z = _mm_loadu_ps(pz), s = _mm_loadu_ps(scale);
+
+		_MM_TRANSPOSE4_PS(x, y, z, s);
+		_MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+		__m128 first[4] = { x, y, z, s };
+		__m128 second[4] = { qx, qy, qz, qw };
+		for (int i = 0; i < 4; i++) {
+			_mm_storeu_ps(out + 8 * i, first[i]);
+			_mm_storeu_ps(out + 8 * i + 4, second[i]);
+		}
+	}
+#endif
+}
+
+PackedInstance PackFixture(const Eso::Fixture& fixture, float scale) {
+	PackedInstance packed;
+	InstanceTransforms::PackScalar(fixture.x, fixture.y, fixture.z, fixture.rotX, fixture.rotY, fixture.rotZ, scale, packed);
+	return packed;
+}
+
+InstanceTransforms::InstanceTransforms(unsigned int count, InstanceLayout layout) : layout(layout) {
+	Resize(count);
+}
+
+void InstanceTransforms::Resize(unsigned int newCount) {
+	unsigned int oldCount = count;
+	count = newCount;
+	//padded to whole words so the kernel can always do 4 at a time
+	size_t padded = ((size_t)newCount + 63) & ~(size_t)63;
+	px.resize(padded, 0.f); py.resize(padded, 0.f); pz.resize(padded, 0.f);
+	rx.resize(padded, 0.f); ry.resize(padded, 0.f); rz.resize(padded, 0.f);
+	scale.resize(padded, 1.f);
+	output.resize(padded * Stride(), 0.f);
+	dirty.resize(padded / 64, 0);
+	for (unsigned int i = oldCount; i < newCount; i++) {
+		px[i] = py[i] = pz[i] = 0.f;
+		rx[i] = ry[i] = rz[i] = 0.f;
+		scale[i] = 1.f;
+		MarkDirty(i);
+	}
+}
+
+void InstanceTransforms::SetPosition(unsigned int i, float x, float y, float z) {
+	if (px[i] == x && py[i] == y && pz[i] == z) return;
+	px[i] = x; py[i] = y; pz[i] = z;
+	MarkDirty(i);
+}
+
+void InstanceTransforms::SetRotation(unsigned int i, float x, float y, float z) {
+	if (rx[i] == x && ry[i] == y && rz[i] == z) return;
+	rx[i] = x; ry[i] = y; rz[i] = z;
+	MarkDirty(i);
+}
+
+void InstanceTransforms::SetScale(unsigned int i, float s) {
+	if (scale[i] == s) return;
+	scale[i] = s;
+	MarkDirty(i);
+}
+
+void InstanceTransforms::Update(ThreadPool* pool) {
+	PROFILE_SCOPE("instance transforms");
+	changed.clear();
+	dirtyWords.clear();
+	for (unsigned int w = 0; w < dirty.size(); w++) {
+		if (dirty[w] == 0) continue;
+		dirtyWords.push_back(w);
+		unsigned int first = w * 64;
+		unsigned int end = std::min(first + 64, count);
+		if (!changed.empty() && changed.back().end == first) changed.back().end = end;
+		else changed.push_back({ first, end });
+	}
+	if (dirtyWords.empty()) return;
+
+	if (pool && dirtyWords.size() >= parallelWords) {
+		pool->ParallelFor(dirtyWords.size(), wordsPerTask, [this](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) ComposeWord(dirtyWords[i]);
+		});
+	}
+	else {
+		for (unsigned int w : dirtyWords) ComposeWord(w);
+	}
+}
+
+void InstanceTransforms::ComposeWord(unsigned int w) {
+	unsigned long long bits = dirty[w];
+	dirty[w] = 0;
+	for (unsigned int group = 0; group < 16; group++) {
+		if (((bits >> (group * 4)) & 0xF) == 0) continue;
+		size_t i = (size_t)w * 64 + group * 4;
+		float* out = &output[Stride() * i];
+#ifdef INSTANCE_TRANSFORMS_SSE
+		if (layout == InstanceLayout::Matrix) Compose4(&px[i], &py[i], &pz[i], &rx[i], &ry[i], &rz[i], &scale[i], out);
+		else Pack4(&px[i], &py[i], &pz[i], &rx[i], &ry[i], &rz[i], &scale[i], out);
+#else
+		for (size_t j = 0; j < 4; j++) {
+			size_t k = i + j;
+			if (layout == InstanceLayout::Matrix) ComposeScalar(px[k], py[k], pz[k], rx[k], ry[k], rz[k], scale[k], out + 16 * j);
+			else PackScalar(px[k], py[k], pz[k], rx[k], ry[k], rz[k], scale[k], *(PackedInstance*)(out + 8 * j));
+		}
+#endif
+	}
+}
+
+void InstanceTransforms::ComposeScalar(float px, float py, float pz, float rx, float ry, float rz, float scale, float* m) {
+	float sx = std::sin(rx), cx = std::cos(rx);
+	float sy = std::sin(ry), cy = std::cos(ry);
+	float sz = std::sin(rz), cz = std::cos(rz);
+	m[0] = cz * cy * scale;                  m[1] = sz * cy * scale;                  m[2] = -sy * scale;      m[3] = 0.f;
+	m[4] = (cz * sy * sx - sz * cx) * scale; m[5] = (sz * sy * sx + cz * cx) * scale; m[6] = cy * sx * scale;  m[7] = 0.f;
+	m[8] = (cz * sy * cx + sz * sx) * scale; m[9] = (sz * sy * cx - cz * sx) * scale; m[10] = cy * cx * scale; m[11] = 0.f;
+	m[12] = px;                              m[13] = py;                              m[14] = pz;              m[15] = 1.f;
+}
+
+void InstanceTransforms::PackScalar(float px, float py, float pz, float rx, float ry, float rz, float scale, PackedInstance& packed) {
+	float sx = std::sin(rx * 0.5f), cx = std::cos(rx * 0.5f);
+	float sy = std::sin(ry * 0.5f), cy = std::cos(ry * 0.5f);
+	float sz = std::sin(rz * 0.5f), cz = std::cos(rz * 0.5f);
+	packed.x = px;
+	packed.y = py;
+	packed.z = pz;
+	packed.scale = scale;
+	packed.qx = cz * cy * sx - sz * sy * cx;
+	packed.qy = cz * sy * cx + sz * cy * sx;
+	packed.qz = sz * cy * cx - cz * sy * sx;
+	packed.qw = cz * cy * cx + sz * sy * sx;
+}
+
+void InstanceTransforms::TransformPoint(unsigned int i, const float p[3], float result[3]) const {
+	const float* data = Instance(i);
+	if (layout == InstanceLayout::Matrix) {
+		for (int r = 0; r < 3; r++) result[r] = data[r] * p[0] + data[4 + r] * p[1] + data[8 + r] * p[2] + data[12 + r];
+		return;
+	}
+	//v + 2w(q x v) + 2q x (q x v), same as the shader
+	const PackedInstance& packed = *(const PackedInstance*)data;
+	float v[3] = { p[0] * packed.scale, p[1] * packed.scale, p[2] * packed.scale };
+	float tx = 2.f * (packed.qy * v[2] - packed.qz * v[1]);
+	float ty = 2.f * (packed.qz * v[0] - packed.qx * v[2]);
+	float tz = 2.f * (packed.qx * v[1] - packed.qy * v[0]);
+	result[0] = v[0] + packed.qw * tx + (packed.qy * tz - packed.qz * ty) + packed.x;
+	result[1] = v[1] + packed.qw * ty + (packed.qz * tx - packed.qx * tz) + packed.y;
+	result[2] = v[2] + packed.qw * tz + (packed.qx * ty - packed.qy * tx) + packed.z;
+}
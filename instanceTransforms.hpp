@@ -0,0 +1,77 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "EsoWorld.h"
+
+class ThreadPool;
+
+//what ends up in the instance buffer
+enum class InstanceLayout {
+	Matrix, //column major mat4, 64 bytes
+	Packed, //PackedInstance, 32 bytes
+};
+
+//position, uniform scale and a unit quaternion, expanded back to a matrix in the vertex shader
+struct PackedInstance {
+	float x, y, z;
+	float scale;
+	float qx, qy, qz, qw;
+};
+static_assert(sizeof(PackedInstance) == 32, "PackedInstance has to match the packed vertex attributes");
+
+//fixtures have no scale of their own, their rotation is euler radians in the same x, y, z order as SetRotation
+PackedInstance PackFixture(const Eso::Fixture& fixture, float scale = 1.f);
+
+//per instance translation, euler rotation and uniform scale kept as structure of arrays
+//only instances touched since the last Update get their matrix rebuilt
+class InstanceTransforms {
+public:
+	//instances [first, end) whose matrices changed in the last Update, 64 instance granularity
+	struct Range {
+		unsigned int first;
+		unsigned int end;
+	};
+
+	InstanceTransforms(unsigned int count = 0, InstanceLayout layout = InstanceLayout::Matrix);
+
+	//new instances start as identity and dirty
+	void Resize(unsigned int count);
+	unsigned int Count() const { return count; }
+
+	void SetPosition(unsigned int i, float x, float y, float z);
+	//radians, applied x then y then z (the matrix is Rz * Ry * Rx)
+	void SetRotation(unsigned int i, float x, float y, float z);
+	void SetScale(unsigned int i, float scale);
+
+	//rebuilds the dirty matrices, split across the pool when there are enough of them
+	void Update(ThreadPool* pool = nullptr);
+
+	InstanceLayout Layout() const { return layout; }
+	//floats per instance, 16 for matrices and 8 for PackedInstance
+	unsigned int Stride() const { return layout == InstanceLayout::Matrix ? 16 : 8; }
+	const float* Data() const { return output.data(); }
+	const float* Instance(unsigned int i) const { return output.data() + Stride() * (size_t)i; }
+	std::span<const Range> Changed() const { return changed; }
+
+	//model space point to world space with the instance as of the last Update
+	void TransformPoint(unsigned int i, const float point[3], float result[3]) const;
+
+	//the references the vector kernels have to match
+	static void ComposeScalar(float px, float py, float pz, float rx, float ry, float rz, float scale, float* matrix);
+	static void PackScalar(float px, float py, float pz, float rx, float ry, float rz, float scale, PackedInstance& packed);
+
+private:
+	unsigned int count = 0;
+	InstanceLayout layout;
+	std::vector<float> px, py, pz;
+	std::vector<float> rx, ry, rz;
+	std::vector<float> scale;
+	std::vector<float> output;
+	std::vector<unsigned long long> dirty; //a bit per instance
+	std::vector<Range> changed;
+	std::vector<unsigned int> dirtyWords;
+
+	void MarkDirty(unsigned int i) { dirty[i >> 6] |= 1ull << (i & 63); }
+	//rebuilds the dirty instances of dirty word w, in groups of 4
+	void ComposeWord(unsigned int w);
+};
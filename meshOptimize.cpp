@@ -0,0 +1,405 @@
+#include "meshOptimize.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+CacheStats AnalyzeVertexCache(const std::vector<unsigned int>& indices, unsigned int vertCount, unsigned int cacheSize) {
+	std::vector<unsigned int> timestamps(vertCount, 0);
+	unsigned int time = cacheSize + 1;
+	unsigned int misses = 0;
+	for (unsigned int index : indices) {
+		//a vert is in the fifo if it was added within the last cacheSize misses
+		if (time - timestamps[index] > cacheSize) {
+			timestamps[index] = time++;
+			misses++;
+		}
+	}
+	CacheStats stats;
+	stats.acmr = indices.empty() ? 0.f : (float)misses / (indices.size() / 3);
+	stats.atvr = vertCount == 0 ? 0.f : (float)misses / vertCount;
+	return stats;
+}
+
+namespace {
+	const int forsythCacheSize = 32;
+
+	float VertexScore(int cachePos, unsigned int remaining) {
+		if (remaining == 0) return -1.f;
+		float score = 0.f;
+		if (cachePos >= 0) {
+			//the last triangle's verts get a fixed score so we don't just keep using the same edge
+			if (cachePos < 3) score = 0.75f;
+			else score = std::pow(1.f - (cachePos - 3) * (1.f / (forsythCacheSize - 3)), 1.5f);
+		}
+		//boost verts with few triangles left so they get finished off
+		score += 2.f * std::pow((float)remaining, -0.5f);
+		return score;
+	}
+}
+
+void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertCount) {
+	size_t triCount = indices.size() / 3;
+	if (triCount == 0) return;
+
+	//per vertex lists of the triangles that still need emitting
+	std::vector<unsigned int> remaining(vertCount, 0);
+	for (unsigned int index : indices) remaining[index]++;
+	std::vector<unsigned int> offsets(vertCount + 1, 0);
+	for (unsigned int v = 0; v < vertCount; v++) offsets[v + 1] = offsets[v] + remaining[v];
+	std::vector<unsigned int> adjacency(indices.size());
+	{
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<int> cachePos(vertCount, -1);
+	std::vector<float> vertScore(vertCount);
+	for (unsigned int v = 0; v < vertCount; v++) vertScore[v] = VertexScore(-1, remaining[v]);
+	std::vector<float> triScore(triCount);
+	std::vector<bool> emitted(triCount, false);
+	for (size_t t = 0; t < triCount; t++) triScore[t] = vertScore[indices[t * 3]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> newCache;
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	size_t scan = 0;
+	long long best = (long long)(std::max_element(triScore.begin(), triScore.end()) - triScore.begin());
+
+	while (output.size() < indices.size()) {
+		if (best < 0) {
+			//nothing in the cache has triangles left, carry on from the first unemitted one
+			while (emitted[scan]) scan++;
+			best = (long long)scan;
+		}
+		const unsigned int* tri = &indices[best * 3];
+		output.insert(output.end(), tri, tri + 3);
+		emitted[best] = true;
+
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = tri[k];
+			unsigned int* begin = &adjacency[offsets[v]];
+			unsigned int* end = begin + remaining[v];
+			unsigned int* found = std::find(begin, end, (unsigned int)best);
+			if (found != end) {
+				*found = *(end - 1);
+				remaining[v]--;
+			}
+		}
+
+		//the triangle's verts move to the front of the cache, everything else shifts back
+		newCache.assign(tri, tri + 3);
+		for (unsigned int v : cache) {
+			if (v != tri[0] && v != tri[1] && v != tri[2]) newCache.push_back(v);
+		}
+		for (size_t i = forsythCacheSize; i < newCache.size(); i++) {
+			cachePos[newCache[i]] = -1;
+			vertScore[newCache[i]] = VertexScore(-1, remaining[newCache[i]]);
+		}
+		if (newCache.size() > forsythCacheSize) {
+			//rescore the evicted verts' triangles too, they aren't candidates but keep their scores right for later
+			for (size_t i = forsythCacheSize; i < newCache.size(); i++) {
+				unsigned int v = newCache[i];
+				for (unsigned int j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+					unsigned int t = adjacency[j];
+					triScore[t] = vertScore[indices[t * 3]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+				}
+			}
+			newCache.resize(forsythCacheSize);
+		}
+		cache.swap(newCache);
+
+		for (size_t i = 0; i < cache.size(); i++) {
+			cachePos[cache[i]] = (int)i;
+			vertScore[cache[i]] = VertexScore((int)i, remaining[cache[i]]);
+		}
+		best = -1;
+		float bestScore = -1.f;
+		for (unsigned int v : cache) {
+			for (unsigned int j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+				unsigned int t = adjacency[j];
+				float score = vertScore[indices[t * 3]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+				triScore[t] = score;
+				if (score > bestScore) {
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+	}
+	indices.swap(output);
+}
+
+void OptimizeOverdraw(std::vector<unsigned int>& indices, const char* verts, unsigned int stride, unsigned int vertCount, float threshold) {
+	size_t triCount = indices.size() / 3;
+	if (triCount < 2) return;
+	const unsigned int cacheSize = 16;
+	auto position = [&](unsigned int v) { return (const float*)(verts + (size_t)v * stride); };
+
+	//split wherever a triangle misses on all three verts, those are the points where the cache order restarts anyway
+	std::vector<size_t> clusters;
+	{
+		std::vector<unsigned int> timestamps(vertCount, 0);
+		unsigned int time = cacheSize + 1;
+		for (size_t t = 0; t < triCount; t++) {
+			int misses = 0;
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[t * 3 + k];
+				if (time - timestamps[v] > cacheSize) {
+					timestamps[v] = time++;
+					misses++;
+				}
+			}
+			if (t == 0 || misses == 3) clusters.push_back(t);
+		}
+	}
+	if (clusters.size() < 2) return;
+
+	float meshCentroid[3] = { 0.f, 0.f, 0.f };
+	for (size_t i = 0; i < indices.size(); i++) {
+		for (int c = 0; c < 3; c++) meshCentroid[c] += position(indices[i])[c];
+	}
+	for (int c = 0; c < 3; c++) meshCentroid[c] /= indices.size();
+
+	//sort clusters by how far out they face, outward facing ones go first so they occlude the rest
+	struct Cluster { size_t begin; size_t end; float sortKey; };
+	std::vector<Cluster> sorted(clusters.size());
+	for (size_t i = 0; i < clusters.size(); i++) {
+		size_t begin = clusters[i];
+		size_t end = i + 1 < clusters.size() ? clusters[i + 1] : triCount;
+		float centroid[3] = { 0.f, 0.f, 0.f };
+		float normal[3] = { 0.f, 0.f, 0.f };
+		float area = 0.f;
+		for (size_t t = begin; t < end; t++) {
+			const float* a = position(indices[t * 3]);
+			const float* b = position(indices[t * 3 + 1]);
+			const float* c = position(indices[t * 3 + 2]);
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float triArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int k = 0; k < 3; k++) {
+				centroid[k] += (a[k] + b[k] + c[k]) / 3.f * triArea;
+				normal[k] += n[k];
+			}
+			area += triArea;
+		}
+		float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float key = 0.f;
+		if (area > 0.f && normalLength > 0.f) {
+			for (int k = 0; k < 3; k++) key += (centroid[k] / area - meshCentroid[k]) * normal[k] / normalLength;
+		}
+		sorted[i] = { begin, end, key };
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (const Cluster& cluster : sorted) {
+		output.insert(output.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+	}
+	if (AnalyzeVertexCache(output, vertCount, cacheSize).acmr <= AnalyzeVertexCache(indices, vertCount, cacheSize).acmr * threshold) {
+		indices.swap(output);
+	}
+}
+
+unsigned int OptimizeVertexFetch(std::vector<unsigned int>& indices, char* verts, unsigned int stride, unsigned int vertCount) {
+	std::vector<unsigned int> remap(vertCount, ~0u);
+	unsigned int next = 0;
+	for (unsigned int& index : indices) {
+		if (remap[index] == ~0u) remap[index] = next++;
+		index = remap[index];
+	}
+
+	std::vector<char> original(verts, verts + (size_t)vertCount * stride);
+	for (unsigned int v = 0; v < vertCount; v++) {
+		if (remap[v] != ~0u) std::memcpy(verts + (size_t)remap[v] * stride, original.data() + (size_t)v * stride, stride);
+	}
+	return next;
+}
+
+namespace {
+	//symmetric 4x4 plane quadric, w is the total weight so the error comes out as an average squared distance
+	struct Quadric {
+		float a00, a01, a02, a11, a12, a22, b0, b1, b2, c, w;
+
+		void AddPlane(float nx, float ny, float nz, float d, float weight) {
+			a00 += weight * nx * nx; a01 += weight * nx * ny; a02 += weight * nx * nz;
+			a11 += weight * ny * ny; a12 += weight * ny * nz; a22 += weight * nz * nz;
+			b0 += weight * nx * d; b1 += weight * ny * d; b2 += weight * nz * d;
+			c += weight * d * d;
+			w += weight;
+		}
+		void Add(const Quadric& q) {
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; w += q.w;
+		}
+		float Error(const float* p) const {
+			float x = p[0], y = p[1], z = p[2];
+			float e = a00 * x * x + a11 * y * y + a22 * z * z + 2.f * (a01 * x * y + a02 * x * z + a12 * y * z)
+				+ 2.f * (b0 * x + b1 * y + b2 * z) + c;
+			return w > 0.f ? std::max(e, 0.f) / w : 0.f;
+		}
+	};
+
+	void TriNormal(const float* a, const float* b, const float* c, float* n) {
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+}
+
+std::vector<unsigned int> SimplifyMesh(const std::vector<unsigned int>& sourceIndices, const char* verts, unsigned int stride, unsigned int vertCount,
+	size_t targetIndexCount, float maxError, float* resultError) {
+	auto position = [&](unsigned int v) { return (const float*)(verts + (size_t)v * stride); };
+	std::vector<unsigned int> indices = sourceIndices;
+	float maxErrorSq = maxError * maxError;
+	float achievedError = 0.f;
+
+	//plane quadrics, area weighted so big triangles hold their shape
+	std::vector<Quadric> quadrics(vertCount, Quadric{});
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		const float* a = position(indices[t]);
+		float n[3];
+		TriNormal(a, position(indices[t + 1]), position(indices[t + 2]), n);
+		float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0.f) continue;
+		n[0] /= length; n[1] /= length; n[2] /= length;
+		float d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+		for (int k = 0; k < 3; k++) quadrics[indices[t + k]].AddPlane(n[0], n[1], n[2], d, length * 0.5f);
+	}
+
+	//lock verts on open edges, and verts that share a position with another vert (uv/normal seams)
+	std::vector<bool> locked(vertCount, false);
+	{
+		std::vector<std::pair<unsigned long long, int>> edges;
+		edges.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+				edges.emplace_back(((unsigned long long)std::min(a, b) << 32) | std::max(a, b), 0);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();) {
+			size_t j = i;
+			while (j < edges.size() && edges[j].first == edges[i].first) j++;
+			if (j - i == 1) {
+				locked[edges[i].first >> 32] = true;
+				locked[edges[i].first & 0xFFFFFFFF] = true;
+			}
+			i = j;
+		}
+
+		std::vector<unsigned int> byPosition(vertCount);
+		for (unsigned int v = 0; v < vertCount; v++) byPosition[v] = v;
+		std::sort(byPosition.begin(), byPosition.end(), [&](unsigned int a, unsigned int b) {
+			return std::memcmp(position(a), position(b), 12) < 0;
+		});
+		for (unsigned int i = 1; i < vertCount; i++) {
+			if (std::memcmp(position(byPosition[i - 1]), position(byPosition[i]), 12) == 0) {
+				locked[byPosition[i - 1]] = true;
+				locked[byPosition[i]] = true;
+			}
+		}
+	}
+
+	std::vector<unsigned int> remap(vertCount);
+	std::vector<bool> touched(vertCount);
+	std::vector<unsigned int> triOffsets(vertCount + 1);
+	std::vector<unsigned int> vertTris;
+	struct Collapse { unsigned int from; unsigned int to; float error; };
+	std::vector<Collapse> collapses;
+
+	while (indices.size() > targetIndexCount) {
+		//triangles around each vert, for the flip check
+		std::fill(triOffsets.begin(), triOffsets.end(), 0);
+		for (unsigned int index : indices) triOffsets[index + 1]++;
+		for (unsigned int v = 0; v < vertCount; v++) triOffsets[v + 1] += triOffsets[v];
+		vertTris.resize(indices.size());
+		{
+			std::vector<unsigned int> fill(triOffsets.begin(), triOffsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++) vertTris[fill[indices[i]]++] = (unsigned int)(i / 3);
+		}
+
+		//every edge in both directions, cost is the combined quadric at the vert we'd keep
+		collapses.clear();
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+				for (int dir = 0; dir < 2; dir++) {
+					unsigned int from = dir ? b : a, to = dir ? a : b;
+					if (locked[from]) continue;
+					Quadric q = quadrics[from];
+					q.Add(quadrics[to]);
+					collapses.push_back({ from, to, q.Error(position(to)) });
+				}
+			}
+		}
+		if (collapses.empty()) break;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		//take the cheapest collapses that don't share verts, about a fifth of what's left per pass keeps the quality reasonable
+		for (unsigned int v = 0; v < vertCount; v++) remap[v] = v;
+		std::fill(touched.begin(), touched.end(), false);
+		size_t triangles = indices.size() / 3;
+		size_t wanted = std::max<size_t>(1, (indices.size() - targetIndexCount) / 3 / 2);
+		wanted = std::min(wanted, std::max<size_t>(1, triangles / 5));
+		size_t removed = 0;
+		for (const Collapse& collapse : collapses) {
+			if (removed >= wanted || collapse.error > maxErrorSq) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			//reject if any triangle around the moving vert would flip
+			bool flips = false;
+			int dying = 0;
+			const float* target = position(collapse.to);
+			for (unsigned int j = triOffsets[collapse.from]; j < triOffsets[collapse.from + 1] && !flips; j++) {
+				const unsigned int* tri = &indices[vertTris[j] * 3];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+					dying++;
+					continue;
+				}
+				const float* p[3];
+				const float* moved[3];
+				for (int k = 0; k < 3; k++) {
+					p[k] = position(tri[k]);
+					moved[k] = tri[k] == collapse.from ? target : p[k];
+				}
+				float before[3], after[3];
+				TriNormal(p[0], p[1], p[2], before);
+				TriNormal(moved[0], moved[1], moved[2], after);
+				if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.f) flips = true;
+			}
+			if (flips) continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].Add(quadrics[collapse.from]);
+			touched[collapse.from] = true;
+			touched[collapse.to] = true;
+			//the triangles around the moving vert's neighbours can't be checked again this pass
+			for (unsigned int j = triOffsets[collapse.from]; j < triOffsets[collapse.from + 1]; j++) {
+				const unsigned int* tri = &indices[vertTris[j] * 3];
+				for (int k = 0; k < 3; k++) touched[tri[k]] = true;
+			}
+			removed += dying;
+			achievedError = std::max(achievedError, collapse.error);
+		}
+		if (removed == 0) break;
+
+		size_t write = 0;
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			unsigned int a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+			if (a == b || b == c || a == c) continue;
+			indices[write++] = a;
+			indices[write++] = b;
+			indices[write++] = c;
+		}
+		indices.resize(write);
+	}
+
+	if (resultError) *resultError = std::sqrt(achievedError);
+	return indices;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+//post transform cache numbers for a fifo cache: acmr is misses per triangle, atvr is misses per vertex (1.0 is perfect)
+struct CacheStats {
+	float acmr;
+	float atvr;
+};
+
+CacheStats AnalyzeVertexCache(const std::vector<unsigned int>& indices, unsigned int vertCount, unsigned int cacheSize = 16);
+
+//reorders triangles for post transform cache reuse (forsyth's linear speed optimizer)
+void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertCount);
+
+//reorders clusters of the cache optimized triangles roughly front to back from the outside of the mesh
+//gives up if that would make the acmr worse than threshold times the current one
+void OptimizeOverdraw(std::vector<unsigned int>& indices, const char* verts, unsigned int stride, unsigned int vertCount, float threshold);
+
+//reorders verts (position as float3 at the start of each vert) in the order the indices first use them
+//unused verts are dropped, returns the new vertex count
+unsigned int OptimizeVertexFetch(std::vector<unsigned int>& indices, char* verts, unsigned int stride, unsigned int vertCount);
+
+//one level of detail, an index range into the model's shared index buffer
+struct MeshLod {
+	int firstIndex;
+	int idxCount;
+	float error; //geometric error in model units, how far the surface can be from the full mesh
+	float padding;
+};
+
+//quadric error edge collapse, verts only ever collapse onto other existing verts so the vertex buffer is shared with the full mesh
+//stops at targetIndexCount or when the next collapse would move the surface by more than maxError (model units)
+//border and seam verts are locked so the mesh doesn't open up
+std::vector<unsigned int> SimplifyMesh(const std::vector<unsigned int>& indices, const char* verts, unsigned int stride, unsigned int vertCount,
+	size_t targetIndexCount, float maxError, float* resultError);
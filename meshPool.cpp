@@ -0,0 +1,193 @@
+#include "meshPool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+using namespace wgpu;
+
+namespace {
+	Buffer CreatePoolBuffer(Device& device, unsigned long long size, WGPUBufferUsageFlags usage, const char* label) {
+		BufferDescriptor desc;
+		desc.size = size;
+		desc.usage = BufferUsage::CopyDst | BufferUsage::CopySrc | usage;
+		desc.mappedAtCreation = false;
+		desc.label = label;
+		return device.createBuffer(desc);
+	}
+}
+
+MeshPool::MeshPool(Device device, Queue queue, unsigned int vertStride, unsigned int vertCapacity, unsigned int idxCapacity)
+	: device(device), queue(queue), vertStride(vertStride) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Rebuild(std::max(vertCapacity, 1u), std::max(idxCapacity / 4, 1u));
+}
+
+MeshPool::~MeshPool() {
+	vertBuffer.drop();
+	idxBuffer.drop();
+}
+
+unsigned int MeshPool::Add(std::span<const char> verts, std::span<const char> idx) {
+	std::lock_guard<std::mutex> lock(mutex);
+	unsigned int vertCount = (unsigned int)(verts.size() / vertStride);
+	unsigned int idxWords = (unsigned int)(idx.size() / 4);
+
+	Slot slot;
+	slot.vertCount = vertCount;
+	slot.idxWords = idxWords;
+	slot.live = true;
+	slot.verts = vertAllocator.Allocate(vertCount);
+	slot.idx = idxAllocator.Allocate(idxWords);
+	if (slot.verts.offset == OffsetAllocator::NoSpace || slot.idx.offset == OffsetAllocator::NoSpace) {
+		vertAllocator.Free(slot.verts);
+		idxAllocator.Free(slot.idx);
+		//grow until it fits after compaction, which also gets rid of whatever fragmentation made it fail
+		unsigned int vertCapacity = vertAllocator.Size();
+		unsigned int idxCapacity = idxAllocator.Size();
+		while (vertCapacity - (vertAllocator.Size() - vertAllocator.FreeStorage()) < vertCount) vertCapacity *= 2;
+		while (idxCapacity - (idxAllocator.Size() - idxAllocator.FreeStorage()) < idxWords) idxCapacity *= 2;
+		if (vertCapacity == vertAllocator.Size() && idxCapacity == idxAllocator.Size()) {
+			if (vertCapacity - vertAllocator.FreeStorage() + vertCount > vertCapacity * 3 / 4) vertCapacity *= 2;
+			if (idxCapacity - idxAllocator.FreeStorage() + idxWords > idxCapacity * 3 / 4) idxCapacity *= 2;
+		}
+		Rebuild(vertCapacity, idxCapacity, &slot);
+		assert((vertCount == 0 || slot.verts.offset != OffsetAllocator::NoSpace) && (idxWords == 0 || slot.idx.offset != OffsetAllocator::NoSpace));
+	}
+
+	if (vertCount > 0) queue.writeBuffer(vertBuffer, (unsigned long long)slot.verts.offset * vertStride, verts.data(), (size_t)vertCount * vertStride);
+	if (idxWords > 0) queue.writeBuffer(idxBuffer, (unsigned long long)slot.idx.offset * 4, idx.data(), (size_t)idxWords * 4);
+
+	unsigned int index;
+	if (!freeSlots.empty()) {
+		index = freeSlots.back();
+		freeSlots.pop_back();
+		slots[index] = slot;
+	}
+	else {
+		index = (unsigned int)slots.size();
+		slots.push_back(slot);
+	}
+	return index;
+}
+
+void MeshPool::Remove(unsigned int index) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Slot& slot = slots[index];
+	if (!slot.live) return;
+	vertAllocator.Free(slot.verts);
+	idxAllocator.Free(slot.idx);
+	slot = Slot();
+	freeSlots.push_back(index);
+}
+
+MeshPool::Range MeshPool::Get(unsigned int index) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	const Slot& slot = slots[index];
+	Range range;
+	range.baseVertex = slot.vertCount > 0 ? (int)slot.verts.offset : 0;
+	range.vertCount = (int)slot.vertCount;
+	range.idxOffset = slot.idxWords > 0 ? slot.idx.offset * 4 : 0;
+	range.idxBytes = slot.idxWords * 4;
+	return range;
+}
+
+void MeshPool::Defragment() {
+	std::lock_guard<std::mutex> lock(mutex);
+	Rebuild(vertAllocator.Size(), idxAllocator.Size());
+}
+
+Buffer MeshPool::VertBuffer() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return vertBuffer;
+}
+
+Buffer MeshPool::IdxBuffer() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return idxBuffer;
+}
+
+unsigned int MeshPool::VertsUsed() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return vertAllocator.Size() - vertAllocator.FreeStorage();
+}
+
+unsigned int MeshPool::VertCapacity() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return vertAllocator.Size();
+}
+
+unsigned int MeshPool::IdxBytesUsed() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return (idxAllocator.Size() - idxAllocator.FreeStorage()) * 4;
+}
+
+unsigned int MeshPool::IdxCapacity() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return idxAllocator.Size() * 4;
+}
+
+float MeshPool::Fragmentation() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	unsigned int free = vertAllocator.FreeStorage();
+	if (free == 0) return 0.f;
+	return 1.f - (float)std::min(vertAllocator.LargestFree(), free) / free;
+}
+
+unsigned int MeshPool::Generation() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return generation;
+}
+
+void MeshPool::Rebuild(unsigned int vertCapacity, unsigned int idxWords, Slot* pending) {
+	//allocating in order of the old offsets keeps everything in the same order, just without the gaps
+	std::vector<unsigned int> order;
+	for (unsigned int i = 0; i < slots.size(); i++) {
+		if (slots[i].live) order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return slots[a].verts.offset < slots[b].verts.offset; });
+
+	//the pending slot goes last, Repack grows the sizes until everything has a place
+	std::vector<unsigned int> vertCounts, idxCounts;
+	for (unsigned int i : order) {
+		vertCounts.push_back(slots[i].vertCount);
+		idxCounts.push_back(slots[i].idxWords);
+	}
+	if (pending) {
+		vertCounts.push_back(pending->vertCount);
+		idxCounts.push_back(pending->idxWords);
+	}
+	std::vector<OffsetAllocator::Allocation> placedVerts, placedIdx;
+	vertCapacity = vertAllocator.Repack(vertCapacity, vertCounts, placedVerts);
+	idxWords = idxAllocator.Repack(idxWords, idxCounts, placedIdx);
+	if (pending) {
+		pending->verts = placedVerts.back();
+		pending->idx = placedIdx.back();
+	}
+
+	generation++;
+	Buffer newVerts = CreatePoolBuffer(device, (unsigned long long)vertCapacity * vertStride, BufferUsage::Vertex, "mesh pool vertex buffer");
+	Buffer newIdx = CreatePoolBuffer(device, (unsigned long long)idxWords * 4, BufferUsage::Index, "mesh pool idx buffer");
+
+	if (vertBuffer) {
+		CommandEncoderDescriptor encoderDesc;
+		encoderDesc.label = "mesh pool rebuild";
+		CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+		for (size_t i = 0; i < order.size(); i++) {
+			Slot& slot = slots[order[i]];
+			if (slot.vertCount > 0) encoder.copyBufferToBuffer(vertBuffer, (unsigned long long)slot.verts.offset * vertStride, newVerts, (unsigned long long)placedVerts[i].offset * vertStride, (unsigned long long)slot.vertCount * vertStride);
+			if (slot.idxWords > 0) encoder.copyBufferToBuffer(idxBuffer, (unsigned long long)slot.idx.offset * 4, newIdx, (unsigned long long)placedIdx[i].offset * 4, (unsigned long long)slot.idxWords * 4);
+			slot.verts = placedVerts[i];
+			slot.idx = placedIdx[i];
+		}
+		CommandBufferDescriptor commandDesc;
+		commandDesc.label = "mesh pool rebuild";
+		queue.submit(encoder.finish(commandDesc));
+		encoder.drop();
+
+		//still alive until the copy has run, wgpu keeps its own reference
+		vertBuffer.drop();
+		idxBuffer.drop();
+		std::cout << "Mesh pool rebuilt with room for " << vertCapacity << " verts, " << idxWords * 4 / 1024 << " KB of indices\n";
+	}
+	vertBuffer = newVerts;
+	idxBuffer = newIdx;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <mutex>
+#include <span>
+#include <vector>
+#include "webgpu\webgpu.hpp"
+#include "offsetAllocator.hpp"
+
+//one big vertex buffer and one big index buffer shared by every mesh with the same vertex stride,
+//so drawing a different mesh is just a different firstIndex/baseVertex instead of rebinding buffers
+//Add/Remove can be called from any thread, but growing or defragmenting replaces the buffers and moves meshes,
+//so whoever records draws has to fetch the buffers and ranges after the last Add of the frame
+class MeshPool {
+public:
+	struct Range {
+		int baseVertex;
+		int vertCount;
+		unsigned int idxOffset; //bytes, a multiple of 4
+		unsigned int idxBytes;
+	};
+
+	//capacities are in vertices and index bytes, they double whenever something doesn't fit
+	MeshPool(wgpu::Device device, wgpu::Queue queue, unsigned int vertStride, unsigned int vertCapacity, unsigned int idxCapacity);
+	~MeshPool();
+
+	//copies the mesh in, index data has to be padded to a multiple of 4 bytes. returns a slot for Get and Remove
+	unsigned int Add(std::span<const char> verts, std::span<const char> idx);
+	void Remove(unsigned int slot);
+	Range Get(unsigned int slot) const;
+
+	//packs every mesh to the start of fresh buffers
+	void Defragment();
+
+	wgpu::Buffer VertBuffer() const;
+	wgpu::Buffer IdxBuffer() const;
+	unsigned int VertStride() const { return vertStride; }
+	unsigned int VertsUsed() const;
+	unsigned int VertCapacity() const;
+	unsigned int IdxBytesUsed() const;
+	unsigned int IdxCapacity() const;
+	//share of the free vertex space outside the largest free range, 0 is unfragmented
+	float Fragmentation() const;
+	//bumped whenever the buffers are replaced and meshes move, anything recorded against the old ones is stale
+	unsigned int Generation() const;
+
+private:
+	struct Slot {
+		OffsetAllocator::Allocation verts;
+		OffsetAllocator::Allocation idx;
+		unsigned int vertCount = 0;
+		unsigned int idxWords = 0;
+		bool live = false;
+	};
+
+	wgpu::Device device;
+	wgpu::Queue queue;
+	unsigned int vertStride;
+
+	mutable std::mutex mutex;
+	wgpu::Buffer vertBuffer = nullptr;
+	wgpu::Buffer idxBuffer = nullptr;
+	OffsetAllocator vertAllocator; //in vertices
+	OffsetAllocator idxAllocator; //in 4 byte words
+	std::vector<Slot> slots;
+	std::vector<unsigned int> freeSlots;
+	unsigned int generation = 0;
+
+	//new buffers of at least the given sizes with every live mesh copied to the front, caller holds the lock
+	//a pending slot that isn't in slots yet gets its ranges placed after them
+	void Rebuild(unsigned int vertCapacity, unsigned int idxWords, Slot* pending = nullptr);
+};
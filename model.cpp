@@ -1,9 +1,29 @@
 #include "model.hpp"
+#include "modelCache.hpp"
+#include "vertexConvert.hpp"
+#include "meshOptimize.hpp"
 #include "granny2\include\granny.h"
 #include "webgpu\webgpu.hpp"
+#include <algorithm>
+#include <cmath>
 using namespace wgpu;
 
-Model::Model(const char* path, Device& device, Queue& queue) {
+//cluster sort for less overdraw, only applied when it keeps the cache numbers within 5%
+static const bool reduceOverdraw = true;
+static const int maxLods = 6;
+static const size_t minLodTris = 64;
+
+Model::Model(const char* path, Device& device, Queue& queue, MeshPool& pool, VertexLayout layout, BindGroupLayout boundsLayout) : pool(&pool) {
+	//cooked copy from an earlier run, skips granny entirely
+	{
+		ModelCache cache;
+		ModelBlob blob;
+		if (cache.Open(path, layout, blob)) {
+			Upload(blob, device, queue, boundsLayout);
+			return;
+		}
+	}
+
 	//jank granny testing stuff
 	granny_file* file = GrannyReadEntireFile(path);
 	granny_file_info* info = GrannyGetFileInfo(file);
@@ -16,84 +36,190 @@ Model::Model(const char* path, Device& device, Queue& queue) {
 	//GrannyCopyMeshVertices(grannyMesh, GrannyPN33VertexType, grannyVertData.data());
 
 	int vertCount = grannyMesh->PrimaryVertexData->VertexCount;
-	this->vertData = new char[vertCount * 32 + 128]; //extra padding
+	std::vector<char> vertData(vertCount * 32 + 128); //extra padding
+	granny_data_type_definition* vertType = grannyMesh->PrimaryVertexData->VertexType;
+	if (GrannyGetTotalObjectSize(vertType) == 32) {
+		//pull everything out in one go, then convert in bulk
+		GrannyCopyMeshVertices(grannyMesh, vertType, vertData.data());
+	}
+	else {
+		for (int i = 0; i < vertCount; i++) {
+			GrannyGetSingleVertex(grannyMesh->PrimaryVertexData, i, vertType, (void*)(vertData.data() + 32 * i)); //does this fuck stuff up if it outputs to a too small buffer?
+		}
+	}
+	ConvertEsoVerts(vertData.data(), vertCount);
+
+	//always work on 32 bit indices, they get narrowed again below
+	std::vector<unsigned int> indices(GrannyGetMeshIndexCount(grannyMesh));
+	GrannyCopyMeshIndices(grannyMesh, 4, indices.data());
+
+	CacheStats before = AnalyzeVertexCache(indices, vertCount);
+	OptimizeVertexCache(indices, vertCount);
+	if (reduceOverdraw) OptimizeOverdraw(indices, vertData.data(), 32, vertCount, 1.05f);
+	vertCount = OptimizeVertexFetch(indices, vertData.data(), 32, vertCount);
+	CacheStats after = AnalyzeVertexCache(indices, vertCount);
+	std::cout << grannyMesh->Name << ": " << indices.size() / 3 << " tris, " << vertCount << " verts, ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+
+	//bounding sphere around the aabb centre, used for lod selection and culling
+	float boundsLow[3] = { INFINITY, INFINITY, INFINITY };
+	float boundsHigh[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (int i = 0; i < vertCount; i++) {
+		const float* p = (const float*)(vertData.data() + 32 * i);
+		for (int c = 0; c < 3; c++) {
+			boundsLow[c] = std::min(boundsLow[c], p[c]);
+			boundsHigh[c] = std::max(boundsHigh[c], p[c]);
+		}
+	}
+	float sphereCenter[3];
+	float sphereRadius = 0.f;
+	for (int c = 0; c < 3; c++) sphereCenter[c] = vertCount > 0 ? (boundsLow[c] + boundsHigh[c]) * 0.5f : 0.f;
+	for (int i = 0; i < vertCount; i++) {
+		const float* p = (const float*)(vertData.data() + 32 * i);
+		float dx = p[0] - sphereCenter[0], dy = p[1] - sphereCenter[1], dz = p[2] - sphereCenter[2];
+		sphereRadius = std::max(sphereRadius, dx * dx + dy * dy + dz * dz);
+	}
+	sphereRadius = std::sqrt(sphereRadius);
+
+	//lod chain, each level goes for half the triangles of the one before and indexes the same verts
+	std::vector<MeshLod> lodList;
+	lodList.push_back({ 0, (int)indices.size(), 0.f, 0.f });
+	std::vector<unsigned int> allIndices = indices;
 	{
-		float* floatVertBuffer = (float*)vertData;
-		for (int i = 0; i < grannyMesh->PrimaryVertexData->VertexCount; i++) {
-			GrannyGetSingleVertex(grannyMesh->PrimaryVertexData, i, grannyMesh->PrimaryVertexData->VertexType, (void*)(vertData + 32 * i)); //does this fuck stuff up if it outputs to a too small buffer?
-			EsoVert* vert = (EsoVert*)(vertData + 32 * i);
-			vert->x = vert->x * -1;
-			bool inverted = false;
-			if (0 > vert->nx) {
-				vert->nx = vert->nx + 32768;
-				inverted = true;
-			}
-			if (0 > vert->ny) {
-				vert->ny = vert->ny + 32768;
-				inverted = true;
-			}
-			//vert->u = bx::halfFromFloat(vert->u / 1024.f);
-			//vert->v = bx::halfFromFloat(vert->v / -1024.f);
-
-
-			float fnormX = ((float)vert->nx) / -16384.f + 1.f;
-			float fnormY = ((float)vert->ny) / 16384.f - 1.f;
-			float fnormZ = std::sqrtf(1 - fnormX * fnormX - fnormY * fnormY);
-			if (inverted) fnormZ *= -1;
-			floatVertBuffer[i * 8 + 4] = fnormX;
-			floatVertBuffer[i * 8 + 5] = fnormY;
-			floatVertBuffer[i * 8 + 6] = fnormZ;
-
-			//std::cout << "TEST " << vert->x << " " << vert->y << " " << vert->z << " " << fnormX << " " << fnormY  << " " << fnormZ << "\n";
+		std::vector<unsigned int> previous = indices;
+		while ((int)lodList.size() < maxLods && previous.size() / 3 > minLodTris) {
+			float error;
+			std::vector<unsigned int> next = SimplifyMesh(previous, vertData.data(), 32, vertCount, previous.size() / 2, sphereRadius * 0.1f, &error);
+			if (next.size() > previous.size() * 4 / 5) break; //stuck on locked verts or the error limit
+			OptimizeVertexCache(next, vertCount);
+			lodList.push_back({ (int)allIndices.size(), (int)next.size(), lodList.back().error + error, 0.f });
+			allIndices.insert(allIndices.end(), next.begin(), next.end());
+			previous.swap(next);
 		}
 	}
+	std::cout << grannyMesh->Name << ": " << lodList.size() << " lods, coarsest " << lodList.back().idxCount / 3 << " tris" << std::endl;
 
-	if (grannyMesh->PrimaryTopology->IndexCount > 0) {
-		idx32 = true;
-		idxCount = grannyMesh->PrimaryTopology->IndexCount;
-		idxBufferSize = (idxCount * sizeof(uint32_t) + 3) & ~3;
-		idxData = new char[idxBufferSize];
-		GrannyCopyMeshIndices(grannyMesh, 4, idxData);
+	//16 bit indices whenever the vertex count allows, whatever granny stored them as
+	idx32 = vertCount > 65536;
+	idxCount = (int)indices.size();
+	int totalIdxCount = (int)allIndices.size();
+	int idxBufferSize = (totalIdxCount * (idx32 ? sizeof(uint32_t) : sizeof(uint16_t)) + 3) & ~3;
+	std::vector<char> idxData(idxBufferSize);
+	if (idx32) {
+		std::memcpy(idxData.data(), allIndices.data(), totalIdxCount * sizeof(uint32_t));
 	}
 	else {
-		idx32 = false;
-		idxCount = grannyMesh->PrimaryTopology->Index16Count;
-		idxBufferSize = (idxCount * sizeof(uint16_t) + 3) & ~3;
-		idxData = new char[idxBufferSize];
-		GrannyCopyMeshIndices(grannyMesh, 2, idxData);
+		uint16_t* narrow = (uint16_t*)idxData.data();
+		for (int i = 0; i < totalIdxCount; i++) narrow[i] = (uint16_t)allIndices[i];
 	}
 
-	
-
 	//for (int i = 0; i < grannyIdxData.size(); i += 3) {
 	//	cout << grannyIdxData[i] << " " << grannyIdxData[i + 1] << " " << grannyIdxData[i + 2] << endl;
 	//}
 	GrannyFreeFile(file);
 
-	BufferDescriptor vBufferDesc;
-	vBufferDesc.size = vertCount * 32;
-	vBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-	vBufferDesc.mappedAtCreation = false;
-	vBufferDesc.label = "vertex buffer";
-	this->vertBuffer = device.createBuffer(vBufferDesc);
-	queue.writeBuffer(vertBuffer, 0, vertData, vBufferDesc.size);
-
-
-	//IDX BUFFER
-	BufferDescriptor idxBufferDesc;
-	//A writeBuffer operation must copy a number of bytes that is a multiple of 4. To ensure so we can switch bufferDesc.size for (bufferDesc.size + 3) & ~3.
-	idxBufferDesc.size = idxBufferSize;
-	idxBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Index;
-	idxBufferDesc.mappedAtCreation = false;
-	idxBufferDesc.label = "idx buffer";
-	this->idxBuffer = device.createBuffer(idxBufferDesc);
-	queue.writeBuffer(idxBuffer, 0, idxData, idxBufferSize);
-	this->vertBufferSize = vertCount * 32;
-	
+	ModelBlob blob;
+	blob.layout = layout;
+	blob.vertCount = vertCount;
+	blob.idxCount = idxCount;
+	blob.idx32 = idx32;
+	blob.verts = std::span<const char>(vertData.data(), vertCount * 32);
+	blob.idx = std::span<const char>(idxData.data(), idxBufferSize);
+	blob.lods = lodList;
+	for (int c = 0; c < 3; c++) {
+		blob.boundsMin[c] = 0.f;
+		blob.boundsExtent[c] = 0.f;
+		blob.center[c] = sphereCenter[c];
+	}
+	blob.radius = sphereRadius;
+
+	std::vector<CompactVert> compactData;
+	if (layout == VertexLayout::Compact) {
+		compactData.resize((vertCount + 1) & ~1); //keeps the buffer size a multiple of 4
+		CompactEsoVerts(vertData.data(), vertCount, compactData.data(), blob.boundsMin, blob.boundsExtent);
+		blob.verts = std::span<const char>((const char*)compactData.data(), compactData.size() * sizeof(CompactVert));
+	}
+
+	ModelCache::Store(path, blob);
+	Upload(blob, device, queue, boundsLayout);
+}
+
+void Model::Upload(const ModelBlob& blob, Device& device, Queue& queue, BindGroupLayout boundsLayout) {
+	layout = blob.layout;
+	vertStride = layout == VertexLayout::Compact ? sizeof(CompactVert) : 32;
+	idx32 = blob.idx32;
+	idxCount = blob.idxCount;
+	for (int c = 0; c < 3; c++) {
+		boundsMin[c] = blob.boundsMin[c];
+		boundsExtent[c] = blob.boundsExtent[c];
+		center[c] = blob.center[c];
+	}
+	radius = blob.radius;
+	lods.assign(blob.lods.begin(), blob.lods.end());
+
+	//verts of another stride would land across other meshes' data, the model stays out of the pool with nothing to draw
+	if ((int)pool->VertStride() != vertStride) {
+		std::cout << "Mesh pool stride " << pool->VertStride() << " doesn't match the model's " << vertStride << ", not uploading it\n";
+		lods.clear();
+		return;
+	}
+	//kept until AddToPool, the blob only lives as long as the cache mapping or the locals that built it
+	pendingVerts.assign(blob.verts.begin(), blob.verts.end());
+	pendingIdx.assign(blob.idx.begin(), blob.idx.end());
+
+	if (layout == VertexLayout::Compact) {
+		//matches MeshBounds in the shader, vec3s are padded to 16
+		float bounds[8] = { boundsMin[0], boundsMin[1], boundsMin[2], 0.f, boundsExtent[0], boundsExtent[1], boundsExtent[2], 0.f };
+		BufferDescriptor boundsBufferDesc;
+		boundsBufferDesc.size = sizeof(bounds);
+		boundsBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+		boundsBufferDesc.mappedAtCreation = false;
+		boundsBufferDesc.label = "mesh bounds buffer";
+		boundsBuffer = device.createBuffer(boundsBufferDesc);
+		queue.writeBuffer(boundsBuffer, 0, bounds, sizeof(bounds));
+
+		BindGroupEntry boundsEntry = Default;
+		boundsEntry.binding = 0;
+		boundsEntry.buffer = boundsBuffer;
+		boundsEntry.offset = 0;
+		boundsEntry.size = sizeof(bounds);
+		BindGroupDescriptor boundsGroupDesc;
+		boundsGroupDesc.layout = boundsLayout;
+		boundsGroupDesc.entryCount = 1;
+		boundsGroupDesc.entries = &boundsEntry;
+		boundsGroup = device.createBindGroup(boundsGroupDesc);
+	}
+}
+
+void Model::AddToPool() {
+	if (poolSlot != NoSlot || lods.empty()) return;
+	//index data is already padded to a multiple of 4 bytes, writeBuffer needs that
+	poolSlot = pool->Add(pendingVerts, pendingIdx);
+	std::vector<char>().swap(pendingVerts);
+	std::vector<char>().swap(pendingIdx);
+}
+
+int Model::SelectLod(float distance, float scale, float pixelsPerUnit, float maxPixelError) const {
+	//coarsest lod whose error, projected to the screen at this distance, stays under maxPixelError
+	float projected = scale * pixelsPerUnit / std::max(distance, 1e-4f);
+	for (int i = (int)lods.size() - 1; i > 0; i--) {
+		if (lods[i].error * projected <= maxPixelError) return i;
+	}
+	return 0;
+}
+
+int Model::BaseVertex() const {
+	if (poolSlot == NoSlot) return 0;
+	return pool->Get(poolSlot).baseVertex;
+}
 
+int Model::FirstIndex() const {
+	if (poolSlot == NoSlot) return 0;
+	return (int)(pool->Get(poolSlot).idxOffset / (idx32 ? sizeof(uint32_t) : sizeof(uint16_t)));
 }
 
 Model::~Model() {
-	vertBuffer.drop();
-	idxBuffer.drop();
+	if (poolSlot != NoSlot) pool->Remove(poolSlot);
+	if (boundsGroup) boundsGroup.drop();
+	if (boundsBuffer) boundsBuffer.drop();
 }
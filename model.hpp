@@ -1,43 +1,59 @@
+#pragma once
 #include "webgpu\webgpu.hpp"
+#include "vertexConvert.hpp"
+#include "meshOptimize.hpp"
+#include "meshPool.hpp"
+
+struct ModelBlob;
 
 struct Model {
 public:
-    //idx buffers have to be a mult of 16 so this is neccecary, to tell in the render pass how much to use from each buffer
-	int vertBufferSize;
-	int idxBufferSize;
-	int idxCount;
+	int idxCount; //full detail, lods[0]
 	bool idx32;
 
-	wgpu::Buffer vertBuffer = nullptr;
-	wgpu::Buffer idxBuffer = nullptr;
+	//geometry lives in a shared MeshPool, these are only valid until the pool's next Add or Defragment
+	//NoSlot until AddToPool, and for good if the model couldn't go into the pool (it has no lods then)
+	static const unsigned int NoSlot = 0xFFFFFFFF;
+	MeshPool* pool = nullptr;
+	unsigned int poolSlot = NoSlot;
+	bool InPool() const { return poolSlot != NoSlot; }
+	int BaseVertex() const;
+	int FirstIndex() const; //in indices of this model's format
+
+	//index ranges relative to FirstIndex, finest first, all using the same verts
+	std::vector<MeshLod> lods;
+	//bounding sphere in model space
+	float center[3];
+	float radius;
+
+
+	VertexLayout layout;
+	int vertStride;
+	//compact models only, bounds for decoding positions at group 1
+	float boundsMin[3];
+	float boundsExtent[3];
+	wgpu::Buffer boundsBuffer = nullptr;
+	wgpu::BindGroup boundsGroup = nullptr;
 
 	std::vector<wgpu::VertexAttribute> vertAttributes;
 
-	Model(const char* path, wgpu::Device& device, wgpu::Queue& queue);
+	//the pool's stride has to match the layout, boundsLayout is only needed for the compact layout
+	//loading can run on any thread, the geometry only goes into the pool with AddToPool
+	Model(const char* path, wgpu::Device& device, wgpu::Queue& queue, MeshPool& pool, VertexLayout layout = VertexLayout::Full, wgpu::BindGroupLayout boundsLayout = nullptr);
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
 	~Model();
 
+	//adding can grow or move the pool's buffers, so it has to happen where nothing is reading them (see MeshPool)
+	void AddToPool();
+
+	//pixelsPerUnit is the screen height in pixels of something one unit tall at distance one
+	int SelectLod(float distance, float scale, float pixelsPerUnit, float maxPixelError = 1.f) const;
+
 
 private:
-	char* vertData;
-	char* idxData;
-
-
-	struct EsoVert {
-		float x; //4
-		float y; //8
-		float z; //12
-		char r;  //13
-		char g;  //14
-		char b;  //15
-		char a;  //16
-		short nx;//18
-		short ny;//20
-		short tx;//22
-		short ty;//24
-		short bx;//26
-		short by;//28
-		short u; //30
-		short v; //32
-	};
+	void Upload(const ModelBlob& blob, wgpu::Device& device, wgpu::Queue& queue, wgpu::BindGroupLayout boundsLayout);
+	std::vector<char> pendingVerts;
+	std::vector<char> pendingIdx;
 
 };
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "modelCache.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+std::string ModelCache::directory = "modelcache";
+
+namespace {
+	const unsigned int cacheMagic = 0x4C444D43; //CMDL
+	const unsigned int cacheVersion = 4;
+
+	struct CacheHeader {
+		unsigned int magic;
+		unsigned int version;
+		unsigned long long sourceSize;
+		long long sourceTime;
+		unsigned int pathLength;
+		unsigned int layout;
+		float boundsMin[3];
+		float boundsExtent[3];
+		float center[3];
+		float radius;
+		unsigned int lodCount;
+		unsigned int idx32;
+		unsigned int vertCount;
+		unsigned int idxCount;
+		unsigned long long vertBytes;
+		unsigned long long idxBytes;
+	};
+
+	struct SourceKey {
+		std::string path;
+		unsigned long long size;
+		long long time;
+	};
+
+	bool GetKey(const char* sourcePath, SourceKey& key) {
+		std::error_code error;
+		key.path = std::filesystem::absolute(sourcePath, error).string();
+		key.size = std::filesystem::file_size(sourcePath, error);
+		if (error) return false;
+		key.time = (long long)std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+		return !error;
+	}
+
+	std::filesystem::path EntryPath(const std::string& sourcePath, VertexLayout layout) {
+		//fnv-1a of the absolute source path and the layout
+		unsigned long long hash = 0xcbf29ce484222325ULL;
+		for (char c : sourcePath) {
+			hash ^= (unsigned char)c;
+			hash *= 0x100000001b3ULL;
+		}
+		hash ^= (unsigned long long)layout;
+		hash *= 0x100000001b3ULL;
+		char name[24];
+		snprintf(name, sizeof(name), "%016llX.mdl", hash);
+		return std::filesystem::path(ModelCache::directory) / name;
+	}
+
+	size_t Align16(size_t offset) {
+		return (offset + 15) & ~(size_t)15;
+	}
+
+	//header, source path, lod table, verts, indices, each section 16 byte aligned
+	void SectionOffsets(const CacheHeader& header, size_t& lodOffset, size_t& vertOffset, size_t& idxOffset) {
+		lodOffset = Align16(sizeof(CacheHeader) + header.pathLength);
+		vertOffset = Align16(lodOffset + header.lodCount * sizeof(MeshLod));
+		idxOffset = Align16(vertOffset + header.vertBytes);
+	}
+}
+
+bool ModelCache::Open(const char* sourcePath, VertexLayout layout, ModelBlob& blob) {
+	SourceKey key;
+	if (directory.empty() || !GetKey(sourcePath, key)) return false;
+	std::filesystem::path entryPath = EntryPath(key.path, layout);
+	if (!std::filesystem::exists(entryPath)) return false;
+
+	reader = std::make_unique<BinaryReader>(entryPath.string().c_str());
+	std::span<const char> bytes = reader->Bytes();
+	if (bytes.size() < sizeof(CacheHeader)) return false;
+	const CacheHeader* header = (const CacheHeader*)bytes.data();
+	size_t lodOffset, vertOffset, idxOffset;
+	SectionOffsets(*header, lodOffset, vertOffset, idxOffset);
+	if (header->magic != cacheMagic || header->version != cacheVersion ||
+		header->sourceSize != key.size || header->sourceTime != key.time || header->layout != (unsigned int)layout ||
+		idxOffset + header->idxBytes > bytes.size() ||
+		key.path.compare(0, std::string::npos, bytes.data() + sizeof(CacheHeader), header->pathLength) != 0) {
+		reader.reset();
+		return false;
+	}
+
+	blob.layout = layout;
+	for (int c = 0; c < 3; c++) {
+		blob.boundsMin[c] = header->boundsMin[c];
+		blob.boundsExtent[c] = header->boundsExtent[c];
+		blob.center[c] = header->center[c];
+	}
+	blob.radius = header->radius;
+	blob.vertCount = header->vertCount;
+	blob.idxCount = header->idxCount;
+	blob.idx32 = header->idx32 != 0;
+	blob.verts = bytes.subspan(vertOffset, header->vertBytes);
+	blob.idx = bytes.subspan(idxOffset, header->idxBytes);
+	blob.lods = std::span<const MeshLod>((const MeshLod*)(bytes.data() + lodOffset), header->lodCount);
+	return true;
+}
+
+void ModelCache::Store(const char* sourcePath, const ModelBlob& blob) {
+	SourceKey key;
+	if (directory.empty() || !GetKey(sourcePath, key)) return;
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	CacheHeader header = {};
+	header.magic = cacheMagic;
+	header.version = cacheVersion;
+	header.sourceSize = key.size;
+	header.sourceTime = key.time;
+	header.pathLength = (unsigned int)key.path.size();
+	header.layout = (unsigned int)blob.layout;
+	for (int c = 0; c < 3; c++) {
+		header.boundsMin[c] = blob.boundsMin[c];
+		header.boundsExtent[c] = blob.boundsExtent[c];
+		header.center[c] = blob.center[c];
+	}
+	header.radius = blob.radius;
+	header.lodCount = (unsigned int)blob.lods.size();
+	header.idx32 = blob.idx32 ? 1 : 0;
+	header.vertCount = blob.vertCount;
+	header.idxCount = blob.idxCount;
+	header.vertBytes = blob.verts.size();
+	header.idxBytes = blob.idx.size();
+
+	//write to a temp file and rename so a concurrent reader never sees half an entry
+	std::filesystem::path entryPath = EntryPath(key.path, blob.layout);
+	std::filesystem::path tempPath = entryPath;
+	tempPath += ".tmp";
+	{
+		static const char zeros[16] = {};
+		std::ofstream out(tempPath, std::ios_base::binary);
+		size_t lodOffset, vertOffset, idxOffset;
+		SectionOffsets(header, lodOffset, vertOffset, idxOffset);
+		size_t lodBytes = blob.lods.size() * sizeof(MeshLod);
+		out.write((const char*)&header, sizeof(header));
+		out.write(key.path.data(), key.path.size());
+		out.write(zeros, lodOffset - sizeof(CacheHeader) - key.path.size());
+		out.write((const char*)blob.lods.data(), lodBytes);
+		out.write(zeros, vertOffset - lodOffset - lodBytes);
+		out.write(blob.verts.data(), blob.verts.size());
+		out.write(zeros, idxOffset - vertOffset - blob.verts.size());
+		out.write(blob.idx.data(), blob.idx.size());
+		if (!out) {
+			std::cout << "Could not write model cache entry " << tempPath << std::endl;
+			return;
+		}
+	}
+	std::filesystem::rename(tempPath, entryPath, error);
+	if (error) std::filesystem::remove(tempPath, error);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <memory>
+#include <span>
+#include <string>
+#include "BinaryReader.h"
+#include "vertexConvert.hpp"
+#include "meshOptimize.hpp"
+
+//gpu ready vertex and index data for one model, exactly what gets passed to writeBuffer
+struct ModelBlob {
+	VertexLayout layout;
+	float boundsMin[3];
+	float boundsExtent[3];
+	float center[3];
+	float radius;
+	int vertCount;
+	int idxCount;
+	bool idx32;
+	std::span<const char> verts;
+	std::span<const char> idx;
+	std::span<const MeshLod> lods;
+};
+
+//persistent cache of cooked models so a second launch doesn't need granny at all
+//entries are keyed by source path, size and mtime, anything stale is rebuilt
+class ModelCache {
+public:
+	static std::string directory; //empty turns the cache off
+
+	//maps the entry for a source model, the blob stays valid as long as this object
+	bool Open(const char* sourcePath, VertexLayout layout, ModelBlob& blob);
+	static void Store(const char* sourcePath, const ModelBlob& blob);
+
+private:
+	std::unique_ptr<BinaryReader> reader;
+};
@@ -0,0 +1,84 @@
+#include "modelRegistry.hpp"
+#include "profiler.hpp"
+#include <filesystem>
+#include <iostream>
+
+ModelRegistry::ModelRegistry(const std::string& directory, wgpu::Device device, wgpu::Queue queue, MeshPool& pool, VertexLayout layout, wgpu::BindGroupLayout boundsLayout)
+	: directory(directory), device(device), queue(queue), pool(pool), layout(layout), boundsLayout(boundsLayout) {
+}
+
+ModelRegistry::~ModelRegistry() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& [id, entry] : entries) {
+		if (entry.refs > 0) std::cout << "Model " << id << " still has " << entry.refs << " references at shutdown\n";
+	}
+}
+
+Model* ModelRegistry::Acquire(unsigned int id) {
+	std::unique_lock<std::mutex> lock(mutex);
+	Entry& entry = entries[id]; //references into an unordered_map stay valid through rehashing
+	entry.refs++;
+	if (entry.refs > 1) {
+		loaded.wait(lock, [&entry] { return !entry.loading; });
+		return entry.model.get();
+	}
+
+	entry.loading = true;
+	lock.unlock();
+	std::unique_ptr<Model> model;
+	std::string path = Path(id);
+	if (std::filesystem::exists(path)) {
+		PROFILE_SCOPE("load model");
+		model = std::make_unique<Model>(path.c_str(), device, queue, pool, layout, boundsLayout);
+	}
+	else std::cout << "Model " << id << " not found at " << path << "\n";
+	lock.lock();
+
+	entry.model = std::move(model);
+	entry.loading = false;
+	if (entry.model) pending.push_back(id);
+	loaded.notify_all();
+	return entry.model.get();
+}
+
+void ModelRegistry::Release(unsigned int id) {
+	std::unique_ptr<Model> dropped; //destroyed after unlocking, freeing gpu buffers doesn't need to block other threads
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(id);
+		if (it == entries.end()) return;
+		if (--it->second.refs > 0) return;
+		dropped = std::move(it->second.model);
+		entries.erase(it);
+	}
+}
+
+void ModelRegistry::AddPending() {
+	//under the lock, a Release on another thread could drop a model halfway through
+	std::lock_guard<std::mutex> lock(mutex);
+	for (unsigned int id : pending) {
+		auto it = entries.find(id);
+		if (it != entries.end() && it->second.model) it->second.model->AddToPool();
+	}
+	pending.clear();
+}
+
+Model* ModelRegistry::Find(unsigned int id) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = entries.find(id);
+	if (it == entries.end() || it->second.loading || !it->second.model || !it->second.model->InPool()) return nullptr;
+	return it->second.model.get();
+}
+
+std::string ModelRegistry::Path(unsigned int id) const {
+	return (std::filesystem::path(directory) / (std::to_string(id) + ".gr2")).string();
+}
+
+size_t ModelRegistry::LoadedCount() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t count = 0;
+	for (auto& [id, entry] : entries) {
+		if (entry.model) count++;
+	}
+	return count;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "model.hpp"
+
+//shared models keyed by the model id fixtures use, each loaded at most once and dropped when the last user releases it
+//safe to call from any thread, a second thread asking for a model that's still loading waits for the first one
+class ModelRegistry {
+public:
+	//directory holds <id>.gr2, boundsLayout is only needed for the compact layout
+	ModelRegistry(const std::string& directory, wgpu::Device device, wgpu::Queue queue, MeshPool& pool, VertexLayout layout = VertexLayout::Full, wgpu::BindGroupLayout boundsLayout = nullptr);
+	~ModelRegistry();
+
+	//takes a reference and loads the model if nobody holds it yet. every Acquire needs a Release,
+	//even when it returns nullptr for a model that doesn't exist (so it isn't probed for again while in use)
+	//a newly loaded model isn't in the mesh pool until the next AddPending
+	Model* Acquire(unsigned int id);
+	void Release(unsigned int id);
+
+	//puts the models loaded since the last call into the mesh pool, only where nothing is reading the pool (see MeshPool)
+	void AddPending();
+
+	//nullptr if not loaded or not in the pool yet, doesn't take a reference
+	Model* Find(unsigned int id) const;
+
+	std::string Path(unsigned int id) const;
+	size_t LoadedCount() const;
+
+private:
+	struct Entry {
+		std::unique_ptr<Model> model;
+		int refs = 0;
+		bool loading = false;
+	};
+
+	std::string directory;
+	wgpu::Device device;
+	wgpu::Queue queue;
+	MeshPool& pool;
+	VertexLayout layout;
+	wgpu::BindGroupLayout boundsLayout;
+
+	mutable std::mutex mutex;
+	std::condition_variable loaded;
+	std::unordered_map<unsigned int, Entry> entries;
+	std::vector<unsigned int> pending; //loaded but not added to the pool
+};
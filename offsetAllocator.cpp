@@ -0,0 +1,214 @@
+#include "offsetAllocator.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace {
+	const unsigned int mantissaBits = 3;
+	const unsigned int mantissaValue = 1 << mantissaBits;
+	const unsigned int mantissaMask = mantissaValue - 1;
+
+	//sizes under 8 are exact, above that 8 bins per power of two
+	unsigned int BinRoundUp(unsigned int size) {
+		if (size < mantissaValue) return size;
+		unsigned int highBit = 31 - std::countl_zero(size);
+		unsigned int mantissaStart = highBit - mantissaBits;
+		unsigned int exponent = mantissaStart + 1;
+		unsigned int mantissa = (size >> mantissaStart) & mantissaMask;
+		if (size & ((1u << mantissaStart) - 1)) mantissa++; //carries into the exponent when it overflows
+		return (exponent << mantissaBits) + mantissa;
+	}
+
+	unsigned int BinRoundDown(unsigned int size) {
+		if (size < mantissaValue) return size;
+		unsigned int highBit = 31 - std::countl_zero(size);
+		unsigned int mantissaStart = highBit - mantissaBits;
+		unsigned int exponent = mantissaStart + 1;
+		unsigned int mantissa = (size >> mantissaStart) & mantissaMask;
+		return (exponent << mantissaBits) | mantissa;
+	}
+
+	unsigned int BinSize(unsigned int bin) {
+		unsigned int exponent = bin >> mantissaBits;
+		unsigned int mantissa = bin & mantissaMask;
+		if (exponent == 0) return mantissa;
+		return (mantissa | mantissaValue) << (exponent - 1);
+	}
+
+	//index of the lowest set bit at or after start, NoSpace if none
+	unsigned int LowestBitFrom(unsigned int mask, unsigned int start) {
+		if (start >= 32) return OffsetAllocator::NoSpace;
+		unsigned int bits = mask & ~((1u << start) - 1);
+		return bits ? std::countr_zero(bits) : OffsetAllocator::NoSpace;
+	}
+}
+
+OffsetAllocator::OffsetAllocator(unsigned int size) {
+	Reset(size);
+}
+
+void OffsetAllocator::Reset(unsigned int newSize) {
+	size = newSize;
+	freeStorage = 0;
+	usedTopBins = 0;
+	for (int i = 0; i < TopBins; i++) usedLeafBins[i] = 0;
+	for (int i = 0; i < TopBins * LeafBins; i++) binHeads[i] = Unused;
+	nodes.clear();
+	freeNodes.clear();
+	if (size > 0) InsertIntoBin(size, 0);
+}
+
+unsigned int OffsetAllocator::Repack(unsigned int minSize, std::span<const unsigned int> sizes, std::vector<Allocation>& placed) {
+	//the bins round sizes, so even packed a nearly full range can refuse its last allocation
+	placed.resize(sizes.size());
+	for (unsigned int newSize = std::max(minSize, 1u);; newSize *= 2) {
+		Reset(newSize);
+		bool fits = true;
+		for (size_t i = 0; i < sizes.size() && fits; i++) {
+			placed[i] = Allocate(sizes[i]);
+			fits = sizes[i] == 0 || placed[i].offset != NoSpace;
+		}
+		if (fits) return newSize;
+	}
+}
+
+OffsetAllocator::Allocation OffsetAllocator::Allocate(unsigned int allocSize) {
+	Allocation allocation;
+	if (allocSize == 0 || allocSize > freeStorage) return allocation;
+
+	//smallest bin whose every range fits, then the first non empty bin at or above it
+	unsigned int minBin = BinRoundUp(allocSize);
+	unsigned int minTop = minBin >> mantissaBits;
+	unsigned int minLeaf = minBin & mantissaMask;
+	unsigned int top = minTop;
+	unsigned int leaf = NoSpace;
+	if (top < TopBins && (usedTopBins & (1u << top))) leaf = LowestBitFrom(usedLeafBins[top], minLeaf);
+	if (leaf == NoSpace) {
+		top = LowestBitFrom(usedTopBins, minTop + 1);
+		if (top == NoSpace) return allocation;
+		leaf = std::countr_zero((unsigned int)usedLeafBins[top]);
+	}
+	unsigned int bin = (top << mantissaBits) | leaf;
+
+	unsigned int index = binHeads[bin];
+	unsigned int total = nodes[index].size;
+	RemoveFromBin(index);
+	freeNodes.pop_back(); //RemoveFromBin recycles it, we're keeping it
+	Node& node = nodes[index];
+	node.size = allocSize;
+	node.used = true;
+
+	//give the rest back as a new free range right after this one
+	unsigned int remainder = total - allocSize;
+	if (remainder > 0) {
+		unsigned int rest = InsertIntoBin(remainder, nodes[index].offset + allocSize);
+		unsigned int next = nodes[index].neighbourNext;
+		if (next != Unused) nodes[next].neighbourPrev = rest;
+		nodes[rest].neighbourPrev = index;
+		nodes[rest].neighbourNext = next;
+		nodes[index].neighbourNext = rest;
+	}
+
+	allocation.offset = nodes[index].offset;
+	allocation.node = index;
+	return allocation;
+}
+
+void OffsetAllocator::Free(Allocation allocation) {
+	if (allocation.node == NoSpace) return;
+	unsigned int index = allocation.node;
+	Node& node = nodes[index];
+	unsigned int offset = node.offset;
+	unsigned int freedSize = node.size;
+	unsigned int prev = node.neighbourPrev;
+	unsigned int next = node.neighbourNext;
+
+	if (prev != Unused && !nodes[prev].used) {
+		offset = nodes[prev].offset;
+		freedSize += nodes[prev].size;
+		unsigned int before = nodes[prev].neighbourPrev;
+		RemoveFromBin(prev);
+		prev = before;
+	}
+	if (next != Unused && !nodes[next].used) {
+		freedSize += nodes[next].size;
+		unsigned int after = nodes[next].neighbourNext;
+		RemoveFromBin(next);
+		next = after;
+	}
+
+	nodes[index].used = false;
+	freeNodes.push_back(index);
+
+	unsigned int merged = InsertIntoBin(freedSize, offset);
+	nodes[merged].neighbourPrev = prev;
+	nodes[merged].neighbourNext = next;
+	if (prev != Unused) nodes[prev].neighbourNext = merged;
+	if (next != Unused) nodes[next].neighbourPrev = merged;
+}
+
+unsigned int OffsetAllocator::LargestFree() const {
+	if (usedTopBins == 0) return 0;
+	unsigned int top = 31 - std::countl_zero(usedTopBins);
+	unsigned int leaf = 31 - std::countl_zero((unsigned int)usedLeafBins[top]);
+	return BinSize((top << mantissaBits) | leaf);
+}
+
+unsigned int OffsetAllocator::AllocationSize(Allocation allocation) const {
+	if (allocation.node == NoSpace) return 0;
+	return nodes[allocation.node].size;
+}
+
+unsigned int OffsetAllocator::NewNode() {
+	if (!freeNodes.empty()) {
+		unsigned int index = freeNodes.back();
+		freeNodes.pop_back();
+		nodes[index] = Node();
+		return index;
+	}
+	nodes.emplace_back();
+	return (unsigned int)nodes.size() - 1;
+}
+
+unsigned int OffsetAllocator::InsertIntoBin(unsigned int rangeSize, unsigned int offset) {
+	//round down so everything in a bin is at least the bin's size
+	unsigned int bin = BinRoundDown(rangeSize);
+	unsigned int top = bin >> mantissaBits;
+	unsigned int leaf = bin & mantissaMask;
+	if (binHeads[bin] == Unused) {
+		usedLeafBins[top] |= 1 << leaf;
+		usedTopBins |= 1u << top;
+	}
+
+	unsigned int index = NewNode();
+	Node& node = nodes[index];
+	node.offset = offset;
+	node.size = rangeSize;
+	node.binNext = binHeads[bin];
+	if (node.binNext != Unused) nodes[node.binNext].binPrev = index;
+	binHeads[bin] = index;
+	freeStorage += rangeSize;
+	return index;
+}
+
+void OffsetAllocator::RemoveFromBin(unsigned int index) {
+	Node& node = nodes[index];
+	if (node.binPrev != Unused) {
+		nodes[node.binPrev].binNext = node.binNext;
+		if (node.binNext != Unused) nodes[node.binNext].binPrev = node.binPrev;
+	}
+	else {
+		unsigned int bin = BinRoundDown(node.size);
+		unsigned int top = bin >> mantissaBits;
+		unsigned int leaf = bin & mantissaMask;
+		binHeads[bin] = node.binNext;
+		if (node.binNext != Unused) nodes[node.binNext].binPrev = Unused;
+		if (binHeads[bin] == Unused) {
+			usedLeafBins[top] &= ~(1 << leaf);
+			if (usedLeafBins[top] == 0) usedTopBins &= ~(1u << top);
+		}
+	}
+	node.binPrev = Unused;
+	node.binNext = Unused;
+	freeStorage -= node.size;
+	freeNodes.push_back(index);
+}
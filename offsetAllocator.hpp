@@ -0,0 +1,61 @@
+#pragma once
+#include <span>
+#include <vector>
+
+//tlsf style range allocator, hands out offsets into some other storage (a gpu buffer) and never touches it itself
+//sizes are binned on a small float scale (3 bit mantissa) so allocate and free are O(1) with two bitmask scans
+//free ranges are merged with free neighbours straight away
+class OffsetAllocator {
+public:
+	static const unsigned int NoSpace = 0xFFFFFFFF;
+
+	struct Allocation {
+		unsigned int offset = NoSpace;
+		unsigned int node = NoSpace; //pass back to Free
+	};
+
+	OffsetAllocator(unsigned int size = 0);
+
+	//forgets every allocation
+	void Reset(unsigned int size);
+	//Reset to at least minSize and allocate sizes back to back in order, doubling the size until every one of them fits.
+	//placed gets an allocation per size, NoSpace for sizes of 0. returns the size it settled on
+	unsigned int Repack(unsigned int minSize, std::span<const unsigned int> sizes, std::vector<Allocation>& placed);
+
+	//offset is NoSpace if there's no free range big enough
+	Allocation Allocate(unsigned int size);
+	void Free(Allocation allocation);
+
+	unsigned int Size() const { return size; }
+	unsigned int FreeStorage() const { return freeStorage; }
+	//lower bound, a range this big will always succeed
+	unsigned int LargestFree() const;
+	unsigned int AllocationSize(Allocation allocation) const;
+
+private:
+	static const unsigned int Unused = 0xFFFFFFFF;
+	static const int TopBins = 32;
+	static const int LeafBins = 8;
+
+	struct Node {
+		unsigned int offset;
+		unsigned int size;
+		unsigned int binPrev = Unused;
+		unsigned int binNext = Unused;
+		unsigned int neighbourPrev = Unused;
+		unsigned int neighbourNext = Unused;
+		bool used = false;
+	};
+
+	unsigned int size = 0;
+	unsigned int freeStorage = 0;
+	unsigned int usedTopBins = 0;
+	unsigned char usedLeafBins[TopBins];
+	unsigned int binHeads[TopBins * LeafBins];
+	std::vector<Node> nodes;
+	std::vector<unsigned int> freeNodes;
+
+	unsigned int NewNode();
+	unsigned int InsertIntoBin(unsigned int size, unsigned int offset);
+	void RemoveFromBin(unsigned int node);
+};
@@ -0,0 +1,281 @@
+#include "pipelineCache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+using namespace wgpu;
+
+namespace {
+	//fnv-1a
+	unsigned long long Hash(const void* data, size_t size, unsigned long long hash = 14695981039346656037ull) {
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	template <typename T>
+	unsigned long long HashValue(const T& value, unsigned long long hash) {
+		return Hash(&value, sizeof(T), hash);
+	}
+
+	VertexAttribute Attribute(VertexFormat format, unsigned long long offset, unsigned int location) {
+		VertexAttribute attribute;
+		attribute.format = format;
+		attribute.offset = offset;
+		attribute.shaderLocation = location;
+		return attribute;
+	}
+
+	double MsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+bool PipelineKey::operator==(const PipelineKey& other) const {
+	return shader == other.shader && vertices == other.vertices && instanced == other.instanced &&
+		(!instanced || instances == other.instances) && blend == other.blend && depthWrite == other.depthWrite &&
+		depthCompare == other.depthCompare && colorFormat == other.colorFormat && depthFormat == other.depthFormat &&
+		(WGPUPipelineLayout)layout == (WGPUPipelineLayout)other.layout && constants == other.constants;
+}
+
+size_t PipelineCache::KeyHash::operator()(const PipelineKey& key) const {
+	unsigned long long hash = HashValue(key.shader, 14695981039346656037ull);
+	hash = HashValue(key.vertices, hash);
+	hash = HashValue(key.instanced, hash);
+	if (key.instanced) hash = HashValue(key.instances, hash);
+	hash = HashValue(key.blend, hash);
+	hash = HashValue(key.depthWrite, hash);
+	hash = HashValue((WGPUCompareFunction)key.depthCompare, hash);
+	hash = HashValue((WGPUTextureFormat)key.colorFormat, hash);
+	hash = HashValue((WGPUTextureFormat)key.depthFormat, hash);
+	hash = HashValue((WGPUPipelineLayout)key.layout, hash);
+	for (auto& [name, value] : key.constants) {
+		hash = Hash(name.data(), name.size(), hash);
+		hash = HashValue(value, hash);
+	}
+	return (size_t)hash;
+}
+
+PipelineCache::PipelineCache(Device device, const std::string& directory) : device(device), directory(directory) {
+	worker = std::thread(&PipelineCache::WorkerLoop, this);
+}
+
+PipelineCache::~PipelineCache() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	worker.join();
+	for (auto& [key, entry] : pipelines) {
+		if (entry.pipeline) entry.pipeline.drop();
+	}
+	for (auto& [hash, module] : modules) module.drop();
+}
+
+unsigned long long PipelineCache::Shader(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto known = paths.find(path);
+	if (known != paths.end()) {
+		stats.shaderHits++;
+		return known->second;
+	}
+
+	std::ifstream file(std::filesystem::path(directory) / path, std::ios_base::binary);
+	if (!file) {
+		std::cout << "Could not read shader " << path << " in " << directory << "\n";
+		return 0;
+	}
+	std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	unsigned long long hash = Hash(source.data(), source.size());
+	paths[path] = hash;
+	if (modules.count(hash)) {
+		stats.shaderHits++;
+		return hash;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	ShaderModuleWGSLDescriptor codeDesc;
+	codeDesc.chain.next = nullptr;
+	codeDesc.chain.sType = SType::ShaderModuleWGSLDescriptor;
+	codeDesc.code = source.c_str();
+	ShaderModuleDescriptor shaderDesc;
+	shaderDesc.hintCount = 0;
+	shaderDesc.hints = nullptr;
+	shaderDesc.label = path.c_str();
+	shaderDesc.nextInChain = &codeDesc.chain;
+	modules[hash] = device.createShaderModule(shaderDesc);
+	double ms = MsSince(start);
+	stats.shaderMisses++;
+	stats.compileMs += ms;
+	stats.slowestMs = std::max(stats.slowestMs, ms);
+	return hash;
+}
+
+ShaderModule PipelineCache::Module(unsigned long long shader) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = modules.find(shader);
+	return it == modules.end() ? nullptr : it->second;
+}
+
+RenderPipeline PipelineCache::Get(const PipelineKey& key) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = pipelines.find(key);
+	if (it != pipelines.end()) {
+		if (!it->second.ready) return nullptr;
+		stats.hits++;
+		return it->second.pipeline;
+	}
+	stats.misses++;
+	stats.pending++;
+	pipelines.emplace(key, Entry{});
+	queue.push_back(key);
+	wake.notify_one();
+	return nullptr;
+}
+
+RenderPipeline PipelineCache::Wait(const PipelineKey& key) {
+	RenderPipeline pipeline = Get(key);
+	if (pipeline) return pipeline;
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return pipelines[key].ready; });
+	return pipelines[key].pipeline;
+}
+
+PipelineCache::Stats PipelineCache::GetStats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void PipelineCache::WorkerLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !queue.empty(); });
+		if (stopping) return;
+
+		PipelineKey key = std::move(queue.front());
+		queue.pop_front();
+		auto module = modules.find(key.shader);
+		ShaderModule shader = module == modules.end() ? nullptr : module->second;
+
+		lock.unlock();
+		auto start = std::chrono::steady_clock::now();
+		RenderPipeline pipeline = shader ? Create(key, shader) : nullptr;
+		double ms = MsSince(start);
+		lock.lock();
+
+		Entry& entry = pipelines[key];
+		entry.pipeline = pipeline;
+		entry.ready = true;
+		stats.pending--;
+		stats.compiled++;
+		stats.compileMs += ms;
+		stats.slowestMs = std::max(stats.slowestMs, ms);
+		done.notify_all();
+	}
+}
+
+RenderPipeline PipelineCache::Create(const PipelineKey& key, ShaderModule module) {
+	RenderPipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "cached pipeline";
+	pipelineDesc.layout = key.layout;
+
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CW;
+	pipelineDesc.primitive.cullMode = CullMode::Back;
+
+	std::vector<ConstantEntry> constants(key.constants.size(), Default);
+	for (size_t i = 0; i < constants.size(); i++) {
+		constants[i].key = key.constants[i].first.c_str();
+		constants[i].value = key.constants[i].second;
+	}
+
+	//mesh vertices in slot 0, instances in slot 1
+	std::vector<VertexAttribute> vertAttributes;
+	unsigned long long vertStride;
+	if (key.vertices == VertexLayout::Compact) {
+		vertAttributes.resize(3);
+		//position relative to the mesh bounds, octahedral normal, uv
+		vertAttributes[0] = Attribute(VertexFormat::Unorm16x4, offsetof(CompactVert, px), 0);
+		vertAttributes[1] = Attribute(VertexFormat::Snorm16x2, offsetof(CompactVert, nx), 1);
+		vertAttributes[2] = Attribute(VertexFormat::Sint16x2, offsetof(CompactVert, u), 6);
+		vertStride = sizeof(CompactVert);
+	}
+	else {
+		vertAttributes.resize(2);
+		//position, color
+		vertAttributes[0] = Attribute(VertexFormat::Float32x3, 0, 0);
+		vertAttributes[1] = Attribute(VertexFormat::Float32x3, 4 * sizeof(float), 1);
+		vertStride = 32;
+	}
+	//model matrix, or position and scale then the quaternion
+	bool packed = key.instances == InstanceLayout::Packed;
+	std::vector<VertexAttribute> instanceAttributes(packed ? 2 : 4);
+	for (unsigned int i = 0; i < instanceAttributes.size(); i++) {
+		instanceAttributes[i] = Attribute(VertexFormat::Float32x4, i * 4 * sizeof(float), 2 + i);
+	}
+
+	std::vector<VertexBufferLayout> bufferLayouts(key.instanced ? 2 : 1);
+	bufferLayouts[0].attributeCount = (uint32_t)vertAttributes.size();
+	bufferLayouts[0].attributes = vertAttributes.data();
+	bufferLayouts[0].arrayStride = vertStride;
+	bufferLayouts[0].stepMode = VertexStepMode::Vertex;
+	if (key.instanced) {
+		bufferLayouts[1].attributeCount = (uint32_t)instanceAttributes.size();
+		bufferLayouts[1].attributes = instanceAttributes.data();
+		bufferLayouts[1].arrayStride = packed ? sizeof(PackedInstance) : 16 * sizeof(float);
+		bufferLayouts[1].stepMode = VertexStepMode::Instance;
+	}
+
+	std::string vertexEntry = key.vertices == VertexLayout::Compact ? "vs_compact" : "vs_main";
+	if (!key.instanced) vertexEntry += "_world";
+	else if (packed) vertexEntry += "_packed";
+	pipelineDesc.vertex.bufferCount = (uint32_t)bufferLayouts.size();
+	pipelineDesc.vertex.buffers = bufferLayouts.data();
+	pipelineDesc.vertex.module = module;
+	pipelineDesc.vertex.entryPoint = vertexEntry.c_str();
+	pipelineDesc.vertex.constantCount = (uint32_t)constants.size();
+	pipelineDesc.vertex.constants = constants.data();
+
+	BlendState blendState;
+	blendState.color.srcFactor = BlendFactor::SrcAlpha;
+	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha.srcFactor = BlendFactor::Zero;
+	blendState.alpha.dstFactor = BlendFactor::One;
+	blendState.alpha.operation = BlendOperation::Add;
+
+	ColorTargetState colorTarget;
+	colorTarget.format = key.colorFormat;
+	colorTarget.blend = key.blend ? &blendState : nullptr;
+	colorTarget.writeMask = ColorWriteMask::All;
+
+	FragmentState fragmentState;
+	fragmentState.module = module;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = (uint32_t)constants.size();
+	fragmentState.constants = constants.data();
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	DepthStencilState depthState = Default;
+	depthState.depthCompare = key.depthCompare;
+	depthState.depthWriteEnabled = key.depthWrite;
+	depthState.format = key.depthFormat;
+	depthState.stencilReadMask = 0;
+	depthState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = key.depthFormat == TextureFormat::Undefined ? nullptr : &depthState;
+
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	return device.createRenderPipeline(pipelineDesc);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "webgpu\webgpu.hpp"
+#include "instanceTransforms.hpp"
+#include "vertexConvert.hpp"
+
+//everything a render pipeline variant is built from. the entry points follow from the variant:
+//vs_main or vs_compact, then _packed for packed instances or _world without instances, and fs_main
+struct PipelineKey {
+	unsigned long long shader = 0; //from PipelineCache::Shader
+	VertexLayout vertices = VertexLayout::Full;
+	bool instanced = true;
+	InstanceLayout instances = InstanceLayout::Matrix;
+	bool blend = true; //source alpha over, otherwise opaque
+	bool depthWrite = true;
+	wgpu::CompareFunction depthCompare = wgpu::CompareFunction::Less;
+	wgpu::TextureFormat colorFormat = wgpu::TextureFormat::Undefined;
+	wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;
+	wgpu::PipelineLayout layout = nullptr;
+	std::vector<std::pair<std::string, double>> constants; //pipeline overridable constants, for both stages
+
+	bool operator==(const PipelineKey& other) const;
+};
+
+//shader modules keyed by a hash of their source and render pipelines keyed by PipelineKey, each created once
+//pipelines are created on a worker thread, so asking for a new variant mid frame never waits on a compile
+class PipelineCache {
+public:
+	struct Stats {
+		unsigned int shaderHits = 0;
+		unsigned int shaderMisses = 0;
+		unsigned int hits = 0;
+		unsigned int misses = 0;
+		unsigned int pending = 0; //queued or compiling right now
+		unsigned int compiled = 0;
+		double compileMs = 0.0; //shader modules and pipelines together
+		double slowestMs = 0.0;
+	};
+
+	//shader paths are relative to directory
+	PipelineCache(wgpu::Device device, const std::string& directory);
+	~PipelineCache();
+	PipelineCache(const PipelineCache&) = delete;
+	PipelineCache& operator=(const PipelineCache&) = delete;
+
+	//reads and compiles the file the first time, a different file with the same source shares the module. 0 if it can't be read
+	unsigned long long Shader(const std::string& path);
+	wgpu::ShaderModule Module(unsigned long long shader) const;
+
+	//the pipeline if it is ready, otherwise queues it for the worker and returns nullptr
+	wgpu::RenderPipeline Get(const PipelineKey& key);
+	//blocks until the pipeline is ready, for warming up before the first frame
+	wgpu::RenderPipeline Wait(const PipelineKey& key);
+
+	Stats GetStats() const;
+
+private:
+	struct KeyHash {
+		size_t operator()(const PipelineKey& key) const;
+	};
+
+	struct Entry {
+		wgpu::RenderPipeline pipeline = nullptr;
+		bool ready = false;
+	};
+
+	wgpu::Device device;
+	std::string directory;
+
+	mutable std::mutex mutex;
+	std::condition_variable wake; //worker, something was queued
+	std::condition_variable done; //Wait, something finished
+	std::unordered_map<std::string, unsigned long long> paths;
+	std::unordered_map<unsigned long long, wgpu::ShaderModule> modules;
+	std::unordered_map<PipelineKey, Entry, KeyHash> pipelines;
+	std::deque<PipelineKey> queue;
+	bool stopping = false;
+	Stats stats;
+	std::thread worker;
+
+	void WorkerLoop();
+	wgpu::RenderPipeline Create(const PipelineKey& key, wgpu::ShaderModule module);
+};
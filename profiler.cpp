@@ -0,0 +1,288 @@
+#include "profiler.hpp"
+#if RENDWGPU_PROFILE
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "imgui\imgui.h"
+using namespace wgpu;
+
+Profiler::Scope::Scope(const char* name) : name(name), start(Profiler::Get().Now()) {
+}
+
+Profiler::Scope::~Scope() {
+	Profiler& profiler = Profiler::Get();
+	double end = profiler.Now();
+	std::lock_guard<std::mutex> lock(profiler.mutex);
+	profiler.Add({ name, profiler.frame, profiler.ThreadIndex(), start, end - start });
+}
+
+Profiler& Profiler::Get() {
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler() : epoch(std::chrono::steady_clock::now()) {
+	for (GpuSlot& slot : slots) slot.owner = this;
+}
+
+Profiler::~Profiler() {
+	ReleaseGpu();
+}
+
+double Profiler::Now() const {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+int Profiler::ThreadIndex() {
+	//in order of first use, the thread that calls BeginFrame first is usually 0
+	static std::atomic<int> next = 0;
+	thread_local int index = next++;
+	return index;
+}
+
+void Profiler::Add(const Event& event) {
+	current.push_back(event);
+	AddRolling(event, false);
+}
+
+void Profiler::AddRolling(const Event& event, bool gpu) {
+	Rolling& entry = rolling[event.name];
+	entry.gpu = gpu;
+	unsigned int slot = (unsigned int)(event.frame % rollingFrames);
+	if (entry.frames[slot] != event.frame) {
+		entry.frames[slot] = event.frame;
+		entry.samples[slot] = 0.0;
+	}
+	entry.samples[slot] += event.duration / 1000.0;
+}
+
+void Profiler::BeginFrame() {
+	//picks up finished readbacks, the callbacks take the lock themselves
+	if (device) wgpuDevicePoll(device, false, nullptr);
+
+	std::string trace;
+	unsigned long long first = 0, last = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		double now = Now();
+		if (frame > 0) {
+			history.push_back({ frame, frameStart, now, std::move(current) });
+			if (history.size() > historyFrames) history.pop_front();
+			frameTimes.push_back((float)((now - frameStart) / 1000.0));
+			if (frameTimes.size() > rollingFrames) frameTimes.erase(frameTimes.begin());
+		}
+		current.clear();
+		frame++;
+		frameStart = now;
+		passCount = 0;
+		resolved = false;
+		//the gpu timings of the last frame need a few more frames to come back
+		if (!tracePath.empty() && frame > traceLast + gpuSlots + 1) {
+			trace.swap(tracePath);
+			first = traceFirst;
+			last = traceLast;
+		}
+	}
+	if (!trace.empty()) WriteTrace(trace.c_str(), first, last);
+}
+
+void Profiler::InitGpu(Device newDevice, Queue newQueue) {
+	ReleaseGpu();
+	if (!newDevice.hasFeature(FeatureName::TimestampQuery)) {
+		std::cout << "No timestamp queries on this device, the profiler only has cpu timings\n";
+		return;
+	}
+	device = newDevice;
+	queue = newQueue;
+
+	QuerySetDescriptor queryDesc;
+	queryDesc.label = "profiler timestamps";
+	queryDesc.type = QueryType::Timestamp;
+	queryDesc.count = gpuSlots * maxPasses * 2;
+	queryDesc.pipelineStatisticsCount = 0;
+	queryDesc.pipelineStatistics = nullptr;
+	querySet = device.createQuerySet(queryDesc);
+
+	//each slot's queries start 256 bytes apart, which is what resolveQuerySet wants
+	BufferDescriptor resolveDesc;
+	resolveDesc.label = "profiler resolve";
+	resolveDesc.size = (unsigned long long)gpuSlots * maxPasses * 2 * sizeof(unsigned long long);
+	resolveDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	resolveDesc.mappedAtCreation = false;
+	resolveBuffer = device.createBuffer(resolveDesc);
+	for (GpuSlot& slot : slots) {
+		BufferDescriptor readbackDesc;
+		readbackDesc.label = "profiler readback";
+		readbackDesc.size = maxPasses * 2 * sizeof(unsigned long long);
+		readbackDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+		readbackDesc.mappedAtCreation = false;
+		slot.readback = device.createBuffer(readbackDesc);
+		slot.busy = false;
+	}
+}
+
+void Profiler::ReleaseGpu() {
+	if (!querySet) return;
+	//the callbacks point at the slots
+	for (GpuSlot& slot : slots) {
+		while (slot.busy) wgpuDevicePoll(device, true, nullptr);
+		slot.readback.drop();
+		slot.readback = nullptr;
+	}
+	resolveBuffer.drop();
+	querySet.drop();
+	resolveBuffer = nullptr;
+	querySet = nullptr;
+	device = nullptr;
+	queue = nullptr;
+}
+
+unsigned int Profiler::NextQueries(const char* name) {
+	GpuSlot& slot = slots[frame % gpuSlots];
+	//still reading back the frame that used this slot last time, this frame goes without
+	if (!querySet || slot.busy || passCount == maxPasses) return ~0u;
+	slot.names[passCount] = name;
+	unsigned int first = (unsigned int)(frame % gpuSlots) * maxPasses * 2 + passCount * 2;
+	passCount++;
+	return first;
+}
+
+std::span<const WGPURenderPassTimestampWrite> Profiler::RenderPass(const char* name) {
+	unsigned int pass = passCount;
+	unsigned int first = NextQueries(name);
+	if (first == ~0u) return {};
+	WGPURenderPassTimestampWrite* writes = renderWrites[pass];
+	writes[0] = { querySet, first, WGPURenderPassTimestampLocation_Beginning };
+	writes[1] = { querySet, first + 1, WGPURenderPassTimestampLocation_End };
+	return { writes, 2 };
+}
+
+std::span<const WGPUComputePassTimestampWrite> Profiler::ComputePass(const char* name) {
+	unsigned int pass = passCount;
+	unsigned int first = NextQueries(name);
+	if (first == ~0u) return {};
+	WGPUComputePassTimestampWrite* writes = computeWrites[pass];
+	writes[0] = { querySet, first, WGPUComputePassTimestampLocation_Beginning };
+	writes[1] = { querySet, first + 1, WGPUComputePassTimestampLocation_End };
+	return { writes, 2 };
+}
+
+void Profiler::ResolveGpu(CommandEncoder& encoder) {
+	GpuSlot& slot = slots[frame % gpuSlots];
+	if (!querySet || passCount == 0 || slot.busy) return;
+	unsigned int first = (unsigned int)(frame % gpuSlots) * maxPasses * 2;
+	unsigned long long bytes = (unsigned long long)passCount * 2 * sizeof(unsigned long long);
+	encoder.resolveQuerySet(querySet, first, passCount * 2, resolveBuffer, first * sizeof(unsigned long long));
+	encoder.copyBufferToBuffer(resolveBuffer, first * sizeof(unsigned long long), slot.readback, 0, bytes);
+	slot.busy = true;
+	slot.frame = frame;
+	slot.passCount = passCount;
+	resolved = true;
+}
+
+void Profiler::GpuSubmitted() {
+	if (!resolved) return;
+	resolved = false;
+	GpuSlot& slot = slots[frame % gpuSlots];
+	wgpuBufferMapAsync(slot.readback, WGPUMapMode_Read, 0, (size_t)slot.passCount * 2 * sizeof(unsigned long long), OnReadback, &slot);
+}
+
+void Profiler::OnReadback(WGPUBufferMapAsyncStatus status, void* userData) {
+	GpuSlot& slot = *reinterpret_cast<GpuSlot*>(userData);
+	Profiler& profiler = *slot.owner;
+	if (status == WGPUBufferMapAsyncStatus_Success) {
+		size_t bytes = (size_t)slot.passCount * 2 * sizeof(unsigned long long);
+		const unsigned long long* ticks = (const unsigned long long*)slot.readback.getConstMappedRange(0, bytes);
+		std::lock_guard<std::mutex> lock(profiler.mutex);
+		//gpu and cpu clocks aren't related, the frame's first pass is put at the start of its cpu frame
+		auto record = std::find_if(profiler.history.begin(), profiler.history.end(), [&](const FrameRecord& r) { return r.index == slot.frame; });
+		double frameStart = record != profiler.history.end() ? record->start : profiler.frameStart;
+		unsigned long long origin = ticks[0];
+		for (unsigned int p = 0; p < slot.passCount; p++) {
+			//timestamps are nanoseconds, a pass the gpu reordered or that overflowed is dropped
+			unsigned long long begin = ticks[p * 2], end = ticks[p * 2 + 1];
+			if (end < begin || begin < origin) continue;
+			Event event = { slot.names[p], slot.frame, -1, frameStart + (begin - origin) / 1000.0, (end - begin) / 1000.0 };
+			if (record != profiler.history.end()) record->events.push_back(event);
+			else if (slot.frame == profiler.frame) profiler.current.push_back(event);
+			profiler.AddRolling(event, true);
+		}
+		slot.readback.unmap();
+	}
+	slot.busy = false;
+}
+
+void Profiler::DrawPanel() {
+	std::lock_guard<std::mutex> lock(mutex);
+	ImGui::Begin("Profiler");
+	if (!frameTimes.empty()) {
+		float slowest = *std::max_element(frameTimes.begin(), frameTimes.end());
+		ImGui::PlotLines("Frame ms", frameTimes.data(), (int)frameTimes.size(), 0, nullptr, 0.f, std::max(slowest, 16.7f), ImVec2(0, 60));
+	}
+	ImGui::Text("%s", GpuEnabled() ? "gpu timestamps on" : "gpu timestamps unavailable");
+
+	//sorted so the list doesn't jump around
+	std::vector<std::pair<const std::string*, const Rolling*>> entries;
+	for (auto& [name, entry] : rolling) entries.emplace_back(&name, &entry);
+	std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.second->gpu != b.second->gpu ? !a.second->gpu : *a.first < *b.first; });
+	for (auto& [name, entry] : entries) {
+		double sum = 0.0, worst = 0.0;
+		int count = 0;
+		for (unsigned int i = 0; i < rollingFrames; i++) {
+			if (entry->frames[i] == 0 || frame - entry->frames[i] > rollingFrames) continue;
+			sum += entry->samples[i];
+			worst = std::max(worst, entry->samples[i]);
+			count++;
+		}
+		if (count == 0) continue;
+		ImGui::Text("%s %-24s %7.3f ms avg %7.3f ms max", entry->gpu ? "gpu" : "cpu", name->c_str(), sum / count, worst);
+	}
+
+	if (ImGui::Button("Save trace of the last 300 frames") && frame > 1) {
+		//written from BeginFrame once the gpu timings are in
+		tracePath = "trace.json";
+		traceFirst = frame > 300 ? frame - 300 : 1;
+		traceLast = frame - 1;
+	}
+	ImGui::End();
+}
+
+void Profiler::RequestTrace(const std::string& path, unsigned long long first, unsigned long long last) {
+	std::lock_guard<std::mutex> lock(mutex);
+	tracePath = path;
+	traceFirst = first;
+	traceLast = last;
+}
+
+bool Profiler::WriteTrace(const char* path, unsigned long long first, unsigned long long last) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::ofstream out(path);
+	if (!out) {
+		std::cout << "Could not write trace " << path << "\n";
+		return false;
+	}
+	//microseconds to the nanosecond, the default 6 significant digits lose sub millisecond scopes once a run is long
+	out << std::fixed << std::setprecision(3);
+	//gpu events get their own track, frames another so they're easy to find
+	const int gpuTrack = 1000, frameTrack = 1001;
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << gpuTrack << ",\"args\":{\"name\":\"gpu\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << frameTrack << ",\"args\":{\"name\":\"frames\"}}";
+	size_t written = 0;
+	for (const FrameRecord& record : history) {
+		if (record.index < first || record.index > last) continue;
+		out << ",\n{\"name\":\"frame " << record.index << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << frameTrack
+			<< ",\"ts\":" << record.start << ",\"dur\":" << record.end - record.start << "}";
+		for (const Event& event : record.events) {
+			out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.thread < 0 ? gpuTrack : event.thread)
+				<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration << ",\"args\":{\"frame\":" << event.frame << "}}";
+		}
+		written++;
+	}
+	out << "\n]}\n";
+	std::cout << "Wrote " << written << " frames of trace to " << path << "\n";
+	return (bool)out;
+}
+#endif
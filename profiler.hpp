@@ -0,0 +1,130 @@
+#pragma once
+//cpu scopes and gpu pass timings for the last few hundred frames, shown in an imgui panel and exportable as a chrome trace
+//set RENDWGPU_PROFILE to 0 and the macros below expand to nothing and profiler.cpp compiles to an empty file
+#ifndef RENDWGPU_PROFILE
+#define RENDWGPU_PROFILE 1
+#endif
+
+#if RENDWGPU_PROFILE
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "webgpu\webgpu.hpp"
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+//times the rest of the enclosing block, name has to outlive the profiler (a string literal)
+#define PROFILE_SCOPE(name) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_FRAME() Profiler::Get().BeginFrame()
+
+class Profiler {
+public:
+	struct Scope {
+		Scope(const char* name);
+		~Scope();
+		const char* name;
+		double start;
+	};
+
+	struct Event {
+		const char* name;
+		unsigned long long frame;
+		int thread; //-1 for the gpu
+		double start; //microseconds since the profiler started, gpu events are lined up with the start of their frame
+		double duration;
+	};
+
+	static Profiler& Get();
+
+	//closes the last frame and starts the next one, also picks up gpu timings that have been read back
+	void BeginFrame();
+	unsigned long long Frame() const { return frame; }
+
+	//gpu timestamps need the device to have TimestampQuery, without it the pass functions return nothing
+	void InitGpu(wgpu::Device device, wgpu::Queue queue);
+	void ReleaseGpu();
+	bool GpuEnabled() const { return querySet != nullptr; }
+	//the beginning and end writes for one pass of this frame, to put straight into the pass descriptor
+	std::span<const WGPURenderPassTimestampWrite> RenderPass(const char* name);
+	std::span<const WGPUComputePassTimestampWrite> ComputePass(const char* name);
+	//resolves this frame's queries into a readback buffer, last thing in the frame's last encoder
+	void ResolveGpu(wgpu::CommandEncoder& encoder);
+	//after that encoder was submitted, starts the readback
+	void GpuSubmitted();
+
+	//rolling per scope averages over the last frames and the frame time graph
+	void DrawPanel();
+	//frames [first, last] that are still in the history as chrome trace event json (chrome://tracing, perfetto)
+	bool WriteTrace(const char* path, unsigned long long first, unsigned long long last) const;
+	//writes the trace once frame last (and its gpu timings) are done
+	void RequestTrace(const std::string& path, unsigned long long first, unsigned long long last);
+
+private:
+	static const unsigned int historyFrames = 600;
+	static const unsigned int rollingFrames = 120;
+	static const unsigned int maxPasses = 16; //per frame
+	static const unsigned int gpuSlots = 3; //frames of timestamps in flight
+
+	struct FrameRecord {
+		unsigned long long index;
+		double start;
+		double end;
+		std::vector<Event> events;
+	};
+
+	struct Rolling {
+		double samples[rollingFrames] = {};
+		unsigned long long frames[rollingFrames] = {}; //which frame each sample belongs to, so gpu samples arriving late land in the right place
+		bool gpu = false;
+	};
+
+	struct GpuSlot {
+		Profiler* owner = nullptr;
+		wgpu::Buffer readback = nullptr;
+		bool busy = false; //copied into or mapping
+		unsigned long long frame = 0;
+		unsigned int passCount = 0;
+		const char* names[maxPasses] = {};
+	};
+
+	Profiler();
+	~Profiler();
+
+	std::chrono::steady_clock::time_point epoch;
+	mutable std::mutex mutex;
+	unsigned long long frame = 0;
+	double frameStart = 0.0;
+	std::vector<Event> current;
+	std::deque<FrameRecord> history;
+	std::unordered_map<std::string, Rolling> rolling;
+	std::vector<float> frameTimes; //ms, for the graph
+	std::string tracePath;
+	unsigned long long traceFirst = 0;
+	unsigned long long traceLast = 0;
+
+	wgpu::Device device = nullptr;
+	wgpu::Queue queue = nullptr;
+	wgpu::QuerySet querySet = nullptr;
+	wgpu::Buffer resolveBuffer = nullptr;
+	GpuSlot slots[gpuSlots];
+	unsigned int passCount = 0; //this frame
+	bool resolved = false; //this frame
+	WGPURenderPassTimestampWrite renderWrites[maxPasses][2];
+	WGPUComputePassTimestampWrite computeWrites[maxPasses][2];
+
+	double Now() const;
+	int ThreadIndex();
+	void Add(const Event& event); //caller holds the lock
+	void AddRolling(const Event& event, bool gpu); //caller holds the lock
+	unsigned int NextQueries(const char* name); //first of the pass's two queries, or ~0u
+	static void OnReadback(WGPUBufferMapAsyncStatus status, void* userData);
+};
+
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FRAME()
+#endif
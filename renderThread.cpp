@@ -0,0 +1,102 @@
+#include "renderThread.hpp"
+#include "webgpu\wgpu.h"
+#include "profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+using namespace wgpu;
+
+namespace {
+	double MsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+RenderThread::RenderThread(Device device, Queue queue, unsigned int framesInFlight)
+	: device(device), queue(queue), framesInFlight(std::clamp(framesInFlight, 1u, 3u)) {
+	thread = std::thread(&RenderThread::Loop, this);
+}
+
+RenderThread::~RenderThread() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	thread.join();
+	//the callbacks point at this
+	WaitInFlight(0);
+}
+
+void RenderThread::Submit(std::function<void()> frame) {
+	auto start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(mutex);
+	taken.wait(lock, [this] { return !pending; });
+	stats.submitWaitMs = MsSince(start);
+	pending = std::move(frame);
+	wake.notify_one();
+}
+
+void RenderThread::WaitIdle() {
+	std::unique_lock<std::mutex> lock(mutex);
+	taken.wait(lock, [this] { return !pending && !busy; });
+}
+
+void RenderThread::Fence() {
+	inFlight++;
+	wgpuQueueOnSubmittedWorkDone(queue, OnWorkDone, this);
+}
+
+void RenderThread::WaitGpu() {
+	WaitIdle();
+	WaitInFlight(0);
+}
+
+RenderThread::Stats RenderThread::GetStats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	Stats copy = stats;
+	copy.inFlight = inFlight;
+	return copy;
+}
+
+void RenderThread::Loop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || pending; });
+		//stopping still runs whatever was submitted before it
+		if (!pending) return;
+		std::function<void()> frame = std::move(pending);
+		pending = nullptr;
+		busy = true;
+		taken.notify_all();
+		lock.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		{
+			PROFILE_SCOPE("wait for gpu");
+			WaitInFlight(framesInFlight - 1);
+		}
+		double gpuWait = MsSince(start);
+		frame();
+
+		lock.lock();
+		busy = false;
+		stats.frames++;
+		stats.gpuWaitMs = gpuWait;
+		taken.notify_all();
+	}
+}
+
+void RenderThread::WaitInFlight(unsigned int most) {
+	//a blocking poll waits for the newest submission rather than the oldest, so poll without waiting and sleep in between
+	while (inFlight > most) {
+		wgpuDevicePoll(device, false, nullptr);
+		if (inFlight > most) std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+}
+
+void RenderThread::OnWorkDone(WGPUQueueWorkDoneStatus status, void* userData) {
+	RenderThread& renderThread = *reinterpret_cast<RenderThread*>(userData);
+	if (status != WGPUQueueWorkDoneStatus_Success) std::cout << "Submitted work finished with status " << status << "\n";
+	renderThread.inFlight--;
+}
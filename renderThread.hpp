@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "webgpu\webgpu.hpp"
+
+//encodes, submits and presents frames on its own thread while the main thread builds the next one.
+//a frame is a function that owns its frame packet, it runs once at most framesInFlight - 1 earlier submissions
+//are still on the gpu, so the cpu, the render thread and the gpu each work on a different frame
+class RenderThread {
+public:
+	struct Stats {
+		unsigned long long frames = 0;
+		double submitWaitMs = 0.0; //last frame, main thread waiting for the render thread to take the previous one
+		double gpuWaitMs = 0.0; //last frame, render thread waiting for a frame in flight to finish
+		unsigned int inFlight = 0;
+	};
+
+	//framesInFlight is clamped to [1, 3], 1 waits for the gpu every frame like a serial loop
+	RenderThread(wgpu::Device device, wgpu::Queue queue, unsigned int framesInFlight = 2);
+	//runs what was submitted and waits for the gpu to finish it
+	~RenderThread();
+	RenderThread(const RenderThread&) = delete;
+	RenderThread& operator=(const RenderThread&) = delete;
+
+	//hands a frame to the render thread, waits while the one before it hasn't been picked up yet
+	void Submit(std::function<void()> frame);
+	//until every submitted frame has been encoded and submitted, the gpu may still be working on them.
+	//anything the frames read besides their packet (mesh pool, cell bundles, models) can only change after this
+	void WaitIdle();
+	//called by the frame right after its queue.submit, fences that submission with onSubmittedWorkDone
+	void Fence();
+	//WaitIdle and then until the gpu finished every fenced submission
+	void WaitGpu();
+
+	unsigned int FramesInFlight() const { return framesInFlight; }
+	Stats GetStats() const;
+
+private:
+	wgpu::Device device;
+	wgpu::Queue queue;
+	unsigned int framesInFlight;
+
+	mutable std::mutex mutex;
+	std::condition_variable wake; //render thread, a frame was submitted
+	std::condition_variable taken; //main thread, the pending frame was picked up or finished
+	std::function<void()> pending;
+	bool busy = false;
+	bool stopping = false;
+	std::atomic<unsigned int> inFlight = 0;
+	Stats stats;
+	std::thread thread;
+
+	void Loop();
+	//polls the device until at most most fenced submissions are unfinished
+	void WaitInFlight(unsigned int most);
+	static void OnWorkDone(WGPUQueueWorkDoneStatus status, void* userData);
+};
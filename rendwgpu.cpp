@@ -21,22 +21,43 @@ using glm::mat4;
 #include "imgui\backends\imgui_impl_glfw.h"
 
 
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 
 #include "model.hpp"
+#include "modelRegistry.hpp"
+#include "pipelineCache.hpp"
+#include "cellBundles.hpp"
+#include "terrain.hpp"
+#include "gpuCull.hpp"
+#include "instanceTransforms.hpp"
+#include "threadPool.hpp"
+#include "uploadRing.hpp"
+#include "renderThread.hpp"
+#include "profiler.hpp"
 #include "wgpuUtil.hpp"
+#include "rendwgpu.hpp"
+#include "benchmarks.hpp"
+#include "WorldStreamer.h"
+#include "FixtureBvh.h"
 
 using namespace std;
 using namespace wgpu;
 
-struct Uniforms {
-	mat4 proj;
-	mat4 view;
-	float time;
-	float rotationSpeed;
-	float padding[2];
-};
+void ExtractFrustum(const mat4& viewProj, glm::vec4 planes[6]) {
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; r++) rows[r] = glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]);
+	planes[0] = rows[3] + rows[0]; //left
+	planes[1] = rows[3] - rows[0]; //right
+	planes[2] = rows[3] + rows[1]; //bottom
+	planes[3] = rows[3] - rows[1]; //top
+	planes[4] = rows[3] + rows[2]; //near
+	planes[5] = rows[3] - rows[2]; //far
+	for (int i = 0; i < 6; i++) planes[i] /= glm::length(glm::vec3(planes[i]));
+}
 
 WGPUAdapter requestAdapter(WGPUInstance instance, WGPURequestAdapterOptions const* options) {
 	// A simple structure holding the local information shared with the
@@ -113,75 +134,7 @@ WGPUDevice requestDevice(WGPUAdapter adapter, WGPUDeviceDescriptor const* descri
 	return userData.device;
 }
 
-ShaderModule CreateShader(Device& device, const char* path) {
-	ShaderModuleDescriptor shaderDescriptor;
-	shaderDescriptor.hintCount = 0;
-	shaderDescriptor.hints = nullptr;
-	ShaderModuleWGSLDescriptor shaderCodeDescriptor;
-	shaderCodeDescriptor.chain.next = nullptr;
-	shaderCodeDescriptor.chain.sType = SType::ShaderModuleWGSLDescriptor;
-
-	ifstream shaderFileStream;
-	shaderFileStream.open(path);
-	shaderFileStream.seekg(0, std::ios_base::end);
-	int shaderTextLength = (int)shaderFileStream.tellg();
-	shaderFileStream.seekg(0);
-	std::vector<char> shaderText(shaderTextLength);
-	shaderFileStream.read(shaderText.data(), shaderTextLength);
-	shaderFileStream.close();
-	shaderCodeDescriptor.code = shaderText.data();
-	shaderDescriptor.nextInChain = &shaderCodeDescriptor.chain;
-	return device.createShaderModule(shaderDescriptor);
-}
-
-SwapChainDescriptor DescribeSwapChain(int width, int height, TextureFormat format) {
-	SwapChainDescriptor swapChainDescriptor;
-	swapChainDescriptor.width = width;
-	swapChainDescriptor.height = height;
-	swapChainDescriptor.format = format;
-	swapChainDescriptor.usage = WGPUTextureUsage_RenderAttachment;
-	swapChainDescriptor.presentMode = WGPUPresentMode_Mailbox;
-	return swapChainDescriptor;
-}
-
-
-int main()
-{
-	unsigned int windowWidth = 1920;
-	unsigned int windowHeight = 1080;
-	int instanceCount = 64;
-
-
-	cout << "TEST SIZE OF UNIFORMS " << sizeof(Uniforms) << endl;
-
-	glfwInit();
-	if (!glfwInit()) {
-		std::cerr << "Could not initialize GLFW!" << std::endl;
-		return 1;
-	}
-
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "render", NULL, NULL);
-	if (!window) {
-		std::cerr << "Could not open window!" << std::endl;
-		glfwTerminate();
-		return 1;
-	}
-
-
-	//INSTANCE
-	Instance instance = wgpu::createInstance(InstanceDescriptor());
-
-
-	Surface surface = glfwGetWGPUSurface(instance, window);
-	 
-	//ADAPTER
-	RequestAdapterOptions adapterOptions;
-	adapterOptions.compatibleSurface = surface;
-	Adapter adapter = instance.requestAdapter(adapterOptions);
-	
-	//DEVICE
+Device CreateDevice(Adapter& adapter) {
 	SupportedLimits adapterLimits;
 	adapter.getLimits(&adapterLimits);
 
@@ -245,11 +198,17 @@ int main()
 	DeviceDescriptor deviceDescriptor;
 	deviceDescriptor.label = "Default Device";
 	deviceDescriptor.requiredFeaturesCount = 0;
+#if RENDWGPU_PROFILE
+	//gpu pass timings for the profiler, everything else works without it
+	WGPUFeatureName timestamps = WGPUFeatureName_TimestampQuery;
+	if (adapter.hasFeature(FeatureName::TimestampQuery)) {
+		deviceDescriptor.requiredFeaturesCount = 1;
+		deviceDescriptor.requiredFeatures = &timestamps;
+	}
+#endif
 	deviceDescriptor.requiredLimits = &deviceReqs;
 	deviceDescriptor.defaultQueue.label = "Default Queue";
 	Device device = adapter.requestDevice(deviceDescriptor);
-
-	Util::ListLimits(device);
 	
 	//TODO figure out what this means
 	auto onDeviceError = [](WGPUErrorType type, char const* message, void* /* pUserData */) {
@@ -258,60 +217,177 @@ int main()
 		std::cout << std::endl;
 	};
 	wgpuDeviceSetUncapturedErrorCallback(device, onDeviceError, nullptr /* pUserData */);
+	return device;
+}
 
-	
-	//SWAPCHAIN
-	TextureFormat swapChainFormat = wgpuSurfaceGetPreferredFormat(surface, adapter);
-	SwapChain swapChain = device.createSwapChain(surface, DescribeSwapChain(windowWidth, windowHeight, swapChainFormat));
-	
-	
-	Queue queue = device.getQueue();
+SwapChainDescriptor DescribeSwapChain(int width, int height, TextureFormat format, PresentMode presentMode) {
+	SwapChainDescriptor swapChainDescriptor;
+	swapChainDescriptor.width = width;
+	swapChainDescriptor.height = height;
+	swapChainDescriptor.format = format;
+	swapChainDescriptor.usage = WGPUTextureUsage_RenderAttachment;
+	swapChainDescriptor.presentMode = presentMode;
+	return swapChainDescriptor;
+}
+
+//fifo is vsync and the only one every surface has, mailbox and immediate don't wait for it
+static const PresentMode presentModes[] = { PresentMode::Fifo, PresentMode::Mailbox, PresentMode::Immediate };
+static const char* presentModeNames[] = { "fifo", "mailbox", "immediate" };
+
+//a copy of imgui's draw data, the main thread starts on the next imgui frame while the render thread draws this one
+struct ImGuiSnapshot {
+	ImDrawData data;
+	std::vector<ImDrawList*> lists;
 
+	ImGuiSnapshot() = default;
+	ImGuiSnapshot(const ImGuiSnapshot&) = delete;
+	ImGuiSnapshot& operator=(const ImGuiSnapshot&) = delete;
+	~ImGuiSnapshot() {
+		for (ImDrawList* list : lists) IM_DELETE(list);
+	}
+
+	void Take(const ImDrawData* source) {
+		for (ImDrawList* list : lists) IM_DELETE(list);
+		lists.clear();
+		data = *source;
+		for (int i = 0; i < source->CmdListsCount; i++) lists.push_back(source->CmdLists[i]->CloneOutput());
+#if IMGUI_VERSION_NUM >= 18980
+		data.CmdLists.resize(0);
+		for (ImDrawList* list : lists) data.CmdLists.push_back(list);
+#else
+		data.CmdLists = lists.data();
+#endif
+	}
+};
+
+//everything the render thread needs from one main thread frame
+struct FramePacket {
+	Uniforms uniforms;
+	bool cullChanged = false; //new instances and draws for the culler, otherwise it only resets the visible counts
+	std::vector<float> instances;
+	std::vector<GpuCuller::Draw> cullDraws;
+	PresentMode presentMode = PresentMode::Fifo;
+	TerrainRenderer::Selection terrain;
+	ImGuiSnapshot ui;
+};
+
+
+//models generate at most this many, see model.cpp
+static const int maxDrawLods = 8;
+
+std::string ShaderDirectory() {
+	return std::filesystem::exists("defaultshader.wgsl") ? "." : "E:/Anna/Anna/Visual Studio/rendwgpu";
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int windowWidth = 1920;
+	unsigned int windowHeight = 1080;
+	int instanceCount = 64;
+	const int drawModelCount = 2;
+
+	//headless modes, see benchmarks.hpp
+	if (argc >= 2 && strcmp(argv[1], "--bench-instances") == 0) return BenchmarkInstances(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--bench-render") == 0) return BenchmarkRender(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--bench-record") == 0) return BenchmarkRecord(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--bench-bvh") == 0) return BenchmarkBvh(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--bench-fixtures") == 0) return BenchmarkFixtures(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--bench-world") == 0) return BenchmarkWorld(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--bench-vertices") == 0) return BenchmarkVertices(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--test-allocator") == 0) return TestAllocator(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--test-cull") == 0) return TestCull(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--test-rotations") == 0) return TestRotations(argc, argv);
+
+	//which world layers hold what, --layers <layer:kind,...> anywhere after --world or --cook-world, Eso::DefaultLayers otherwise
+	std::vector<std::pair<unsigned int, Eso::CellKind>> worldLayers;
+	Eso::ParseLayers(Eso::DefaultLayers, worldLayers);
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--layers") == 0 && !Eso::ParseLayers(argv[i + 1], worldLayers)) {
+			std::cerr << "Could not parse --layers " << argv[i + 1] << ", expected layer:kind pairs like " << Eso::DefaultLayers << "\n";
+			return 1;
+		}
+	}
+
+	//offline cook, --cook-world <world directory> <world id> <output archive>
+	if (argc >= 5 && strcmp(argv[1], "--cook-world") == 0) {
+		return Eso::WorldArchive::Cook(argv[2], (unsigned int)strtoul(argv[3], nullptr, 0), worldLayers, argv[4]) ? 0 : 1;
+	}
+
+	//--present fifo|mailbox|immediate, --frames-in-flight 1 to 3
+	int presentModeIndex = 1;
+	unsigned int framesInFlight = 2;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--present") == 0) {
+			for (int m = 0; m < 3; m++) {
+				if (strcmp(argv[i + 1], presentModeNames[m]) == 0) presentModeIndex = m;
+			}
+		}
+		if (strcmp(argv[i], "--frames-in-flight") == 0) framesInFlight = std::clamp((unsigned int)strtoul(argv[i + 1], nullptr, 0), 1u, 3u);
+	}
+
+
+	cout << "TEST SIZE OF UNIFORMS " << sizeof(Uniforms) << endl;
+
+	glfwInit();
+	if (!glfwInit()) {
+		std::cerr << "Could not initialize GLFW!" << std::endl;
+		return 1;
+	}
 
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "render", NULL, NULL);
+	if (!window) {
+		std::cerr << "Could not open window!" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
 
-	//shader
-	ShaderModule shader = CreateShader(device, "E:/Anna/Anna/Visual Studio/rendwgpu/defaultshader.wgsl");
 
-	//render pipeline object
-	RenderPipelineDescriptor pipelineDescriptor;
+	//INSTANCE
+	Instance instance = wgpu::createInstance(InstanceDescriptor());
 
 
-	pipelineDescriptor.primitive.topology = PrimitiveTopology::TriangleList;
-	pipelineDescriptor.primitive.stripIndexFormat = IndexFormat::Undefined;
-	pipelineDescriptor.primitive.frontFace = FrontFace::CW;
-	pipelineDescriptor.primitive.cullMode = CullMode::Back;
+	Surface surface = glfwGetWGPUSurface(instance, window);
+	 
+	//ADAPTER
+	RequestAdapterOptions adapterOptions;
+	adapterOptions.compatibleSurface = surface;
+	//--software picks the fallback adapter (lavapipe, warp), slow but runs anywhere
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--software") == 0) adapterOptions.forceFallbackAdapter = true;
+	}
+	Adapter adapter = instance.requestAdapter(adapterOptions);
+	
+	//DEVICE
+	Device device = CreateDevice(adapter);
 
-	BlendState blendState;
-	blendState.color.srcFactor = BlendFactor::SrcAlpha;
-	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
-	blendState.color.operation = BlendOperation::Add;
-	blendState.alpha.srcFactor = BlendFactor::Zero;
-	blendState.alpha.dstFactor = BlendFactor::One;
-	blendState.alpha.operation = BlendOperation::Add;
+	Util::ListLimits(device);
 
 	
-	ColorTargetState colorTarget;
-	colorTarget.format = swapChainFormat;
-	colorTarget.blend = &blendState;
-	colorTarget.writeMask = ColorWriteMask::All;
+	//SWAPCHAIN
+	TextureFormat swapChainFormat = wgpuSurfaceGetPreferredFormat(surface, adapter);
+	PresentMode presentMode = presentModes[presentModeIndex]; //what the swap chain was made with, only the render thread changes it after this
+	SwapChain swapChain = device.createSwapChain(surface, DescribeSwapChain(windowWidth, windowHeight, swapChainFormat, presentMode));
 	
-	FragmentState fragmentState;
-	fragmentState.module = shader;
-	fragmentState.entryPoint = "fs_main";
-	fragmentState.constantCount = 0;
-	fragmentState.constants = nullptr;
-	fragmentState.targetCount = 1;
-	fragmentState.targets = &colorTarget;
-	pipelineDescriptor.fragment = &fragmentState;
 	
+	Queue queue = device.getQueue();
+#if RENDWGPU_PROFILE
+	Profiler::Get().InitGpu(device, queue);
+	//--trace <path> <first frame> <last frame>, writes a chrome trace of those frames and keeps running
+	for (int i = 1; i + 3 < argc; i++) {
+		if (strcmp(argv[i], "--trace") == 0) {
+			Profiler::Get().RequestTrace(argv[i + 1], strtoull(argv[i + 2], nullptr, 0), strtoull(argv[i + 3], nullptr, 0));
+		}
+	}
+#endif
+
+
+
+	//shaders and pipeline variants
+	PipelineCache pipelines(device, ShaderDirectory());
+	unsigned long long defaultShader = pipelines.Shader("defaultshader.wgsl");
 	TextureFormat depthTextureFormat = TextureFormat::Depth24Plus;
-	DepthStencilState depthState = Default;
-	depthState.depthCompare = CompareFunction::Less;
-	depthState.depthWriteEnabled = true;
-	depthState.format = depthTextureFormat;
-	depthState.stencilReadMask = 0;
-	depthState.stencilWriteMask = 0;
-	pipelineDescriptor.depthStencil = &depthState;
 	
 
 	// Create the depth texture
@@ -340,74 +416,8 @@ int main()
 	std::cout << depthTextureViewDesc.format << endl;
 
 
-	pipelineDescriptor.multisample.count = 1;
-	pipelineDescriptor.multisample.mask = ~0u;
-	pipelineDescriptor.multisample.alphaToCoverageEnabled = false;
-
-
-
-	
-	//Model model("F:\\Extracted\\ESO\\sfpts\\model\\1520043.gr2", device, queue); //elstemple
-
-	//vertex buffer layouts
-	vector<VertexBufferLayout> vertexBufferLayouts(2);
-	vector<VertexAttribute> vertexBufferAttributes(2);
-
-	//position
-	vertexBufferAttributes[0].shaderLocation = 0;
-	vertexBufferAttributes[0].offset = 0;
-	vertexBufferAttributes[0].format = VertexFormat::Float32x3;
-	//color
-	vertexBufferAttributes[1].shaderLocation = 1;
-	vertexBufferAttributes[1].offset = 4 * sizeof(float);
-	vertexBufferAttributes[1].format = VertexFormat::Float32x3;
-	//vert buffer layout
-	vertexBufferLayouts[0].attributeCount = static_cast<uint32_t>(vertexBufferAttributes.size());
-	vertexBufferLayouts[0].attributes = vertexBufferAttributes.data();
-	vertexBufferLayouts[0].arrayStride = 32;
-	vertexBufferLayouts[0].stepMode = VertexStepMode::Vertex;
-
-
-	
-
-
-	//create instance vert buffer
-	BufferDescriptor instanceVertBufferDesc;
-	instanceVertBufferDesc.size = instanceCount * sizeof(mat4);
-	instanceVertBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-	instanceVertBufferDesc.mappedAtCreation = false;
-	instanceVertBufferDesc.label = "instance vert buffer";
-	Buffer instanceVertBuffer = device.createBuffer(instanceVertBufferDesc);
-
-	vector<VertexAttribute> instancePosVertAttribute(4);
-	//model matrix
-	instancePosVertAttribute[0].shaderLocation = 2;
-	instancePosVertAttribute[0].offset = 0;
-	instancePosVertAttribute[0].format = VertexFormat::Float32x4;
-	instancePosVertAttribute[1].shaderLocation = 3;
-	instancePosVertAttribute[1].offset = 4 * sizeof(float);
-	instancePosVertAttribute[1].format = VertexFormat::Float32x4;
-	instancePosVertAttribute[2].shaderLocation = 4;
-	instancePosVertAttribute[2].offset = 8 * sizeof(float);
-	instancePosVertAttribute[2].format = VertexFormat::Float32x4;
-	instancePosVertAttribute[3].shaderLocation = 5;
-	instancePosVertAttribute[3].offset = 12 * sizeof(float);
-	instancePosVertAttribute[3].format = VertexFormat::Float32x4;
-	//intance buffer layout
-	vertexBufferLayouts[1].attributeCount = static_cast<uint32_t>(instancePosVertAttribute.size());
-	vertexBufferLayouts[1].attributes = instancePosVertAttribute.data();
-	vertexBufferLayouts[1].arrayStride = sizeof(mat4);
-	vertexBufferLayouts[1].stepMode = VertexStepMode::Instance;
-
-
-
-
-	pipelineDescriptor.vertex.bufferCount = static_cast<uint32_t>(vertexBufferLayouts.size());
-	pipelineDescriptor.vertex.buffers = vertexBufferLayouts.data();
-	pipelineDescriptor.vertex.module = shader;
-	pipelineDescriptor.vertex.entryPoint = "vs_main";
-	pipelineDescriptor.vertex.constantCount = 0;
-	pipelineDescriptor.vertex.constants = nullptr;
+	//matrices take 64 bytes an instance, PackedInstance 32
+	InstanceLayout instanceLayout = InstanceLayout::Packed;
 
 
 	//UNIFORMS
@@ -415,7 +425,7 @@ int main()
 	std::vector<BindGroupLayoutEntry> uniformLayoutEntries(bindingCount, Default);
 	//global uniform layout
 	uniformLayoutEntries[0].binding = 0;
-	uniformLayoutEntries[0].visibility = ShaderStage::Vertex;
+	uniformLayoutEntries[0].visibility = ShaderStage::Vertex | ShaderStage::Compute; //compute for the frustum in cull.wgsl
 	uniformLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
 	uniformLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
 	//bindgroup layout
@@ -455,16 +465,54 @@ int main()
 	layoutDesc.bindGroupLayoutCount = 1;
 	layoutDesc.bindGroupLayouts = &(WGPUBindGroupLayout)uniformLayout;
 	PipelineLayout layout = device.createPipelineLayout(layoutDesc);
-	pipelineDescriptor.layout = layout;
-	//pipelineDescriptor.layout = nullptr;
 
-	RenderPipeline pipeline = device.createRenderPipeline(pipelineDescriptor);
 
+	//compact vertex layout, same as above plus the mesh bounds at group 1
+	BindGroupLayoutEntry boundsLayoutEntry = Default;
+	boundsLayoutEntry.binding = 0;
+	boundsLayoutEntry.visibility = ShaderStage::Vertex;
+	boundsLayoutEntry.buffer.type = BufferBindingType::Uniform;
+	boundsLayoutEntry.buffer.minBindingSize = 8 * sizeof(float);
+	BindGroupLayoutDescriptor boundsLayoutDesc;
+	boundsLayoutDesc.entryCount = 1;
+	boundsLayoutDesc.entries = &boundsLayoutEntry;
+	BindGroupLayout boundsLayout = device.createBindGroupLayout(boundsLayoutDesc);
+
+
+	vector<WGPUBindGroupLayout> compactGroupLayouts = { uniformLayout, boundsLayout };
+	PipelineLayoutDescriptor compactLayoutDesc;
+	compactLayoutDesc.bindGroupLayoutCount = static_cast<uint32_t>(compactGroupLayouts.size());
+	compactLayoutDesc.bindGroupLayouts = compactGroupLayouts.data();
+	PipelineLayout compactLayout = device.createPipelineLayout(compactLayoutDesc);
+
+
+	//both vertex layouts, built up front so the first frame has them
+	PipelineKey pipelineKey;
+	pipelineKey.shader = defaultShader;
+	pipelineKey.instances = instanceLayout;
+	pipelineKey.colorFormat = swapChainFormat;
+	pipelineKey.depthFormat = depthTextureFormat;
+	pipelineKey.layout = layout;
+	PipelineKey compactPipelineKey = pipelineKey;
+	compactPipelineKey.vertices = VertexLayout::Compact;
+	compactPipelineKey.layout = compactLayout;
+	RenderPipeline pipeline = pipelines.Wait(pipelineKey);
+	RenderPipeline compactPipeline = pipelines.Wait(compactPipelineKey);
+
+
+	//gpu culling, instances go in as one run per model sorted by lod and come out as one indirect draw per model lod
+	ShaderModule cullShader = pipelines.Module(pipelines.Shader("cull.wgsl"));
+	GpuCuller culler(device, queue, cullShader, uniformLayout, instanceCount * drawModelCount, drawModelCount * maxDrawLods, instanceLayout);
+	vector<GpuCuller::Draw> cullDraws;
+	//per frame uploads, sized for every instance and draw plus the uniforms, one more buffer than frames in flight so the
+	//buffer for the next frame has usually finished mapping by the time it is needed
+	//a pointer so it can go before the device, its destructor waits on buffers still being mapped
+	auto uploads = std::make_unique<UploadRing>(device, queue, (unsigned long long)instanceCount * drawModelCount * (sizeof(mat4) + sizeof(unsigned int)) + (1 << 16),
+		framesInFlight + 1);
 
 	Uniforms uniformData;
-	vector<mat4> instanceData(instanceCount);
-	for (int i = 0; i < instanceData.size(); i++) instanceData[i] = mat4(1);
-	queue.writeBuffer(instanceVertBuffer, 0, instanceData.data(), instanceCount * sizeof(mat4)); //also updating rotation speed
+	ThreadPool threadPool;
+	InstanceTransforms instances(instanceCount, instanceLayout);
 
 
 	//proj
@@ -477,6 +525,7 @@ int main()
 	//view
 	uniformData.view = glm::translate(mat4(1), vec3(0, 0, -3));
 	uniformData.view = glm::rotate(uniformData.view, glm::radians(-60.f), vec3(1, 0, 0));
+	ExtractFrustum(uniformData.proj * uniformData.view, uniformData.frustum);
 
 	//model
 
@@ -484,6 +533,12 @@ int main()
 	float modelRot[] = { 90.f, 0.f, 0.f };
 
 	float modelScale = 1.f;
+	float lodPixelError = 1.f;
+	float lastLodPixelError = -1.f;
+	vector<float> lodSorted((size_t)instanceCount * drawModelCount * instances.Stride());
+	vector<int> instanceLod(instanceCount);
+	int lodStart[drawModelCount][maxDrawLods + 1] = {};
+	vector<GpuCuller::Draw> lastCullDraws;
 
 	uniformData.time = (float)glfwGetTime();
 	uniformData.rotationSpeed = 1.0f;
@@ -499,11 +554,72 @@ int main()
 
 
 	//INTERACTION
-	float cameraX;
-	float cameraY;
+	float cameraPos[]{ 0.f, 0.f };
+	float lastCameraPos[]{ 0.f, 0.f };
+	float lastFrameTime = (float)glfwGetTime();
+	bool deferDefragment = false;
+
+	VertexLayout modelLayout = VertexLayout::Compact;
+	MeshPool meshPool(device, queue, modelLayout == VertexLayout::Compact ? sizeof(CompactVert) : 32, 1 << 20, 16 << 20);
+	ModelRegistry models("F:\\Extracted\\ESO\\sfpts\\model", device, queue, meshPool, modelLayout, boundsLayout);
+	const unsigned int demoModels[drawModelCount] = { 2774573, 2551833 }; //bendu, alessia
+	Model* drawModels[drawModelCount];
+	for (int m = 0; m < drawModelCount; m++) drawModels[m] = models.Acquire(demoModels[m]);
+	models.AddPending();
+
+	//world streaming, only when started with --world <directory or cooked archive> <world id>
+	std::unique_ptr<Eso::CellIndex> cellIndex;
+	std::unique_ptr<Eso::WorldArchive> worldArchive;
+	std::unique_ptr<Eso::WorldStreamer> streamer;
+	if (argc >= 4 && strcmp(argv[1], "--world") == 0) {
+		Eso::StreamerSettings streamerSettings;
+		streamerSettings.directory = argv[2];
+		streamerSettings.world = (unsigned int)strtoul(argv[3], nullptr, 0);
+		streamerSettings.layers = worldLayers;
+		//a fixture cell's models load on the streamer worker that loaded the cell, only adding them to the mesh pool is left
+		//for the main thread. the references go when the last holder of the result (the cell or cellModels) drops it
+		streamerSettings.prepare = [&models](const Eso::StreamedCell& cell) -> std::shared_ptr<void> {
+			if (cell.kind != Eso::CellKind::Fixture) return nullptr;
+			auto ids = new std::vector<unsigned int>(cell.fixtureView.models.begin(), cell.fixtureView.models.end());
+			std::sort(ids->begin(), ids->end());
+			ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+			for (unsigned int id : *ids) models.Acquire(id);
+			return std::shared_ptr<std::vector<unsigned int>>(ids, [&models](std::vector<unsigned int>* held) {
+				for (unsigned int id : *held) models.Release(id);
+				delete held;
+			});
+		};
+
+		if (std::filesystem::is_regular_file(argv[2])) {
+			worldArchive = std::make_unique<Eso::WorldArchive>(argv[2]);
+			if (worldArchive->Good()) streamerSettings.archive = worldArchive.get();
+		}
+		else {
+			char* tocFilename = Eso::World::WorldTocFilename(streamerSettings.world);
+			std::string tocPath = streamerSettings.directory + "/" + tocFilename;
+			delete[] tocFilename;
+			Eso::Toc toc(tocPath.c_str());
+			cellIndex = std::make_unique<Eso::CellIndex>(toc, streamerSettings.world, argv[2]);
+			streamerSettings.index = cellIndex.get();
+		}
+		streamer = std::make_unique<Eso::WorldStreamer>(streamerSettings);
+	}
 
-	Model model("F:\\Extracted\\ESO\\sfpts\\model\\2774573.gr2", device, queue); //bendu
-	Model model2("F:\\Extracted\\ESO\\sfpts\\model\\2551833.gr2", device, queue); //alessia
+	//the model references of each fixture cell handed out by the streamer, from streamerSettings.prepare
+	std::unordered_map<unsigned long long, std::shared_ptr<void>> cellModels;
+	Eso::FixtureBvh fixtureBvh;
+	vector<float> fixtureRadii;
+	//streamed fixtures are static, each cell is recorded into a render bundle once
+	CellBundles::Targets bundleTargets;
+	bundleTargets.pipeline = pipeline;
+	bundleTargets.compactPipeline = compactPipeline;
+	bundleTargets.uniformGroup = uniformGroup;
+	bundleTargets.colorFormat = swapChainFormat;
+	bundleTargets.depthFormat = depthTextureFormat;
+	//cells that come into view together record on the thread pool, the render thread helps
+	CellBundles cellBundles(device, queue, models, meshPool, bundleTargets, instanceLayout, &threadPool);
+	//streamed terrain cells, selected on the main thread and drawn on the render thread
+	TerrainRenderer terrain(device, queue, pipelines.Module(pipelines.Shader("terrain.wgsl")), uniformLayout, swapChainFormat, depthTextureFormat);
 
 	//command buffer descs, use this to create the command buffer each frame
 	CommandEncoderDescriptor encoderDescriptor;
@@ -512,34 +628,46 @@ int main()
 	CommandBufferDescriptor bufferDescriptor;
 	bufferDescriptor.label = "Default command buffer";
 
+	//the main thread simulates and builds frame packets, the render thread encodes and presents them
+	//a pointer so it can be stopped before the things its frames use go away
+	std::unique_ptr<RenderThread> renderThread = std::make_unique<RenderThread>(device, queue, framesInFlight);
 
-	cout << "Hello CMake." << endl;
-
-	while (!glfwWindowShouldClose(window)) {
-		glfwPollEvents();
-
-		uniformData.time = (float)glfwGetTime();
-		queue.writeBuffer(uniformBuffer, offsetof(Uniforms, time), &uniformData.time, sizeof(float) * 2); //also updating rotation speed
-
-		
-		for (int i = 0; i < instanceCount; i++) {
-			instanceData[i] = glm::rotate(mat4(1), uniformData.time * uniformData.rotationSpeed + glm::two_pi<float>() / instanceCount * i, vec3(0.f, 0.f, 1.f));
-			instanceData[i] = glm::translate(instanceData[i], vec3(modelPos[0], modelPos[1], modelPos[2]));
-			instanceData[i] = glm::scale(instanceData[i], vec3(modelScale));
-			instanceData[i] = glm::rotate(instanceData[i], glm::radians(modelRot[2]), vec3(0.f, 0.f, 1.f));
-			instanceData[i] = glm::rotate(instanceData[i], glm::radians(modelRot[1]), vec3(0.f, 1.f, 0.f));
-			instanceData[i] = glm::rotate(instanceData[i], glm::radians(modelRot[0]), vec3(1.f, 0.f, 0.f));
+	//written by the render thread, shown by the ui a frame later
+	struct RenderStats {
+		UploadRing::Stats uploads;
+		unsigned int bundlesExecuted = 0;
+		unsigned int bundlesRecorded = 0;
+	};
+	std::mutex renderStatsMutex;
+	RenderStats renderStats;
+	std::atomic<bool> renderFailed = false;
+
+	//the render thread's half of a frame, uploads, encoding, submit and present. besides the packet it reads the models,
+	//the mesh pool and the cell bundles, which the main thread only changes after RenderThread::WaitIdle
+	auto renderFrame = [&](FramePacket& packet) {
+		PROFILE_FRAME();
+		if (packet.presentMode != presentMode) {
+			swapChain.drop();
+			swapChain = device.createSwapChain(surface, DescribeSwapChain(windowWidth, windowHeight, swapChainFormat, packet.presentMode));
+			presentMode = packet.presentMode;
 		}
 
-		//queue.writeBuffer(uniformBuffer, offsetof(Uniforms, model), &uniformData.model, sizeof(mat4));
-		queue.writeBuffer(instanceVertBuffer, 0, instanceData.data(), instanceCount * sizeof(mat4)); //also updating rotation speed
+		uploads->BeginFrame();
+		if (packet.cullChanged) {
+			PROFILE_SCOPE("cull upload");
+			culler.Update(packet.instances.data(), packet.cullDraws, uploads.get());
+		}
+		else culler.ResetCounts(uploads.get());
+		//time, rotation speed and the frustum are one run at the end of the uniforms, so one copy
+		uploads->Write(uniformBuffer, offsetof(Uniforms, time), &packet.uniforms.time, sizeof(Uniforms) - offsetof(Uniforms, time));
 		
 
 		
 		TextureView nextFrame = swapChain.getCurrentTextureView();
 		if (!nextFrame) {
 			std::cerr << "Cannot acquire next swap chain texture" << std::endl;
-			break;
+			renderFailed = true;
+			return;
 		}
 		//std::cout << "next frame: " << nextFrame << std::endl;
 
@@ -576,19 +704,204 @@ int main()
 		renderPassDescriptor.timestampWrites = nullptr;
 
 
-		//swapChain.present();
 		CommandEncoder encoder = device.createCommandEncoder(encoderDescriptor);
+		terrain.Upload(packet.terrain, uploads.get());
+		uploads->Flush(encoder);
+#if RENDWGPU_PROFILE
+		culler.Cull(encoder, uniformGroup, Profiler::Get().ComputePass("cull"));
+		auto passTimestamps = Profiler::Get().RenderPass("main pass");
+		renderPassDescriptor.timestampWriteCount = (uint32_t)passTimestamps.size();
+		renderPassDescriptor.timestampWrites = passTimestamps.empty() ? nullptr : passTimestamps.data();
+#else
+		culler.Cull(encoder, uniformGroup);
+#endif
 		RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDescriptor);
-		renderPass.setPipeline(pipeline);
 		renderPass.setBindGroup(0, uniformGroup, 0, nullptr);
-		renderPass.setVertexBuffer(0, model.vertBuffer, 0, model.vertBufferSize);
-		renderPass.setVertexBuffer(1, instanceVertBuffer, 0, instanceCount * sizeof(mat4));
-		renderPass.setIndexBuffer(model.idxBuffer, model.idx32 ? IndexFormat::Uint32 : IndexFormat::Uint16, 0, model.idxBufferSize);
-		renderPass.drawIndexed(model.idxCount, instanceCount, 0, 0, 0);
+		//every model shares the pool's buffers, the index buffer is only rebound when the format changes
+		Buffer poolIdxBuffer = meshPool.IdxBuffer();
+		renderPass.setVertexBuffer(0, meshPool.VertBuffer(), 0, (unsigned long long)meshPool.VertCapacity() * meshPool.VertStride());
+		int boundIdx32 = -1;
+		for (int m = 0; m < drawModelCount; m++) {
+			Model* drawModel = drawModels[m];
+			if (!drawModel) continue;
+			bool compact = drawModel->layout == VertexLayout::Compact;
+			//a variant that isn't compiled yet is skipped rather than waited on
+			RenderPipeline modelPipeline = pipelines.Get(compact ? compactPipelineKey : pipelineKey);
+			if (!modelPipeline) continue;
+			renderPass.setPipeline(modelPipeline);
+			if (compact) renderPass.setBindGroup(1, drawModel->boundsGroup, 0, nullptr);
+			if (boundIdx32 != (int)drawModel->idx32) {
+				renderPass.setIndexBuffer(poolIdxBuffer, drawModel->idx32 ? IndexFormat::Uint32 : IndexFormat::Uint16, 0, meshPool.IdxCapacity());
+				boundIdx32 = (int)drawModel->idx32;
+			}
+			for (int l = 0; l < maxDrawLods; l++) culler.DrawVisible(renderPass, m * maxDrawLods + l, 1);
+		}
+		terrain.Draw(renderPass, uniformGroup, packet.terrain);
+		//last, executing bundles resets the pass state
+		cellBundles.Execute(renderPass, (const float(*)[4])packet.uniforms.frustum);
 
-		renderPass.setVertexBuffer(0, model2.vertBuffer, 0, model2.vertBufferSize);
-		renderPass.setIndexBuffer(model2.idxBuffer, model2.idx32 ? IndexFormat::Uint32 : IndexFormat::Uint16, 0, model.idxBufferSize);
-		renderPass.drawIndexed(model2.idxCount, instanceCount, 0, 0, 0);
+		ImGui_ImplWGPU_RenderDrawData(&packet.ui.data, renderPass);
+		renderPass.end();
+
+		nextFrame.drop();
+
+#if RENDWGPU_PROFILE
+		Profiler::Get().ResolveGpu(encoder);
+#endif
+		CommandBuffer commandBuffer = encoder.finish(bufferDescriptor);
+		{
+			PROFILE_SCOPE("submit");
+			queue.submit(commandBuffer);
+		}
+		renderThread->Fence();
+		uploads->Submitted();
+#if RENDWGPU_PROFILE
+		Profiler::Get().GpuSubmitted();
+#endif
+		
+		{
+			PROFILE_SCOPE("present");
+			swapChain.present();
+		}
+		
+		//std::cout << "nextTexture: " << nextFrame << std::endl;
+		//std::cout << "A" << std::endl;
+
+		std::lock_guard<std::mutex> lock(renderStatsMutex);
+		renderStats.uploads = uploads->GetStats();
+		renderStats.bundlesExecuted = cellBundles.ExecutedLastFrame();
+		renderStats.bundlesRecorded = cellBundles.RecordedLastFrame();
+	};
+
+
+	cout << "Hello CMake." << endl;
+
+	while (!glfwWindowShouldClose(window) && !renderFailed) {
+		glfwPollEvents();
+
+		uniformData.time = (float)glfwGetTime();
+
+		if (streamer) {
+			PROFILE_SCOPE("streaming");
+			float dt = std::max(uniformData.time - lastFrameTime, 1e-4f);
+			streamer->Update(cameraPos[0], cameraPos[1], (cameraPos[0] - lastCameraPos[0]) / dt, (cameraPos[1] - lastCameraPos[1]) / dt);
+			std::vector<const Eso::StreamedCell*> loadedCells = streamer->TakeLoaded();
+			std::vector<unsigned long long> evictedCells = streamer->TakeEvicted();
+			//adding models moves things in the mesh pool and the frame being rendered reads the cell bundles
+			if (!loadedCells.empty() || !evictedCells.empty() || terrain.ReofferPending()) {
+				renderThread->WaitIdle();
+				models.AddPending();
+			}
+			for (const Eso::StreamedCell* cell : loadedCells) {
+				if (cell->kind == Eso::CellKind::Terrain) {
+					if (cell->terrain) terrain.AddCell(cell->id, cell->x, cell->y, *cell->terrain);
+					continue;
+				}
+				if (cell->kind != Eso::CellKind::Fixture) continue;
+				cellModels[cell->id] = cell->prepared;
+
+				const Eso::FixtureSpan& fixtures = cell->fixtureView;
+				fixtureRadii.resize(fixtures.count);
+				for (size_t i = 0; i < fixtures.count; i++) {
+					const Model* fixtureModel = models.Find(fixtures.models[i]);
+					fixtureRadii[i] = fixtureModel ? glm::length(vec3(fixtureModel->center[0], fixtureModel->center[1], fixtureModel->center[2])) + fixtureModel->radius : 0.f;
+				}
+				fixtureBvh.AddCell(cell->id, fixtures, fixtureRadii);
+				cellBundles.AddCell(cell->id, fixtures);
+			}
+			for (unsigned long long id : evictedCells) {
+				fixtureBvh.RemoveCell(id);
+				cellBundles.RemoveCell(id);
+				terrain.RemoveCell(id);
+				cellModels.erase(id);
+			}
+			//after the evictions, the streamer already dropped those cells' terrain
+			terrain.Reoffer();
+		}
+		if (deferDefragment) {
+			//between frames, nothing recorded yet points at the old buffers
+			renderThread->WaitIdle();
+			meshPool.Defragment();
+			deferDefragment = false;
+		}
+		lastCameraPos[0] = cameraPos[0];
+		lastCameraPos[1] = cameraPos[1];
+		lastFrameTime = uniformData.time;
+
+		//the ring of instances orbiting z, orbit(a) * translate(p) * scale * rotation is translate(orbit(a) * p) * rotation with a added to z * scale.
+		//unchanged values don't mark anything dirty, so with the speed at 0 nothing gets rebuilt or uploaded
+		for (int i = 0; i < instanceCount; i++) {
+			float orbit = uniformData.time * uniformData.rotationSpeed + glm::two_pi<float>() / instanceCount * i;
+			float c = std::cos(orbit), s = std::sin(orbit);
+			instances.SetPosition(i, c * modelPos[0] - s * modelPos[1], s * modelPos[0] + c * modelPos[1], modelPos[2]);
+			instances.SetRotation(i, glm::radians(modelRot[0]), glm::radians(modelRot[1]), glm::radians(modelRot[2]) + orbit);
+			instances.SetScale(i, modelScale);
+		}
+		instances.Update(&threadPool);
+
+		//each model gets its own run of instances grouped by lod, so every lod is one indirect draw
+		//only redone when an instance moved or the lod threshold changed
+		bool instancesChanged = !instances.Changed().empty() || lodPixelError != lastLodPixelError;
+		lastLodPixelError = lodPixelError;
+		//pixels per unit at distance one, for turning lod errors into screen space
+		float pixelsPerUnit = windowHeight / (2.f * std::tan(fov * 0.5f));
+		vec3 eye = vec3(glm::inverse(uniformData.view)[3]);
+		for (int m = 0; m < drawModelCount && instancesChanged; m++) {
+			PROFILE_SCOPE("lod sort");
+			if (!drawModels[m]) continue;
+			const Model& lodModel = *drawModels[m];
+			int lodCount = std::min((int)lodModel.lods.size(), maxDrawLods);
+			int counts[maxDrawLods] = {};
+			for (int i = 0; i < instanceCount; i++) {
+				vec3 center;
+				instances.TransformPoint(i, lodModel.center, glm::value_ptr(center));
+				float distance = std::max(glm::length(center - eye) - lodModel.radius * modelScale, 0.f);
+				int lod = std::min(lodModel.SelectLod(distance, modelScale, pixelsPerUnit, lodPixelError), lodCount - 1);
+				instanceLod[i] = lod;
+				counts[lod]++;
+			}
+			for (int l = 0; l < lodCount; l++) lodStart[m][l + 1] = lodStart[m][l] + counts[l];
+			int fill[maxDrawLods];
+			std::copy(lodStart[m], lodStart[m] + maxDrawLods, fill);
+			unsigned int stride = instances.Stride();
+			for (int i = 0; i < instanceCount; i++) {
+				std::copy_n(instances.Instance(i), stride, &lodSorted[((size_t)m * instanceCount + fill[instanceLod[i]]++) * stride]);
+			}
+		}
+
+		//a fixed list, model m lod l is always draw m * maxDrawLods + l, empty ones are skipped when drawing
+		cullDraws.assign(drawModelCount * maxDrawLods, GpuCuller::Draw{});
+		for (int m = 0; m < drawModelCount; m++) {
+			const Model* drawModel = drawModels[m];
+			if (!drawModel) continue;
+			int firstIndex = drawModel->FirstIndex();
+			int baseVertex = drawModel->BaseVertex();
+			for (int l = 0; l < std::min((int)drawModel->lods.size(), maxDrawLods); l++) {
+				GpuCuller::Draw& draw = cullDraws[m * maxDrawLods + l];
+				draw.indexCount = drawModel->lods[l].idxCount;
+				draw.firstIndex = firstIndex + drawModel->lods[l].firstIndex;
+				draw.baseVertex = baseVertex;
+				draw.firstInstance = m * instanceCount + lodStart[m][l];
+				draw.instanceCount = lodStart[m][l + 1] - lodStart[m][l];
+				for (int c = 0; c < 3; c++) draw.center[c] = drawModel->center[c];
+				draw.radius = drawModel->radius;
+			}
+		}
+		//the draws also move when the mesh pool is rebuilt
+		auto packet = std::make_shared<FramePacket>();
+		if (instancesChanged || cullDraws.size() != lastCullDraws.size() ||
+			std::memcmp(cullDraws.data(), lastCullDraws.data(), cullDraws.size() * sizeof(GpuCuller::Draw)) != 0) {
+			packet->cullChanged = true;
+			packet->instances = lodSorted;
+			packet->cullDraws = cullDraws;
+			lastCullDraws = cullDraws;
+		}
+		ExtractFrustum(uniformData.proj * uniformData.view, uniformData.frustum);
+		packet->uniforms = uniformData;
+		{
+			PROFILE_SCOPE("terrain select");
+			terrain.Select(glm::value_ptr(eye), (const float(*)[4])uniformData.frustum, packet->terrain);
+		}
 
 
 		//imgui
@@ -601,25 +914,64 @@ int main()
 		ImGui::DragFloat3("Rotation", modelRot);
 		ImGui::DragFloat("Scale", &modelScale, 0.01f);
 		ImGui::DragFloat("Speed", &uniformData.rotationSpeed, 0.01f);
+		ImGui::DragFloat("LOD pixel error", &lodPixelError, 0.05f, 0.f, 64.f);
+		RenderStats shownStats;
+		{
+			std::lock_guard<std::mutex> lock(renderStatsMutex);
+			shownStats = renderStats;
+		}
+		if (streamer) {
+			ImGui::DragFloat2("Camera", cameraPos, 1.f);
+			ImGui::Text("Cells %zu resident (%zu KB), %zu pending", streamer->ResidentCells(), streamer->ResidentBytes() / 1024, streamer->PendingCells());
+			ImGui::Text("Models %zu loaded, %zu fixtures indexed", models.LoadedCount(), fixtureBvh.FixtureCount());
+			ImGui::Text("Cell bundles %u of %zu drawn, %u recorded", shownStats.bundlesExecuted, cellBundles.CellCount(), shownStats.bundlesRecorded);
+			ImGui::Text("Terrain %zu tiles (%llu KB), %zu patches, %llu vertices", terrain.TileCount(), terrain.TextureBytes() / 1024,
+				packet->terrain.patches.size(), TerrainRenderer::VertexCount(packet->terrain));
+		}
+		ImGui::Text("Mesh pool %u/%u verts, %u/%u KB indices, %.0f%% fragmented", meshPool.VertsUsed(), meshPool.VertCapacity(),
+			meshPool.IdxBytesUsed() / 1024, meshPool.IdxCapacity() / 1024, meshPool.Fragmentation() * 100.f);
+		PipelineCache::Stats pipelineStats = pipelines.GetStats();
+		ImGui::Text("Pipelines %u hits, %u misses, %u compiling, %.1f ms compiling (slowest %.1f ms)", pipelineStats.hits + pipelineStats.shaderHits,
+			pipelineStats.misses + pipelineStats.shaderMisses, pipelineStats.pending, pipelineStats.compileMs, pipelineStats.slowestMs);
+		const UploadRing::Stats& uploadStats = shownStats.uploads;
+		ImGui::Text("Uploads %llu KB in %u copies, %llu KB overflowed, %u stalls", uploadStats.bytes / 1024, uploadStats.copies,
+			uploadStats.overflowBytes / 1024, uploadStats.stalls);
+		RenderThread::Stats threadStats = renderThread->GetStats();
+		ImGui::Text("Frames in flight %u of %u, %.2f ms waiting for the render thread, %.2f ms waiting for the gpu", threadStats.inFlight,
+			renderThread->FramesInFlight(), threadStats.submitWaitMs, threadStats.gpuWaitMs);
+		ImGui::Combo("Present mode", &presentModeIndex, presentModeNames, 3);
+		packet->presentMode = presentModes[presentModeIndex];
+		if (ImGui::Button("Defragment")) {
+			deferDefragment = true;
+		}
+#if RENDWGPU_PROFILE
+		Profiler::Get().DrawPanel();
+#endif
 		ImGui::Render();
-		ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
-		renderPass.end();
-
-		nextFrame.drop();
-
-		CommandBuffer commandBuffer = encoder.finish(bufferDescriptor);
-		queue.submit(commandBuffer);
-		
-		swapChain.present();
-		
-		//std::cout << "nextTexture: " << nextFrame << std::endl;
-		//std::cout << "A" << std::endl;
+		packet->ui.Take(ImGui::GetDrawData());
 
+		{
+			PROFILE_SCOPE("wait for render thread");
+			renderThread->Submit([&renderFrame, packet] { renderFrame(*packet); });
+		}
 	}
+	//the frames still running read everything below
+	renderThread->WaitGpu();
+	renderThread.reset();
+
+	//the streamer's cells hold model references too
+	streamer.reset();
+	cellModels.clear();
+	for (int m = 0; m < drawModelCount; m++) models.Release(demoModels[m]);
 
-	pipeline.drop();
 	layout.drop();
+	compactLayout.drop();
+	boundsLayout.drop();
 
+	uploads.reset();
+#if RENDWGPU_PROFILE
+	Profiler::Get().ReleaseGpu();
+#endif
 	uniformGroup.drop();
 	uniformBuffer.drop();
 	uniformLayout.drop();
@@ -627,7 +979,6 @@ int main()
 	depthTextureView.drop();
 	depthTexture.drop();
 	swapChain.drop();
-	shader.drop();
 
 
 	device.drop();
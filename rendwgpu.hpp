@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include "webgpu\webgpu.hpp"
+#include "glm\glm.hpp"
+
+//what the windowed renderer in rendwgpu.cpp shares with the headless modes in benchmarks.cpp
+
+struct Uniforms {
+	glm::mat4 proj;
+	glm::mat4 view;
+	float time;
+	float rotationSpeed;
+	float padding[2];
+	glm::vec4 frustum[6]; //world space planes, xyz points inwards
+};
+
+//gribb/hartmann, planes of the clip space box pulled back through viewProj and normalised
+void ExtractFrustum(const glm::mat4& viewProj, glm::vec4 planes[6]);
+//the device main and the headless modes render with, limits are whatever the adapter supports
+wgpu::Device CreateDevice(wgpu::Adapter& adapter);
+//shaders sit next to the executable when run from the build output
+std::string ShaderDirectory();
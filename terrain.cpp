@@ -0,0 +1,537 @@
+#include "terrain.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+using namespace wgpu;
+
+namespace {
+	Buffer CreateTerrainBuffer(Device& device, unsigned long long size, WGPUBufferUsageFlags usage, const char* label) {
+		BufferDescriptor desc;
+		desc.size = std::max((size + 3) & ~3ull, 16ull);
+		desc.usage = usage;
+		desc.mappedAtCreation = false;
+		desc.label = label;
+		return device.createBuffer(desc);
+	}
+
+	float BoxDistanceSq(const float boxMin[3], const float boxMax[3], const float point[3]) {
+		float sum = 0.f;
+		for (int c = 0; c < 3; c++) {
+			float d = std::max({ boxMin[c] - point[c], point[c] - boxMax[c], 0.f });
+			sum += d * d;
+		}
+		return sum;
+	}
+
+	//the corner furthest along each plane's normal has to be inside it
+	bool BoxInFrustum(const float boxMin[3], const float boxMax[3], const float planes[6][4]) {
+		for (int p = 0; p < 6; p++) {
+			float d = planes[p][3];
+			for (int c = 0; c < 3; c++) d += planes[p][c] * (planes[p][c] >= 0.f ? boxMax[c] : boxMin[c]);
+			if (d < 0.f) return false;
+		}
+		return true;
+	}
+}
+
+TerrainRenderer::TerrainRenderer(Device device, Queue queue, ShaderModule shader, BindGroupLayout uniformLayout,
+	TextureFormat colorFormat, TextureFormat depthFormat, const Settings& settings)
+	: device(device), queue(queue), settings(settings) {
+	this->settings.levels = std::clamp(settings.levels, 1u, maxLevels);
+	this->settings.maxTiles = std::max(settings.maxTiles, 1u);
+	this->settings.windowCells = std::max(settings.windowCells, 1u);
+	unsigned int resolution = 2;
+	while (resolution < settings.tileResolution) resolution <<= 1;
+	this->settings.tileResolution = resolution;
+	mipCount = 1;
+	for (unsigned int r = resolution; r > 1; r >>= 1) mipCount++;
+	leafSize = settings.cellSize * gridQuads / resolution;
+	for (unsigned int l = 0; l < maxLevels; l++) ranges[l] = leafSize * (float)(1u << l) * settings.lodRangeRatio;
+	tileOwners.assign(this->settings.maxTiles, ~0ull);
+	window.assign((size_t)this->settings.windowCells * this->settings.windowCells, -1);
+
+	TextureDescriptor heightsDesc;
+	heightsDesc.label = "terrain heights";
+	heightsDesc.dimension = TextureDimension::_2D;
+	heightsDesc.format = TextureFormat::R32Float;
+	heightsDesc.mipLevelCount = mipCount;
+	heightsDesc.sampleCount = 1;
+	heightsDesc.size = { resolution, resolution, this->settings.maxTiles };
+	heightsDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	heightsDesc.viewFormatCount = 0;
+	heightsDesc.viewFormats = nullptr;
+	heights = device.createTexture(heightsDesc);
+	TextureViewDescriptor viewDesc;
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = this->settings.maxTiles;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = mipCount;
+	viewDesc.dimension = TextureViewDimension::_2DArray;
+	viewDesc.format = TextureFormat::R32Float;
+	heightsView = heights.createView(viewDesc);
+
+	windowBuffer = CreateTerrainBuffer(device, window.size() * sizeof(int), BufferUsage::Storage | BufferUsage::CopyDst, "terrain window");
+	queue.writeBuffer(windowBuffer, 0, window.data(), window.size() * sizeof(int));
+	tileCellBuffer = CreateTerrainBuffer(device, (unsigned long long)this->settings.maxTiles * 2 * sizeof(int), BufferUsage::Storage | BufferUsage::CopyDst, "terrain tile cells");
+	paramsBuffer = CreateTerrainBuffer(device, sizeof(Params), BufferUsage::Uniform | BufferUsage::CopyDst, "terrain params");
+	patchBuffer = CreateTerrainBuffer(device, maxPatches * sizeof(Patch), BufferUsage::Vertex | BufferUsage::CopyDst, "terrain patches");
+
+	//one grid for every patch, quarters use every other vertex of it
+	const unsigned int side = gridQuads + 1;
+	std::vector<float> verts;
+	for (unsigned int y = 0; y < side; y++) {
+		for (unsigned int x = 0; x < side; x++) verts.insert(verts.end(), { (float)x / gridQuads, (float)y / gridQuads });
+	}
+	std::vector<unsigned short> idx;
+	for (unsigned int step : { 1u, 2u }) {
+		for (unsigned int y = 0; y < gridQuads; y += step) {
+			for (unsigned int x = 0; x < gridQuads; x += step) {
+				unsigned short a = (unsigned short)(y * side + x), b = (unsigned short)(a + step), c = (unsigned short)(a + step * side), d = (unsigned short)(c + step);
+				idx.insert(idx.end(), { a, b, c, b, d, c });
+			}
+		}
+		if (step == 1) wholeIdxCount = (unsigned int)idx.size();
+	}
+	quarterIdxCount = (unsigned int)idx.size() - wholeIdxCount;
+	gridVerts = CreateTerrainBuffer(device, verts.size() * sizeof(float), BufferUsage::Vertex | BufferUsage::CopyDst, "terrain grid vertices");
+	queue.writeBuffer(gridVerts, 0, verts.data(), verts.size() * sizeof(float));
+	gridIdx = CreateTerrainBuffer(device, idx.size() * sizeof(unsigned short), BufferUsage::Index | BufferUsage::CopyDst, "terrain grid indices");
+	queue.writeBuffer(gridIdx, 0, idx.data(), idx.size() * sizeof(unsigned short));
+
+	//heights, which tile each wrapped cell uses, which cell each tile holds, params
+	std::vector<BindGroupLayoutEntry> layoutEntries(4, Default);
+	layoutEntries[0].binding = 0;
+	layoutEntries[0].visibility = ShaderStage::Vertex;
+	layoutEntries[0].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	layoutEntries[0].texture.viewDimension = TextureViewDimension::_2DArray;
+	layoutEntries[0].texture.multisampled = false;
+	layoutEntries[1].binding = 1;
+	layoutEntries[1].visibility = ShaderStage::Vertex;
+	layoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	layoutEntries[2].binding = 2;
+	layoutEntries[2].visibility = ShaderStage::Vertex;
+	layoutEntries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+	layoutEntries[3].binding = 3;
+	layoutEntries[3].visibility = ShaderStage::Vertex;
+	layoutEntries[3].buffer.type = BufferBindingType::Uniform;
+	layoutEntries[3].buffer.minBindingSize = sizeof(Params);
+	BindGroupLayoutDescriptor layoutDesc;
+	layoutDesc.label = "terrain layout";
+	layoutDesc.entryCount = (uint32_t)layoutEntries.size();
+	layoutDesc.entries = layoutEntries.data();
+	terrainLayout = device.createBindGroupLayout(layoutDesc);
+
+	std::vector<BindGroupEntry> groupEntries(4, Default);
+	groupEntries[0].binding = 0;
+	groupEntries[0].textureView = heightsView;
+	groupEntries[1].binding = 1;
+	groupEntries[1].buffer = windowBuffer;
+	groupEntries[1].offset = 0;
+	groupEntries[1].size = window.size() * sizeof(int);
+	groupEntries[2].binding = 2;
+	groupEntries[2].buffer = tileCellBuffer;
+	groupEntries[2].offset = 0;
+	groupEntries[2].size = (unsigned long long)this->settings.maxTiles * 2 * sizeof(int);
+	groupEntries[3].binding = 3;
+	groupEntries[3].buffer = paramsBuffer;
+	groupEntries[3].offset = 0;
+	groupEntries[3].size = sizeof(Params);
+	BindGroupDescriptor groupDesc;
+	groupDesc.label = "terrain group";
+	groupDesc.layout = terrainLayout;
+	groupDesc.entryCount = (uint32_t)groupEntries.size();
+	groupDesc.entries = groupEntries.data();
+	terrainGroup = device.createBindGroup(groupDesc);
+
+	std::vector<WGPUBindGroupLayout> groupLayouts = { uniformLayout, terrainLayout };
+	PipelineLayoutDescriptor pipelineLayoutDesc;
+	pipelineLayoutDesc.bindGroupLayoutCount = (uint32_t)groupLayouts.size();
+	pipelineLayoutDesc.bindGroupLayouts = groupLayouts.data();
+	pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+	//grid position in slot 0, the patch in slot 1
+	VertexAttribute gridAttribute;
+	gridAttribute.format = VertexFormat::Float32x2;
+	gridAttribute.offset = 0;
+	gridAttribute.shaderLocation = 0;
+	VertexAttribute patchAttribute;
+	patchAttribute.format = VertexFormat::Float32x4;
+	patchAttribute.offset = 0;
+	patchAttribute.shaderLocation = 1;
+	std::vector<VertexBufferLayout> bufferLayouts(2);
+	bufferLayouts[0].attributeCount = 1;
+	bufferLayouts[0].attributes = &gridAttribute;
+	bufferLayouts[0].arrayStride = 2 * sizeof(float);
+	bufferLayouts[0].stepMode = VertexStepMode::Vertex;
+	bufferLayouts[1].attributeCount = 1;
+	bufferLayouts[1].attributes = &patchAttribute;
+	bufferLayouts[1].arrayStride = sizeof(Patch);
+	bufferLayouts[1].stepMode = VertexStepMode::Instance;
+
+	RenderPipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "terrain pipeline";
+	pipelineDesc.layout = pipelineLayout;
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+	pipelineDesc.vertex.bufferCount = (uint32_t)bufferLayouts.size();
+	pipelineDesc.vertex.buffers = bufferLayouts.data();
+	pipelineDesc.vertex.module = shader;
+	pipelineDesc.vertex.entryPoint = "vs_terrain";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+
+	ColorTargetState colorTarget;
+	colorTarget.format = colorFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = ColorWriteMask::All;
+	FragmentState fragmentState;
+	fragmentState.module = shader;
+	fragmentState.entryPoint = "fs_terrain";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	DepthStencilState depthState = Default;
+	depthState.depthCompare = CompareFunction::Less;
+	depthState.depthWriteEnabled = true;
+	depthState.format = depthFormat;
+	depthState.stencilReadMask = 0;
+	depthState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthState;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	pipeline = device.createRenderPipeline(pipelineDesc);
+}
+
+TerrainRenderer::~TerrainRenderer() {
+	pipeline.drop();
+	pipelineLayout.drop();
+	terrainGroup.drop();
+	terrainLayout.drop();
+	gridIdx.drop();
+	gridVerts.drop();
+	patchBuffer.drop();
+	paramsBuffer.drop();
+	tileCellBuffer.drop();
+	windowBuffer.drop();
+	heightsView.drop();
+	heights.drop();
+}
+
+bool TerrainRenderer::AddCell(unsigned long long id, unsigned int x, unsigned int y, Eso::TerrainFile& terrain) {
+	RemoveCell(id);
+	std::vector<float> samples;
+	unsigned int width, height;
+	if (!ReadHeights(terrain, settings, samples, width, height)) {
+		std::cout << "Terrain cell " << x << ", " << y << " has no height layer\n";
+		return false;
+	}
+
+	//the nearer of two cells a window apart keeps the table entry
+	unsigned int slot = WindowSlot(x, y);
+	if (window[slot] >= 0) {
+		unsigned long long other = tileOwners[window[slot]];
+		const Cell& otherCell = cells.at(other);
+		if (DistanceSq(otherCell.x, otherCell.y) <= DistanceSq(x, y)) {
+			waiting[id] = { x, y, &terrain };
+			return false;
+		}
+		Displace(other);
+	}
+	//likewise when every tile is taken, the farthest cell makes room
+	auto freeTile = std::find(tileOwners.begin(), tileOwners.end(), ~0ull);
+	if (freeTile == tileOwners.end()) {
+		auto farthest = std::max_element(cells.begin(), cells.end(), [this](auto& a, auto& b) {
+			return DistanceSq(a.second.x, a.second.y) < DistanceSq(b.second.x, b.second.y);
+		});
+		if (DistanceSq(farthest->second.x, farthest->second.y) <= DistanceSq(x, y)) {
+			waiting[id] = { x, y, &terrain };
+			return false;
+		}
+		Displace(farthest->first);
+		freeTile = std::find(tileOwners.begin(), tileOwners.end(), ~0ull);
+	}
+	unsigned int tile = (unsigned int)(freeTile - tileOwners.begin());
+
+	//resampled to texel centres, so the shader can filter across cell edges the same way as inside a cell
+	unsigned int resolution = settings.tileResolution;
+	std::vector<float> level((size_t)resolution * resolution);
+	float minHeight = INFINITY, maxHeight = -INFINITY;
+	for (unsigned int j = 0; j < resolution; j++) {
+		float sy = std::clamp((j + 0.5f) * height / resolution - 0.5f, 0.f, (float)(height - 1));
+		unsigned int y0 = (unsigned int)sy, y1 = std::min(y0 + 1, height - 1);
+		for (unsigned int i = 0; i < resolution; i++) {
+			float sx = std::clamp((i + 0.5f) * width / resolution - 0.5f, 0.f, (float)(width - 1));
+			unsigned int x0 = (unsigned int)sx, x1 = std::min(x0 + 1, width - 1);
+			float fx = sx - x0, fy = sy - y0;
+			float top = samples[(size_t)y0 * width + x0] * (1.f - fx) + samples[(size_t)y0 * width + x1] * fx;
+			float bottom = samples[(size_t)y1 * width + x0] * (1.f - fx) + samples[(size_t)y1 * width + x1] * fx;
+			float h = top * (1.f - fy) + bottom * fy;
+			level[(size_t)j * resolution + i] = h;
+			minHeight = std::min(minHeight, h);
+			maxHeight = std::max(maxHeight, h);
+		}
+	}
+	//mips are 2x2 averages, coarse levels sample them
+	for (unsigned int mip = 0; mip < mipCount; mip++) {
+		unsigned int size = resolution >> mip;
+		ImageCopyTexture destination = Default;
+		destination.texture = heights;
+		destination.mipLevel = mip;
+		destination.origin = { 0, 0, tile };
+		destination.aspect = TextureAspect::All;
+		TextureDataLayout source = Default;
+		source.offset = 0;
+		source.bytesPerRow = size * sizeof(float);
+		source.rowsPerImage = size;
+		queue.writeTexture(destination, level.data(), (size_t)size * size * sizeof(float), source, { size, size, 1 });
+		if (size == 1) break;
+		unsigned int half = size / 2;
+		for (unsigned int j = 0; j < half; j++) {
+			for (unsigned int i = 0; i < half; i++) {
+				const float* row = &level[(size_t)j * 2 * size + i * 2];
+				level[(size_t)j * half + i] = (row[0] + row[1] + row[size] + row[size + 1]) * 0.25f;
+			}
+		}
+	}
+
+	cells[id] = { x, y, tile, minHeight, maxHeight, &terrain };
+	tileOwners[tile] = id;
+	window[slot] = (int)tile;
+	queue.writeBuffer(windowBuffer, slot * sizeof(int), &window[slot], sizeof(int));
+	int cellCoords[2] = { (int)x, (int)y };
+	queue.writeBuffer(tileCellBuffer, (unsigned long long)tile * sizeof(cellCoords), cellCoords, sizeof(cellCoords));
+	return true;
+}
+
+void TerrainRenderer::RemoveCell(unsigned long long id) {
+	if (cells.count(id)) Evict(id);
+	waiting.erase(id);
+}
+
+void TerrainRenderer::Reoffer() {
+	if (!reoffer) return;
+	reoffer = false;
+	std::vector<std::pair<unsigned long long, Waiting>> offers(waiting.begin(), waiting.end());
+	std::sort(offers.begin(), offers.end(), [this](auto& a, auto& b) {
+		return DistanceSq(a.second.x, a.second.y) < DistanceSq(b.second.x, b.second.y);
+	});
+	for (auto& [id, cell] : offers) AddCell(id, cell.x, cell.y, *cell.terrain);
+}
+
+void TerrainRenderer::Displace(unsigned long long id) {
+	const Cell& cell = cells.at(id);
+	waiting[id] = { cell.x, cell.y, cell.terrain };
+	Evict(id);
+}
+
+void TerrainRenderer::Evict(unsigned long long id) {
+	const Cell& cell = cells.at(id);
+	unsigned int slot = WindowSlot(cell.x, cell.y);
+	if (window[slot] == (int)cell.tile) {
+		window[slot] = -1;
+		queue.writeBuffer(windowBuffer, slot * sizeof(int), &window[slot], sizeof(int));
+	}
+	tileOwners[cell.tile] = ~0ull;
+	cells.erase(id);
+}
+
+unsigned int TerrainRenderer::WindowSlot(unsigned int x, unsigned int y) const {
+	return (y % settings.windowCells) * settings.windowCells + x % settings.windowCells;
+}
+
+float TerrainRenderer::DistanceSq(unsigned int x, unsigned int y) const {
+	float dx = (x + 0.5f) * settings.cellSize - eye[0];
+	float dy = (y + 0.5f) * settings.cellSize - eye[1];
+	return dx * dx + dy * dy;
+}
+
+bool TerrainRenderer::NodeBounds(float x, float y, float size, float& minHeight, float& maxHeight) const {
+	int cx0 = (int)std::floor(x / settings.cellSize), cx1 = (int)std::ceil((x + size) / settings.cellSize) - 1;
+	int cy0 = (int)std::floor(y / settings.cellSize), cy1 = (int)std::ceil((y + size) / settings.cellSize) - 1;
+	minHeight = INFINITY;
+	maxHeight = -INFINITY;
+	auto merge = [&](const Cell& cell) {
+		minHeight = std::min(minHeight, cell.minHeight);
+		maxHeight = std::max(maxHeight, cell.maxHeight);
+	};
+	//small nodes look their cells up, big ones go through the resident cells instead
+	if ((long long)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) <= 64) {
+		for (int cy = std::max(cy0, 0); cy <= cy1; cy++) {
+			for (int cx = std::max(cx0, 0); cx <= cx1; cx++) {
+				int tile = window[WindowSlot(cx, cy)];
+				if (tile < 0) continue;
+				const Cell& cell = cells.at(tileOwners[tile]);
+				if (cell.x == (unsigned int)cx && cell.y == (unsigned int)cy) merge(cell);
+			}
+		}
+	}
+	else {
+		for (auto& [id, cell] : cells) {
+			if ((int)cell.x >= cx0 && (int)cell.x <= cx1 && (int)cell.y >= cy0 && (int)cell.y <= cy1) merge(cell);
+		}
+	}
+	return minHeight <= maxHeight;
+}
+
+void TerrainRenderer::Select(const float newEye[3], const float planes[6][4], Selection& selection) {
+	std::copy(newEye, newEye + 3, eye);
+	std::copy(newEye, newEye + 3, selection.eye);
+	selection.patches.clear();
+	selection.wholeCount = 0;
+	quarters.clear();
+
+	//as the eye moves, a waiting cell can end up nearer than the one holding its table entry or the farthest tile
+	reoffer = false;
+	if (!waiting.empty()) {
+		bool full = std::find(tileOwners.begin(), tileOwners.end(), ~0ull) == tileOwners.end();
+		float farthest = 0.f;
+		for (auto& [id, cell] : cells) farthest = std::max(farthest, DistanceSq(cell.x, cell.y));
+		for (auto& [id, cell] : waiting) {
+			float distance = DistanceSq(cell.x, cell.y);
+			int tile = window[WindowSlot(cell.x, cell.y)];
+			if (tile >= 0) {
+				const Cell& other = cells.at(tileOwners[tile]);
+				if (DistanceSq(other.x, other.y) <= distance) continue;
+			}
+			else if (full && farthest <= distance) continue;
+			reoffer = true;
+			break;
+		}
+	}
+	if (cells.empty()) return;
+
+	//every top level node in reach is a root
+	unsigned int top = settings.levels - 1;
+	float topSize = leafSize * (float)(1u << top);
+	float reach = ranges[top];
+	int x0 = (int)std::floor((eye[0] - reach) / topSize), x1 = (int)std::floor((eye[0] + reach) / topSize);
+	int y0 = (int)std::floor((eye[1] - reach) / topSize), y1 = (int)std::floor((eye[1] + reach) / topSize);
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) SelectNode(x * topSize, y * topSize, top, planes, selection);
+	}
+	selection.wholeCount = (unsigned int)std::min<size_t>(selection.patches.size(), maxPatches);
+	selection.patches.insert(selection.patches.end(), quarters.begin(), quarters.end());
+	if (selection.patches.size() > maxPatches) selection.patches.resize(maxPatches);
+}
+
+bool TerrainRenderer::SelectNode(float x, float y, unsigned int level, const float planes[6][4], Selection& selection) {
+	float size = leafSize * (float)(1u << level);
+	float boxMin[3], boxMax[3];
+	//nothing resident under it, nothing for the parent to draw either
+	if (!NodeBounds(x, y, size, boxMin[2], boxMax[2])) return true;
+	boxMin[0] = x;
+	boxMin[1] = y;
+	boxMax[0] = x + size;
+	boxMax[1] = y + size;
+	if (BoxDistanceSq(boxMin, boxMax, eye) > ranges[level] * ranges[level]) return false;
+	if (!BoxInFrustum(boxMin, boxMax, planes)) return true;
+
+	if (level == 0 || BoxDistanceSq(boxMin, boxMax, eye) > ranges[level - 1] * ranges[level - 1]) {
+		selection.patches.push_back({ x, y, size, (float)gridQuads });
+		return true;
+	}
+	//children out of their range leave their quarter to this level
+	float half = size * 0.5f;
+	for (int c = 0; c < 4; c++) {
+		float cx = x + (c & 1) * half, cy = y + (c >> 1) * half;
+		if (!SelectNode(cx, cy, level - 1, planes, selection)) quarters.push_back({ cx, cy, half, gridQuads * 0.5f });
+	}
+	return true;
+}
+
+void TerrainRenderer::Upload(const Selection& selection, UploadRing* uploads) {
+	Params params = {};
+	std::copy(selection.eye, selection.eye + 3, params.eye);
+	params.cellSize = settings.cellSize;
+	params.tileResolution = settings.tileResolution;
+	params.windowCells = settings.windowCells;
+	params.mipCount = mipCount;
+	params.leafSpacing = leafSize / gridQuads;
+	params.levels = settings.levels;
+	for (unsigned int l = 0; l < settings.levels; l++) {
+		//the last part of each level's range, from where the finer level hands over up to where the coarser one takes over
+		float previous = l > 0 ? ranges[l - 1] : 0.f;
+		params.morph[l][0] = previous + (ranges[l] - previous) * settings.morphStart;
+		params.morph[l][1] = ranges[l];
+	}
+	unsigned long long patchBytes = selection.patches.size() * sizeof(Patch);
+	if (uploads) {
+		uploads->Write(paramsBuffer, 0, &params, sizeof(Params));
+		if (patchBytes) uploads->Write(patchBuffer, 0, selection.patches.data(), patchBytes);
+	}
+	else {
+		queue.writeBuffer(paramsBuffer, 0, &params, sizeof(Params));
+		if (patchBytes) queue.writeBuffer(patchBuffer, 0, selection.patches.data(), patchBytes);
+	}
+}
+
+void TerrainRenderer::Draw(RenderPassEncoder& pass, BindGroup uniformGroup, const Selection& selection) {
+	unsigned int count = (unsigned int)selection.patches.size();
+	if (count == 0) return;
+	unsigned int whole = std::min(selection.wholeCount, count);
+	pass.setPipeline(pipeline);
+	pass.setBindGroup(0, uniformGroup, 0, nullptr);
+	pass.setBindGroup(1, terrainGroup, 0, nullptr);
+	pass.setVertexBuffer(0, gridVerts, 0, (unsigned long long)(gridQuads + 1) * (gridQuads + 1) * 2 * sizeof(float));
+	pass.setVertexBuffer(1, patchBuffer, 0, maxPatches * sizeof(Patch));
+	pass.setIndexBuffer(gridIdx, IndexFormat::Uint16, 0, ((unsigned long long)(wholeIdxCount + quarterIdxCount) * sizeof(unsigned short) + 3) & ~3ull);
+	if (whole > 0) pass.drawIndexed(wholeIdxCount, whole, 0, 0, 0);
+	if (count > whole) pass.drawIndexed(quarterIdxCount, count - whole, wholeIdxCount, 0, whole);
+}
+
+unsigned long long TerrainRenderer::TextureBytes() const {
+	unsigned long long bytes = 0;
+	for (unsigned int mip = 0; mip < mipCount; mip++) {
+		unsigned long long size = settings.tileResolution >> mip;
+		bytes += size * size * sizeof(float);
+	}
+	return bytes * settings.maxTiles;
+}
+
+unsigned long long TerrainRenderer::VertexCount(const Selection& selection) {
+	unsigned long long whole = std::min<size_t>(selection.wholeCount, selection.patches.size());
+	unsigned long long quarter = selection.patches.size() - whole;
+	return whole * (gridQuads + 1) * (gridQuads + 1) + quarter * (gridQuads / 2 + 1) * (gridQuads / 2 + 1);
+}
+
+bool TerrainRenderer::ReadHeights(Eso::TerrainFile& terrain, const Settings& settings, std::vector<float>& samples, unsigned int& width, unsigned int& height) {
+	//the height layer isn't known for every world, so without one given take the first with 16 or 32 bit samples
+	//on a square grid. 32 bits are floats, smaller ones unsigned steps of heightScale
+	int first = settings.heightLayer >= 0 ? settings.heightLayer : 0;
+	int last = settings.heightLayer >= 0 ? settings.heightLayer : terrain.layerCount - 1;
+	for (int i = first; i <= last; i++) {
+		Eso::TerrainLayer* layer = terrain.Layer(i);
+		if (!layer || layer->rowCount == 0 || layer->rowSize % layer->rowCount != 0) continue;
+		unsigned int bytes = layer->rowSize / layer->rowCount;
+		if (bytes != 4 && bytes != 2 && !(bytes == 1 && settings.heightLayer >= 0)) continue;
+		const char* data = layer->Data();
+		if (!data) continue;
+
+		width = layer->rowCount;
+		height = layer->rowCount;
+		samples.resize((size_t)width * height);
+		for (size_t s = 0; s < samples.size(); s++) {
+			if (bytes == 4) {
+				float value;
+				std::memcpy(&value, data + s * 4, 4);
+				samples[s] = std::isfinite(value) ? value : 0.f;
+			}
+			else if (bytes == 2) {
+				unsigned short value;
+				std::memcpy(&value, data + s * 2, 2);
+				samples[s] = value * settings.heightScale;
+			}
+			else samples[s] = (unsigned char)data[s] * settings.heightScale;
+		}
+		return true;
+	}
+	return false;
+}
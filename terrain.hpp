@@ -0,0 +1,139 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "webgpu\webgpu.hpp"
+#include "EsoWorld.h"
+#include "uploadRing.hpp"
+
+//heightmap terrain for streamed terrain cells, drawn with cdlod (strugar 2009). a quadtree over the world is walked on the cpu
+//every frame and each selected node is one instance of a shared grid mesh, whose vertices morph into the next coarser grid
+//towards the end of their lod range so neighbouring levels meet without cracks or pops.
+//heights live in a texture array with a fixed number of tiles, one per cell, mipmapped for the coarser levels, so memory is
+//bounded however many cells are loaded and the patch count only grows with the log of the view distance
+class TerrainRenderer {
+public:
+	struct Settings {
+		float cellSize = 100.f; //same as StreamerSettings::cellSize
+		unsigned int tileResolution = 64; //height texels along a cell, cells are resampled to this, a power of two
+		unsigned int maxTiles = 256; //resident cells, the ones farthest from the eye give way past this
+		unsigned int windowCells = 64; //side of the wrapped cell to tile table, cells this far apart compete for an entry
+		unsigned int levels = 8; //at most maxLevels
+		float lodRangeRatio = 2.f; //a level's range in multiples of its node size
+		float morphStart = 0.7f; //fraction of a level's range where it starts morphing into the next one
+		float heightScale = 1.f / 64.f; //world units per step for 8 and 16 bit height layers
+		int heightLayer = -1; //terrain layer with the heights, -1 takes the first one with 16 or 32 bit samples
+	};
+
+	//one instance of the grid mesh, quads is gridQuads for a whole node or half that for the quarter of one
+	//that has to be drawn at its level because the child covering it is out of range
+	struct Patch {
+		float x, y; //world space corner
+		float size;
+		float quads;
+	};
+
+	struct Selection {
+		std::vector<Patch> patches; //whole nodes first, then quarters
+		unsigned int wholeCount = 0;
+		float eye[3] = {};
+	};
+
+	static const unsigned int maxLevels = 16;
+	static const unsigned int gridQuads = 32;
+	static const unsigned int maxPatches = 4096;
+
+	//uniformLayout is group 0, shared with the other pipelines
+	TerrainRenderer(wgpu::Device device, wgpu::Queue queue, wgpu::ShaderModule shader, wgpu::BindGroupLayout uniformLayout,
+		wgpu::TextureFormat colorFormat, wgpu::TextureFormat depthFormat, const Settings& settings = Settings());
+	~TerrainRenderer();
+	TerrainRenderer(const TerrainRenderer&) = delete;
+	TerrainRenderer& operator=(const TerrainRenderer&) = delete;
+
+	//resamples the cell's height layer into a free tile and uploads it with its mips. when every tile or the cell's table entry
+	//is taken, whichever cell is farther from the last Select's eye loses out. false if the cell has no usable heights or lost.
+	//a cell that loses, now or later, waits to be offered again, so terrain has to stay alive until RemoveCell
+	bool AddCell(unsigned long long id, unsigned int x, unsigned int y, Eso::TerrainFile& terrain);
+	void RemoveCell(unsigned long long id);
+	//true when the last Select found a waiting cell that would now win its tile
+	bool ReofferPending() const { return reoffer; }
+	//adds those cells again, nearest first. call it where AddCell could be called
+	void Reoffer();
+
+	//picks the nodes to draw for eye, inside the frustum (inward facing planes). only reads what Add/RemoveCell change
+	void Select(const float eye[3], const float planes[6][4], Selection& selection);
+	//the selection's patches and eye, through uploads if there are any, before the encoder that draws them is recorded
+	void Upload(const Selection& selection, UploadRing* uploads = nullptr);
+	void Draw(wgpu::RenderPassEncoder& pass, wgpu::BindGroup uniformGroup, const Selection& selection);
+
+	size_t TileCount() const { return cells.size(); }
+	unsigned long long TextureBytes() const;
+	//vertices the selection runs through the vertex shader
+	static unsigned long long VertexCount(const Selection& selection);
+
+private:
+	//mirrors TerrainParams in terrain.wgsl
+	struct Params {
+		float eye[4];
+		float cellSize;
+		unsigned int tileResolution;
+		unsigned int windowCells;
+		unsigned int mipCount;
+		float leafSpacing;
+		unsigned int levels;
+		float padding[2];
+		float morph[maxLevels][4]; //start and end distance of each level's morph
+	};
+
+	struct Cell {
+		unsigned int x, y;
+		unsigned int tile;
+		float minHeight, maxHeight;
+		Eso::TerrainFile* terrain;
+	};
+
+	struct Waiting {
+		unsigned int x, y;
+		Eso::TerrainFile* terrain;
+	};
+
+	wgpu::Device device;
+	wgpu::Queue queue;
+	Settings settings;
+	unsigned int mipCount;
+	float leafSize; //node size at level 0, its grid spacing is one texel
+	float ranges[maxLevels];
+
+	wgpu::Texture heights = nullptr;
+	wgpu::TextureView heightsView = nullptr;
+	wgpu::Buffer windowBuffer = nullptr; //tile per wrapped cell, -1 for none
+	wgpu::Buffer tileCellBuffer = nullptr; //cell each tile holds, to tell wrapped cells apart
+	wgpu::Buffer paramsBuffer = nullptr;
+	wgpu::Buffer patchBuffer = nullptr;
+	wgpu::Buffer gridVerts = nullptr;
+	wgpu::Buffer gridIdx = nullptr;
+	unsigned int wholeIdxCount = 0;
+	unsigned int quarterIdxCount = 0;
+	wgpu::BindGroupLayout terrainLayout = nullptr;
+	wgpu::BindGroup terrainGroup = nullptr;
+	wgpu::PipelineLayout pipelineLayout = nullptr;
+	wgpu::RenderPipeline pipeline = nullptr;
+
+	std::unordered_map<unsigned long long, Cell> cells;
+	std::unordered_map<unsigned long long, Waiting> waiting; //cells that lost their tile or table entry
+	bool reoffer = false;
+	std::vector<unsigned long long> tileOwners; //cell id per tile, ~0 for free
+	std::vector<int> window; //cpu copy of windowBuffer
+	float eye[3] = {};
+	std::vector<Patch> quarters; //Select scratch
+
+	unsigned int WindowSlot(unsigned int x, unsigned int y) const;
+	float DistanceSq(unsigned int x, unsigned int y) const; //cell centre to eye, in the ground plane
+	void Evict(unsigned long long id);
+	//evicts a cell for a nearer one, it waits to be offered again
+	void Displace(unsigned long long id);
+	//height range of the resident cells under a node, false if there are none
+	bool NodeBounds(float x, float y, float size, float& minHeight, float& maxHeight) const;
+	//false when the node is out of its level's range, the parent then covers its area
+	bool SelectNode(float x, float y, unsigned int level, const float planes[6][4], Selection& selection);
+	static bool ReadHeights(Eso::TerrainFile& terrain, const Settings& settings, std::vector<float>& samples, unsigned int& width, unsigned int& height);
+};
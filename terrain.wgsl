@@ -0,0 +1,117 @@
+//cdlod terrain for TerrainRenderer. every instance is a patch of the shared grid, heights come from one texture array
+//tile per cell, found through a table indexed by the cell coordinates wrapped to windowCells
+
+struct Uniforms {
+    proj: mat4x4<f32>,
+    view: mat4x4<f32>,
+    time: f32,
+    rotationSpeed: f32,
+    padding: vec2f,
+    frustum: array<vec4f, 6>,
+};
+
+//see TerrainRenderer::Params
+struct TerrainParams {
+    eye: vec4f,
+    cellSize: f32,
+    tileResolution: u32,
+    windowCells: u32,
+    mipCount: u32,
+    leafSpacing: f32, //grid spacing at level 0, one texel of mip 0
+    levels: u32,
+    padding: vec2f,
+    morph: array<vec4f, 16>, //x start, y end distance of each level's morph
+};
+
+struct TerrainInput {
+    @location(0) grid: vec2f, //0 to 1 across the patch
+    @location(1) node: vec4f, //TerrainRenderer::Patch
+};
+
+struct TerrainOutput {
+    @builtin(position) position: vec4f,
+    @location(0) normal: vec3f,
+};
+
+@group(0) @binding(0) var<uniform> uniforms: Uniforms;
+@group(1) @binding(0) var heights: texture_2d_array<f32>;
+@group(1) @binding(1) var<storage, read> window: array<i32>;
+@group(1) @binding(2) var<storage, read> tileCells: array<vec2<i32>>;
+@group(1) @binding(3) var<uniform> params: TerrainParams;
+
+//height of one texel in world texel coordinates of mip, y is 0 when its cell isn't resident
+fn texel(p: vec2i, mip: u32) -> vec2f {
+    let res = i32(params.tileResolution >> mip);
+    let cell = vec2i(floor(vec2f(p) / f32(res)));
+    if (cell.x < 0 || cell.y < 0) {
+        return vec2f(0.0);
+    }
+    let w = i32(params.windowCells);
+    let tile = window[(cell.y % w) * w + cell.x % w];
+    if (tile < 0 || any(tileCells[tile] != cell)) {
+        return vec2f(0.0);
+    }
+    return vec2f(textureLoad(heights, p - cell * res, tile, i32(mip)).r, 1.0);
+}
+
+//bilinear across cell edges, missing cells are left out of the weights
+fn sampleHeight(world: vec2f, level: u32) -> f32 {
+    let mip = min(level, params.mipCount - 1u);
+    let t = world / params.cellSize * f32(params.tileResolution >> mip) - 0.5;
+    let base = vec2i(floor(t));
+    let f = t - floor(t);
+    let a = texel(base, mip);
+    let b = texel(base + vec2i(1, 0), mip);
+    let c = texel(base + vec2i(0, 1), mip);
+    let d = texel(base + vec2i(1, 1), mip);
+    let wa = (1.0 - f.x) * (1.0 - f.y) * a.y;
+    let wb = f.x * (1.0 - f.y) * b.y;
+    let wc = (1.0 - f.x) * f.y * c.y;
+    let wd = f.x * f.y * d.y;
+    let total = wa + wb + wc + wd;
+    if (total <= 0.0) {
+        return 0.0;
+    }
+    return (a.x * wa + b.x * wb + c.x * wc + d.x * wd) / total;
+}
+
+//fully morphed vertices sit on the next level's grid and take its heights, so both sides of a level change agree
+fn terrainHeight(world: vec2f, level: u32, morph: f32) -> f32 {
+    let fine = sampleHeight(world, level);
+    if (morph <= 0.0) {
+        return fine;
+    }
+    return mix(fine, sampleHeight(world, level + 1u), morph);
+}
+
+@vertex
+fn vs_terrain(in: TerrainInput) -> TerrainOutput {
+    var out: TerrainOutput;
+    let quads = in.node.w;
+    let spacing = in.node.z / quads;
+    let level = min(u32(round(log2(spacing / params.leafSpacing))), params.levels - 1u);
+    var world = in.node.xy + in.grid * in.node.z;
+
+    let range = params.morph[level];
+    let eyeDistance = length(vec3f(world, sampleHeight(world, level)) - params.eye.xyz);
+    let morph = clamp((eyeDistance - range.x) / max(range.y - range.x, 1e-4), 0.0, 1.0);
+    //odd vertices slide onto their even neighbour, which turns the grid into one of half the resolution
+    world -= fract(in.grid * quads * 0.5) * 2.0 * spacing * morph;
+
+    let height = terrainHeight(world, level, morph);
+    let dx = terrainHeight(world + vec2f(spacing, 0.0), level, morph) - terrainHeight(world - vec2f(spacing, 0.0), level, morph);
+    let dy = terrainHeight(world + vec2f(0.0, spacing), level, morph) - terrainHeight(world - vec2f(0.0, spacing), level, morph);
+    out.normal = normalize(vec3f(-dx, -dy, 2.0 * spacing));
+    out.position = uniforms.proj * uniforms.view * vec4f(world, height, 1.0);
+    return out;
+}
+
+@fragment
+fn fs_terrain(in: TerrainOutput) -> @location(0) vec4f {
+    let normal = normalize(in.normal);
+    let grass = vec3f(0.28, 0.38, 0.16);
+    let rock = vec3f(0.42, 0.39, 0.36);
+    let albedo = mix(rock, grass, smoothstep(0.7, 0.85, normal.z));
+    let light = max(dot(normal, normalize(vec3f(0.4, 0.3, 0.85))), 0.0) * 0.8 + 0.2;
+    return vec4f(albedo * light, 1.0);
+}
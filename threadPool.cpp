@@ -0,0 +1,83 @@
+#include "threadPool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) {
+	if (threadCount <= 0) threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	for (int i = 0; i < threadCount + 1; i++) queues.push_back(std::make_unique<Queue>());
+	for (int i = 0; i < threadCount; i++) workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& task) {
+	if (count == 0) return;
+	grain = std::max<size_t>(grain, 1);
+	size_t chunks = (count + grain - 1) / grain;
+	if (chunks == 1 || workers.empty()) {
+		task(0, count);
+		return;
+	}
+
+	//deal the chunks out round robin, stealing sorts out the rest
+	std::atomic<size_t> remaining = chunks;
+	for (size_t c = 0; c < chunks; c++) {
+		Queue& queue = *queues[c % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back({ &task, c * grain, std::min(count, (c + 1) * grain), &remaining });
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued += chunks;
+	}
+	wake.notify_all();
+
+	int callerQueue = (int)queues.size() - 1;
+	while (remaining.load() > 0) {
+		if (!TryRun(callerQueue)) std::this_thread::yield();
+	}
+}
+
+void ThreadPool::WorkerLoop(int index) {
+	while (true) {
+		if (TryRun(index)) continue;
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+		if (stopping) return;
+	}
+}
+
+bool ThreadPool::TryRun(int index) {
+	Job job;
+	bool found = false;
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = own.jobs.back();
+			own.jobs.pop_back();
+			found = true;
+		}
+	}
+	for (size_t i = 1; i < queues.size() && !found; i++) {
+		Queue& victim = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			found = true;
+		}
+	}
+	if (!found) return false;
+
+	queued--;
+	(*job.task)(job.begin, job.end);
+	job.remaining->fetch_sub(1);
+	return true;
+}
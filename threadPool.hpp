@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//fork/join pool for data parallel loops. every worker has its own queue and steals from the others once it runs dry,
+//so uneven chunks even out without a central queue everyone fights over
+class ThreadPool {
+public:
+	//0 uses one thread per core minus the caller
+	ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	//runs task(begin, end) over [0, count) in chunks of about grain, the calling thread helps out and it returns once everything ran.
+	//more than one thread can be in here at once, each only waits for its own chunks
+	void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& task);
+
+	int ThreadCount() const { return (int)workers.size(); }
+
+private:
+	struct Job {
+		const std::function<void(size_t, size_t)>* task;
+		size_t begin;
+		size_t end;
+		std::atomic<size_t>* remaining;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues; //one per worker, the last one is for callers
+	std::vector<std::thread> workers;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<size_t> queued = 0;
+	bool stopping = false;
+
+	void WorkerLoop(int index);
+	//own queue from the back, everyone else's from the front
+	bool TryRun(int index);
+};
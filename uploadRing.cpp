@@ -0,0 +1,124 @@
+#include "uploadRing.hpp"
+#include "webgpu\wgpu.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+using namespace wgpu;
+
+UploadRing::UploadRing(Device device, Queue queue, unsigned long long frameBytes, unsigned int framesInFlight)
+	: device(device), queue(queue), frameBytes((frameBytes + 3) & ~3ull), frames(std::max(framesInFlight, 1u)) {
+	//mapped at creation so the first frames don't have to wait for anything
+	for (Frame& frame : frames) {
+		BufferDescriptor desc;
+		desc.size = this->frameBytes;
+		desc.usage = BufferUsage::MapWrite | BufferUsage::CopySrc;
+		desc.mappedAtCreation = true;
+		desc.label = "upload ring";
+		frame.buffer = device.createBuffer(desc);
+		frame.data = (char*)frame.buffer.getMappedRange(0, this->frameBytes);
+		frame.state = frame.data ? FrameState::Mapped : FrameState::Failed;
+	}
+}
+
+UploadRing::~UploadRing() {
+	//the callbacks still point at the frames
+	for (Frame& frame : frames) {
+		while (frame.state == FrameState::Mapping) wgpuDevicePoll(device, true, nullptr);
+	}
+	for (Frame& frame : frames) {
+		if (frame.state == FrameState::Mapped) frame.buffer.unmap();
+		frame.buffer.drop();
+	}
+}
+
+void UploadRing::BeginFrame() {
+	//nothing was flushed since the last BeginFrame, keep filling the same buffer so those writes aren't lost
+	if (frames[current].state == FrameState::Mapped) return;
+	current = (current + 1) % frames.size();
+	used = 0;
+	stats.bytes = 0;
+	stats.overflowBytes = 0;
+	stats.copies = 0;
+
+	Frame& frame = frames[current];
+	if (frame.state == FrameState::InFlight) {
+		//Submitted was skipped, map it now
+		frame.state = FrameState::Mapping;
+		wgpuBufferMapAsync(frame.buffer, WGPUMapMode_Write, 0, frameBytes, OnMapped, &frame);
+	}
+	if (frame.state == FrameState::Mapping) {
+		wgpuDevicePoll(device, false, nullptr);
+		if (frame.state == FrameState::Mapping) {
+			stats.stalls++;
+			while (frame.state == FrameState::Mapping) wgpuDevicePoll(device, true, nullptr);
+		}
+	}
+	if (frame.state == FrameState::Mapped && !frame.data) frame.data = (char*)frame.buffer.getMappedRange(0, frameBytes);
+}
+
+void* UploadRing::Allocate(Buffer destination, unsigned long long offset, unsigned long long size) {
+	Frame& frame = frames[current];
+	if (frame.state != FrameState::Mapped || !frame.data || used + size > frameBytes) return nullptr;
+
+	unsigned long long srcOffset = used;
+	used += (size + 3) & ~3ull;
+	stats.bytes += size;
+	stats.totalBytes += size;
+
+	//carries on where the last write to this buffer stopped, in both buffers, so grow its copy
+	if (!copies.empty()) {
+		Copy& last = copies.back();
+		if (last.destination == destination && last.srcOffset + last.size == srcOffset && last.dstOffset + last.size == offset) {
+			last.size += size;
+			return frame.data + srcOffset;
+		}
+	}
+	copies.push_back({ destination, srcOffset, offset, size });
+	return frame.data + srcOffset;
+}
+
+void UploadRing::Write(Buffer destination, unsigned long long offset, const void* data, unsigned long long size) {
+	if (size == 0) return;
+	void* staging = Allocate(destination, offset, size);
+	if (staging) {
+		std::memcpy(staging, data, size);
+		return;
+	}
+	stats.overflowBytes += size;
+	stats.totalBytes += size;
+	queue.writeBuffer(destination, offset, data, size);
+}
+
+void UploadRing::Flush(CommandEncoder& encoder) {
+	Frame& frame = frames[current];
+	if (frame.state != FrameState::Mapped) {
+		copies.clear();
+		return;
+	}
+	frame.buffer.unmap();
+	frame.data = nullptr;
+	frame.state = FrameState::InFlight;
+	for (const Copy& copy : copies) {
+		encoder.copyBufferToBuffer(frame.buffer, copy.srcOffset, copy.destination, copy.dstOffset, copy.size);
+	}
+	stats.copies = (unsigned int)copies.size();
+	copies.clear();
+}
+
+void UploadRing::Submitted() {
+	Frame& frame = frames[current];
+	if (frame.state != FrameState::InFlight) return;
+	frame.state = FrameState::Mapping;
+	wgpuBufferMapAsync(frame.buffer, WGPUMapMode_Write, 0, frameBytes, OnMapped, &frame);
+}
+
+void UploadRing::OnMapped(WGPUBufferMapAsyncStatus status, void* userData) {
+	Frame& frame = *reinterpret_cast<Frame*>(userData);
+	if (status == WGPUBufferMapAsyncStatus_Success) {
+		frame.state = FrameState::Mapped;
+	}
+	else {
+		std::cout << "Upload ring buffer failed to map (" << status << "), its frames fall back to writeBuffer\n";
+		frame.state = FrameState::Failed;
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include "webgpu\webgpu.hpp"
+
+//per frame uploads through a few persistently reused staging buffers, one per frame in flight,
+//instead of a queue.writeBuffer (and a driver side staging allocation) for every write
+//writes are suballocated from the current frame's buffer and become copyBufferToBuffer calls on Flush,
+//a write that carries on where the last one to the same buffer stopped shares its copy
+class UploadRing {
+public:
+	struct Stats {
+		unsigned long long bytes = 0; //staged this frame
+		unsigned long long overflowBytes = 0; //this frame, didn't fit and went through queue.writeBuffer
+		unsigned int copies = 0; //this frame
+		unsigned long long totalBytes = 0;
+		unsigned int stalls = 0; //times BeginFrame had to wait for the gpu to give a buffer back
+	};
+
+	UploadRing(wgpu::Device device, wgpu::Queue queue, unsigned long long frameBytes, unsigned int framesInFlight = 3);
+	~UploadRing();
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	//moves on to the next buffer once the current one was flushed, waiting for the gpu if it is still copying out of it
+	void BeginFrame();
+	//staging memory for size bytes going to destination at offset, the caller fills it in before Flush
+	//offset and size have to be multiples of 4. nullptr when the frame's buffer is full
+	void* Allocate(wgpu::Buffer destination, unsigned long long offset, unsigned long long size);
+	//Allocate and copy, or queue.writeBuffer when the frame's buffer is full
+	void Write(wgpu::Buffer destination, unsigned long long offset, const void* data, unsigned long long size);
+	//unmaps the buffer and records the copies, before anything in encoder that reads the destinations
+	void Flush(wgpu::CommandEncoder& encoder);
+	//once the encoder from Flush has been submitted, starts mapping the buffer again for its next turn
+	void Submitted();
+
+	const Stats& GetStats() const { return stats; }
+	unsigned long long FrameBytes() const { return frameBytes; }
+	unsigned int FramesInFlight() const { return (unsigned int)frames.size(); }
+
+private:
+	enum class FrameState {
+		Mapped,
+		InFlight, //unmapped, its copies are submitted or about to be
+		Mapping,
+		Failed,
+	};
+
+	struct Frame {
+		wgpu::Buffer buffer = nullptr;
+		char* data = nullptr;
+		FrameState state = FrameState::Mapped;
+	};
+
+	struct Copy {
+		wgpu::Buffer destination;
+		unsigned long long srcOffset;
+		unsigned long long dstOffset;
+		unsigned long long size;
+	};
+
+	wgpu::Device device;
+	wgpu::Queue queue;
+	unsigned long long frameBytes;
+	std::vector<Frame> frames; //never resized, the map callbacks point into it
+	unsigned int current = 0;
+	unsigned long long used = 0;
+	std::vector<Copy> copies;
+	Stats stats;
+
+	static void OnMapped(WGPUBufferMapAsyncStatus status, void* userData);
+};
@@ -0,0 +1,172 @@
+#include "vertexConvert.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTEX_CONVERT_SSE
+#endif
+
+void ConvertEsoVertsScalar(char* verts, int begin, int end) {
+	float* floatVertBuffer = (float*)verts;
+	for (int i = begin; i < end; i++) {
+		EsoVert* vert = (EsoVert*)(verts + 32 * i);
+		//negations rather than * -1, which compilers may or may not turn into one, so nan normals keep the same bits as the sse path
+		vert->x = -vert->x;
+		bool inverted = false;
+		if (0 > vert->nx) {
+			vert->nx = vert->nx + 32768;
+			inverted = true;
+		}
+		if (0 > vert->ny) {
+			vert->ny = vert->ny + 32768;
+			inverted = true;
+		}
+		//vert->u = bx::halfFromFloat(vert->u / 1024.f);
+		//vert->v = bx::halfFromFloat(vert->v / -1024.f);
+
+
+		float fnormX = ((float)vert->nx) / -16384.f + 1.f;
+		float fnormY = ((float)vert->ny) / 16384.f - 1.f;
+		float fnormZ = std::sqrt(1 - fnormX * fnormX - fnormY * fnormY);
+		if (inverted) fnormZ = -fnormZ;
+		floatVertBuffer[i * 8 + 4] = fnormX;
+		floatVertBuffer[i * 8 + 5] = fnormY;
+		floatVertBuffer[i * 8 + 6] = fnormZ;
+	}
+}
+
+#ifdef VERTEX_CONVERT_SSE
+//same maths as the scalar version, 4 verts at a time. the verts are 32 bytes apart so loads and stores are per lane
+static void ConvertEsoVertsSSE(char* verts, int begin, int end) {
+	const __m128 sign = _mm_set1_ps(-0.f);
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 scaleX = _mm_set1_ps(-16384.f);
+	const __m128 scaleY = _mm_set1_ps(16384.f);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wrap = _mm_set1_epi32(32768);
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4) {
+		EsoVert* v0 = (EsoVert*)(verts + 32 * (i + 0));
+		EsoVert* v1 = (EsoVert*)(verts + 32 * (i + 1));
+		EsoVert* v2 = (EsoVert*)(verts + 32 * (i + 2));
+		EsoVert* v3 = (EsoVert*)(verts + 32 * (i + 3));
+
+		__m128 x = _mm_xor_ps(_mm_set_ps(v3->x, v2->x, v1->x, v0->x), sign);
+		__m128i nx = _mm_set_epi32(v3->nx, v2->nx, v1->nx, v0->nx);
+		__m128i ny = _mm_set_epi32(v3->ny, v2->ny, v1->ny, v0->ny);
+
+		__m128i negX = _mm_cmplt_epi32(nx, zero);
+		__m128i negY = _mm_cmplt_epi32(ny, zero);
+		nx = _mm_add_epi32(nx, _mm_and_si128(negX, wrap));
+		ny = _mm_add_epi32(ny, _mm_and_si128(negY, wrap));
+		__m128 inverted = _mm_castsi128_ps(_mm_or_si128(negX, negY));
+
+		__m128 fx = _mm_add_ps(_mm_div_ps(_mm_cvtepi32_ps(nx), scaleX), one);
+		__m128 fy = _mm_sub_ps(_mm_div_ps(_mm_cvtepi32_ps(ny), scaleY), one);
+		__m128 fz = _mm_sqrt_ps(_mm_sub_ps(_mm_sub_ps(one, _mm_mul_ps(fx, fx)), _mm_mul_ps(fy, fy)));
+		fz = _mm_xor_ps(fz, _mm_and_ps(inverted, sign));
+
+		alignas(16) float outX[4], outNX[4], outNY[4], outNZ[4];
+		_mm_store_ps(outX, x);
+		_mm_store_ps(outNX, fx);
+		_mm_store_ps(outNY, fy);
+		_mm_store_ps(outNZ, fz);
+		EsoVert* lanes[4] = { v0, v1, v2, v3 };
+		for (int lane = 0; lane < 4; lane++) {
+			float* out = (float*)lanes[lane];
+			out[0] = outX[lane];
+			out[4] = outNX[lane];
+			out[5] = outNY[lane];
+			out[6] = outNZ[lane];
+		}
+	}
+	ConvertEsoVertsScalar(verts, i, end);
+}
+#endif
+
+void ConvertEsoVertsSimd(char* verts, int begin, int end) {
+#ifdef VERTEX_CONVERT_SSE
+	ConvertEsoVertsSSE(verts, begin, end);
+#else
+	ConvertEsoVertsScalar(verts, begin, end);
+#endif
+}
+
+void ConvertEsoVerts(char* verts, int vertCount) {
+	//below this the thread startup costs more than the conversion
+	const int minVertsPerThread = 32768;
+	int threadCount = std::min((int)std::max(1u, std::thread::hardware_concurrency()), vertCount / minVertsPerThread);
+	if (threadCount <= 1) {
+		ConvertEsoVertsSimd(verts, 0, vertCount);
+		return;
+	}
+
+	//chunks are multiples of 4 so every thread but the last stays on the simd path
+	int chunk = ((vertCount + threadCount - 1) / threadCount + 3) & ~3;
+	std::vector<std::thread> threads;
+	for (int begin = chunk; begin < vertCount; begin += chunk) {
+		threads.emplace_back(ConvertEsoVertsSimd, verts, begin, std::min(begin + chunk, vertCount));
+	}
+	ConvertEsoVertsSimd(verts, 0, std::min(chunk, vertCount));
+	for (std::thread& thread : threads) thread.join();
+}
+
+static short PackSnorm16(float v) {
+	v = std::clamp(v, -1.f, 1.f);
+	return (short)std::lround(v * 32767.f);
+}
+
+void CompactEsoVerts(const char* verts, int vertCount, CompactVert* out, float boundsMin[3], float boundsExtent[3]) {
+	float boundsMax[3];
+	for (int c = 0; c < 3; c++) {
+		boundsMin[c] = vertCount > 0 ? INFINITY : 0.f;
+		boundsMax[c] = vertCount > 0 ? -INFINITY : 0.f;
+	}
+	for (int i = 0; i < vertCount; i++) {
+		const float* vert = (const float*)(verts + 32 * i);
+		for (int c = 0; c < 3; c++) {
+			boundsMin[c] = std::min(boundsMin[c], vert[c]);
+			boundsMax[c] = std::max(boundsMax[c], vert[c]);
+		}
+	}
+	float scale[3];
+	for (int c = 0; c < 3; c++) {
+		boundsExtent[c] = boundsMax[c] - boundsMin[c];
+		scale[c] = boundsExtent[c] > 0.f ? 65535.f / boundsExtent[c] : 0.f;
+	}
+
+	for (int i = 0; i < vertCount; i++) {
+		const float* vert = (const float*)(verts + 32 * i);
+		CompactVert& packed = out[i];
+		packed.px = (unsigned short)std::lround((vert[0] - boundsMin[0]) * scale[0]);
+		packed.py = (unsigned short)std::lround((vert[1] - boundsMin[1]) * scale[1]);
+		packed.pz = (unsigned short)std::lround((vert[2] - boundsMin[2]) * scale[2]);
+		packed.pw = 0;
+
+		//octahedral, fold the lower hemisphere over the diagonals
+		float nx = vert[4], ny = vert[5], nz = vert[6];
+		if (std::isnan(nz)) nz = 0.f; //reconstruction can go slightly negative under the sqrt
+		float sum = std::abs(nx) + std::abs(ny) + std::abs(nz);
+		if (sum > 0.f) {
+			nx /= sum;
+			ny /= sum;
+		}
+		if (nz < 0.f) {
+			float foldX = (1.f - std::abs(ny)) * (nx >= 0.f ? 1.f : -1.f);
+			float foldY = (1.f - std::abs(nx)) * (ny >= 0.f ? 1.f : -1.f);
+			nx = foldX;
+			ny = foldY;
+		}
+		packed.nx = PackSnorm16(nx);
+		packed.ny = PackSnorm16(ny);
+
+		const EsoVert* source = (const EsoVert*)vert;
+		packed.u = source->u;
+		packed.v = source->v;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+//full is the 32 byte granny layout with float normals, compact is CompactVert, decoded in vs_compact
+enum class VertexLayout { Full, Compact };
+
+//vertex layout as it comes out of granny for eso meshes
+struct EsoVert {
+	float x; //4
+	float y; //8
+	float z; //12
+	char r;  //13
+	char g;  //14
+	char b;  //15
+	char a;  //16
+	short nx;//18
+	short ny;//20
+	short tx;//22
+	short ty;//24
+	short bx;//26
+	short by;//28
+	short u; //30
+	short v; //32
+};
+
+//flips x and decodes the packed normal into floats 4-6 (over nx..by), in place on 32 byte verts
+//large meshes are split across threads, batches of 4 verts go through sse when it's available
+void ConvertEsoVerts(char* verts, int vertCount);
+
+//reference version, the simd path has to match it bit for bit
+void ConvertEsoVertsScalar(char* verts, int begin, int end);
+//one thread, what ConvertEsoVerts runs on each thread's range. sse where it's available, scalar otherwise
+void ConvertEsoVertsSimd(char* verts, int begin, int end);
+
+//16 byte vertex for the compact pipeline layout: position quantized to the mesh bounds, octahedral normal, original uvs
+struct CompactVert {
+	unsigned short px, py, pz, pw; //unorm16 relative to boundsMin / boundsExtent
+	short nx, ny; //snorm16 octahedral
+	short u, v;
+};
+
+//packs converted 32 byte verts (after ConvertEsoVerts) into CompactVerts and reports the bounds the shader needs to decode them
+void CompactEsoVerts(const char* verts, int vertCount, CompactVert* out, float boundsMin[3], float boundsExtent[3]);